@@ -13,6 +13,8 @@
 
 static button* buttonChainList = NULL;
 
+MODULE(button, MOD_BUTTON, 0, 0, &buttonInit);
+
 void buttonInit(uint32_t msg) {
 	tTask* proc = repeat("BTN_PROC",BUTTON_RATE, &buttonProcessor);
 	proc->timeout = ST_SEC;
@@ -24,7 +26,7 @@ void buttonInit(uint32_t msg) {
 button* buttonAdd(char* name, GPIO_TypeDef* port, uint8_t pinNumber, uint8_t type) {
     GPIO_InitTypeDef GPIO_InitStruct = {0};
 
-    button* btn = malloc(sizeof(button));
+    button* btn = memAlloc(MEM_BUTTONS, sizeof(button));
     if (!btn) return NULL;
 
     btn->name =  name;
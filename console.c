@@ -7,6 +7,7 @@
  */
 
 #include "console.h"
+#include <stdarg.h>
 
 #ifdef USING_CONSOLE
 
@@ -15,8 +16,24 @@
 
 	static consoleApp *appList = NULL;
 
-	void monitorAppDraw() {
-		printf("--- < App > ---");
+	// back buffer is rendered every frame, front buffer is what the terminal shows
+	static consoleCell screenBack[CONSOLE_SCREEN_H][CONSOLE_SCREEN_W];
+	static consoleCell screenFront[CONSOLE_SCREEN_H][CONSOLE_SCREEN_W];
+	static uint8_t screenValid = 0;
+
+	// output is collected and written in blocks
+	static char screenOut[64];
+	static uint8_t screenOutLen = 0;
+
+	// wire statistics
+	static uint32_t screenFrames = 0;
+	static uint32_t screenBytesLast = 0;
+	static uint32_t screenBytesTotal = 0;
+	static uint32_t screenBytesFull = 0; // last full redraw, what every frame cost before diffing
+
+	void monitorAppDraw(consoleApp* app) {
+		consoleAppPrint(app, 0, 0, "--- < App > ---");
+		consoleAppPrint(app, 0, 2, "Alive %lus", (unsigned long)(uwTick / ST_SEC));
 	}
 
 	void consoleGui(char* name) {
@@ -25,36 +42,144 @@
 	}
 
 
-	static void drawAppWindow(const consoleApp *a) {
+	static void screenFlush(void) {
+		if (screenOutLen) fwrite(screenOut, 1, screenOutLen, stdout);
+		screenOutLen = 0;
+	}
+
+	static void screenEmit(const char* data, int len) {
+		screenBytesLast += len;
+		while (len--) {
+			if (screenOutLen == sizeof(screenOut)) screenFlush();
+			screenOut[screenOutLen++] = *data++;
+		}
+	}
+
+	// 1-based console coordinates, clipped to the screen
+	static void screenPut(int x, int y, char ch, uint8_t color) {
+		if (x < 1 || y < 1 || x > CONSOLE_SCREEN_W || y > CONSOLE_SCREEN_H) return;
+		screenBack[y - 1][x - 1].ch = ch;
+		screenBack[y - 1][x - 1].color = color;
+	}
+
+	static void drawAppWindow(consoleApp *a) {
+		uint8_t color = CONSOLE_COLOR(a->fg, a->bg);
+
 	    // 1) fill background
-	    setBackgroundColor(a->bg);
-	   // for (int row = 0; row < a->h; ++row) {
-	    //    gotoxy(a->x, a->y + row);
-	    //    for (int col = 0; col < a->w; ++col) putchar(' ');
-	    //}
+		for (int row = 0; row < a->h; ++row)
+			for (int col = 0; col < a->w; ++col)
+				screenPut(a->x + col, a->y + row, ' ', color);
 
 	    // 2) draw frame (borders) in fg
-	    setBackgroundColor(a->bg);
-	    setTextColor(a->fg);
-	    drawFrame(a->x, a->y, a->w, a->h);
+		if (a->w >= 2 && a->h >= 2) {
+			for (int col = 1; col < a->w - 1; ++col) {
+				screenPut(a->x + col, a->y, '-', color);
+				screenPut(a->x + col, a->y + a->h - 1, '-', color);
+			}
+			for (int row = 1; row < a->h - 1; ++row) {
+				screenPut(a->x, a->y + row, '|', color);
+				screenPut(a->x + a->w - 1, a->y + row, '|', color);
+			}
+			screenPut(a->x, a->y, '+', color);
+			screenPut(a->x + a->w - 1, a->y, '+', color);
+			screenPut(a->x, a->y + a->h - 1, '+', color);
+			screenPut(a->x + a->w - 1, a->y + a->h - 1, '+', color);
+		}
 
 	    // 3) call the app’s content
-	    gotoxy(a->x + 1, a->y + 1);
-	    a->onDraw();
+	    a->onDraw(a);
+	}
+
+	void consoleAppPrint(consoleApp* app, int x, int y, const char* fmt, ...) {
+		char line[CONSOLE_SCREEN_W + 1];
+		va_list args;
+		int len;
+
+		if (y < 0 || y >= app->h - 2) return;
+
+		va_start(args, fmt);
+		len = vsnprintf(line, sizeof(line), fmt, args);
+		va_end(args);
+		if (len > (int)sizeof(line) - 1) len = sizeof(line) - 1;
+
+		for (int i = 0; i < len && x + i < app->w - 2; i++) {
+			if (x + i < 0) continue;
+			screenPut(app->x + 1 + x + i, app->y + 1 + y, line[i], CONSOLE_COLOR(app->fg, app->bg));
+		}
+	}
 
-	    // 4) reset to default colors for next draws
-	    setTextColor(DEFAULT_COLOR);
-	    setBackgroundColor(DEFAULT_COLOR);
-	    printf("\n");
+	void consoleAppInvalidate(void) {
+		screenValid = 0;
+	}
+
+	// SGR for the changed half only
+	static void screenColor(uint8_t color, uint8_t prev) {
+		char sgr[16];
+		uint8_t fg = color & 0x0F, bg = color >> 4;
+		int fgCode = (fg == DEFAULT_COLOR) ? 39 : (30 + fg);
+		int bgCode = (bg == DEFAULT_COLOR) ? 49 : (40 + bg);
+
+		if ((color & 0x0F) == (prev & 0x0F))
+			screenEmit(sgr, sprintf(sgr, "\x1B[%dm", bgCode));
+		else if ((color & 0xF0) == (prev & 0xF0))
+			screenEmit(sgr, sprintf(sgr, "\x1B[%dm", fgCode));
+		else
+			screenEmit(sgr, sprintf(sgr, "\x1B[%d;%dm", fgCode, bgCode));
+	}
+
+	// send only the cells which differ from what the terminal shows
+	static void screenDiff(void) {
+		const uint8_t defaultColor = CONSOLE_COLOR(DEFAULT_COLOR, DEFAULT_COLOR);
+		uint8_t color = defaultColor;
+		int curX = -1, curY = -1;
+		char seq[16];
+
+		for (int y = 0; y < CONSOLE_SCREEN_H; y++) {
+			for (int x = 0; x < CONSOLE_SCREEN_W; x++) {
+				consoleCell* back = &screenBack[y][x];
+				consoleCell* front = &screenFront[y][x];
+				if (back->ch == front->ch && back->color == front->color) continue;
+
+				// short run of unchanged cells in the same color is cheaper to reprint than a cursor move
+				int bridge = (curY == y && x > curX && x - curX <= CONSOLE_GAP_BRIDGE);
+				for (int i = curX; bridge && i < x; i++)
+					if (screenBack[y][i].color != color) bridge = 0;
+
+				if (bridge) {
+					for (; curX < x; curX++) screenEmit(&screenBack[y][curX].ch, 1);
+				} else if (curY != y || curX != x) {
+					screenEmit(seq, sprintf(seq, "\x1B[%d;%dH", y + 1, x + 1));
+				}
+
+				if (back->color != color) {
+					screenColor(back->color, color);
+					color = back->color;
+				}
+				screenEmit(&back->ch, 1);
+				*front = *back;
+				curX = x + 1;
+				curY = y;
+			}
+		}
+
+		// leave terminal in default state below the screen
+		if (color != defaultColor) screenEmit("\x1B[0m", 4);
+		if (curY >= 0) screenEmit(seq, sprintf(seq, "\x1B[%d;1H", CONSOLE_SCREEN_H + 1));
 	}
 
 
 	void  consoleAppDrawAll(uint32_t par) {
 		consoleApp *a = appList;
+		int full = !screenValid;
 
 		if (!a) return;
 
-		cls();
+		// render every visible app into the back buffer
+		for (int y = 0; y < CONSOLE_SCREEN_H; y++)
+			for (int x = 0; x < CONSOLE_SCREEN_W; x++) {
+				screenBack[y][x].ch = ' ';
+				screenBack[y][x].color = CONSOLE_COLOR(DEFAULT_COLOR, DEFAULT_COLOR);
+			}
 
 		while (a) {
 			if (a->visible) {
@@ -63,12 +188,44 @@
 			a = a->next;
 		}
 
+		screenBytesLast = 0;
+		if (full) {
+			// terminal content unknown, start from a blank screen
+			screenEmit("\x1B[2J\x1B[H", 7);
+			for (int y = 0; y < CONSOLE_SCREEN_H; y++)
+				for (int x = 0; x < CONSOLE_SCREEN_W; x++) {
+					screenFront[y][x].ch = ' ';
+					screenFront[y][x].color = CONSOLE_COLOR(DEFAULT_COLOR, DEFAULT_COLOR);
+				}
+			screenValid = 1;
+		}
 
+		screenDiff();
+		screenFlush();
+		fflush(stdout);
+
+		screenFrames++;
+		screenBytesTotal += screenBytesLast;
+		if (full) screenBytesFull = screenBytesLast;
+	}
+
+	int consoleAppStats(char* args) {
+		if (args && strcmp(args, "full") == 0) {
+			consoleAppInvalidate();
+			printf("next frame is a full redraw\n");
+			return 0;
+		}
+		printf("Frames: %lu\n", (unsigned long)screenFrames);
+		printf("Last frame: %lu bytes\n", (unsigned long)screenBytesLast);
+		if (screenFrames)
+			printf("Average: %lu bytes/frame\n", (unsigned long)(screenBytesTotal / screenFrames));
+		printf("Full redraw: %lu bytes\n", (unsigned long)screenBytesFull);
+		return 0;
 	}
 
 
-	void 	 consoleAppRegister(char *name, void (*onDraw)(int x, int y), uint8_t x, uint8_t y, uint8_t w, uint8_t h, enum ConsoleColor fg, enum ConsoleColor bg) {
-	    consoleApp* app = malloc(sizeof(consoleApp));
+	void 	 consoleAppRegister(char *name, void (*onDraw)(consoleApp*), uint8_t x, uint8_t y, uint8_t w, uint8_t h, enum ConsoleColor fg, enum ConsoleColor bg) {
+	    consoleApp* app = memAlloc(MEM_CONSOLE, sizeof(consoleApp));
 	    if (!app) return;
 
 	    *app = (consoleApp){ .name = name,
@@ -80,7 +237,7 @@
 	                           .next = appList };
 
 	    appList = app;
-
+	    consoleAppInvalidate();
 	}
 
 
@@ -171,18 +328,57 @@ void setBackgroundColor(enum ConsoleColor color) {
 
 
 
-static consoleCmd* consoleCmdList = NULL;
+static consoleCmd* consoleCmdList = NULL; // runtime registered, overflow of the flash table
 
-void consoleInit(uint32_t msg) {
-	consoleRegister("about", &consoleAbout);
-	//consoleRegister("gui", &consoleGui);
-	consoleRegister("help", &consoleHelp);
-	consoleRegister("taskreset", &consoleTasksReset);
-	consoleRegister("tasks", &consoleTasks);
-	consoleRegister("on", &consoleOn);
-	consoleRegister("off", &consoleOff);
+// flash command table, filled by CONSOLE_CMD() across the sources
+extern const consoleCmd __start_fw_cmd[];
+extern const consoleCmd __stop_fw_cmd[];
+
+// open addressing over the flash table: table index + 1, 0 - empty. NULL - no RAM, lookups scan
+static uint16_t* consoleCmdIndex = NULL;
+static uint16_t consoleCmdSlots = 0; // power of two
+
+MODULE(console, MOD_CONSOLE, MOD_USB | MOD_UART, 0, &consoleInit);
+
+CONSOLE_CMD(about, consoleAbout);
+//CONSOLE_CMD(gui, consoleGui);
+CONSOLE_CMD(help, consoleHelp);
+CONSOLE_CMD(taskreset, consoleTasksReset);
+CONSOLE_CMD(tasks, consoleTasks);
+CONSOLE_CMD(on, consoleOn);
+CONSOLE_CMD(off, consoleOff);
+CONSOLE_CMD(cmdstats, consoleStats);
+#ifdef USING_RICH_CONSOLE
+CONSOLE_CMD(guistat, consoleAppStats);
+#endif
+
+static uint16_t consoleHash(const char* name) {
+	uint32_t h = 2166136261u;
+	while (*name) h = (h ^ (uint8_t)*name++) * 16777619u;
+	return (h >> 16) ^ (h & 0xFFFF);
+}
+
+// at most half full, a lookup is one or two probes
+static void consoleIndexBuild(void) {
+	uint16_t count = __stop_fw_cmd - __start_fw_cmd, slots = 4;
 
+	while (slots < count * 2) slots <<= 1;
+	consoleCmdIndex = memAlloc(MEM_CONSOLE, slots * sizeof(uint16_t));
+	if (!consoleCmdIndex) {
+		printf("console> no RAM for the command index, lookups scan the table\n");
+		return;
+	}
+	memset(consoleCmdIndex, 0, slots * sizeof(uint16_t));
+	consoleCmdSlots = slots;
+	for (uint16_t i = 0; i < count; i++) {
+		uint16_t s = consoleHash(__start_fw_cmd[i].name) & (slots - 1);
+		while (consoleCmdIndex[s]) s = (s + 1) & (slots - 1);
+		consoleCmdIndex[s] = i + 1;
+	}
+}
 
+void consoleInit(uint32_t msg) {
+	consoleIndexBuild();
 	consoleAbout(NULL);
 
 	printf("console loaded\n");
@@ -195,15 +391,37 @@ void consoleInit(uint32_t msg) {
 
 
 void consoleRegister(char* name, consoleCmdHandler handler) {
-    consoleCmd* cmd = malloc(sizeof(consoleCmd));
+    consoleCmd* cmd = memAlloc(MEM_CONSOLE, sizeof(consoleCmd) + sizeof(consoleCmdStats));
     if (!cmd) return;
 
     cmd->name = name;
     cmd->handler = handler;
+    cmd->stats = (consoleCmdStats*)(cmd + 1);
+    memset(cmd->stats, 0, sizeof(consoleCmdStats));
     cmd->next = consoleCmdList;
     consoleCmdList = cmd;
 }
 
+const consoleCmd* consoleFind(const char* name) {
+	const consoleCmd* current;
+
+	if (consoleCmdIndex) {
+		uint16_t mask = consoleCmdSlots - 1;
+		for (uint16_t s = consoleHash(name) & mask; consoleCmdIndex[s]; s = (s + 1) & mask) {
+			current = &__start_fw_cmd[consoleCmdIndex[s] - 1];
+			if (strcmp(current->name, name) == 0) return current;
+		}
+	} else {
+		for (current = __start_fw_cmd; current < __stop_fw_cmd; current++)
+			if (strcmp(current->name, name) == 0) return current;
+	}
+
+	for (current = consoleCmdList; current; current = current->next)
+		if (strcmp(current->name, name) == 0) return current;
+
+	return NULL;
+}
+
 __attribute__((weak))  uint8_t onCustomCommand(char* command) {
 	// to handle this, place on user file
 	setTextColor(RED);
@@ -212,6 +430,27 @@ __attribute__((weak))  uint8_t onCustomCommand(char* command) {
 }
 
 
+// x4 steps, clz is one instruction
+static inline uint8_t consoleHistBucket(uint32_t us) {
+	uint8_t b = (31 - __builtin_clz(us | 1)) >> 1;
+	return b < CONSOLE_HIST_BUCKETS ? b : CONSOLE_HIST_BUCKETS - 1;
+}
+
+static void consoleStatsRecord(consoleCmdStats* s, uint32_t wait, uint32_t run) {
+	uint8_t b;
+
+	if (!s) return;
+	s->calls++;
+	s->waitTotal += wait;
+	s->runTotal += run;
+	if (wait > s->waitMax) s->waitMax = wait;
+	if (run > s->runMax) s->runMax = run;
+	b = consoleHistBucket(wait);
+	if (s->waitHist[b] != 0xFFFF) s->waitHist[b]++;
+	b = consoleHistBucket(run);
+	if (s->runHist[b] != 0xFFFF) s->runHist[b]++;
+}
+
 uint8_t onCommand(uint32_t param) {
 	char* command = cmd;
 	char* space = strchr(command, ' ');
@@ -222,12 +461,15 @@ uint8_t onCommand(uint32_t param) {
 		args = space + 1;
 	}
 
-	consoleCmd* current = consoleCmdList;
-	while (current) {
-		if (strcmp(current->name, command) == 0) {
-			return current->handler(args);
-		}
-		current = current->next;
+	const consoleCmd* found = consoleFind(command);
+	if (found) {
+		uint32_t start = usTimerRead();
+		uint8_t result = found->handler(args);
+		consoleStatsRecord(found->stats, cmdQueueWait(), usTimerRead() - start);
+#ifdef USING_RICH_CONSOLE
+		consoleAppInvalidate(); // command output scrolled the screen
+#endif
+		return result;
 	}
 
 	return onCustomCommand(command);
@@ -236,7 +478,7 @@ uint8_t onCommand(uint32_t param) {
 
 // specific commands
 
-void consoleAbout(char* args) {
+int consoleAbout(char* args) {
     uint32_t t = uwTick / ST_SEC;
 
 #ifdef USING_RICH_CONSOLE
@@ -274,7 +516,7 @@ void consoleAbout(char* args) {
 #endif
 
 #endif
-
+	return 0;
 }
 
 /*
@@ -293,8 +535,78 @@ void consoleHelp(char* args) {
 }*/
 
 
-void consoleHelp(char* args) {
-    consoleCmd* current = consoleCmdList;
+static void consoleStatsLine(const consoleCmd* c) {
+	consoleCmdStats* s = c->stats;
+
+	if (!s || !s->calls) return;
+	printf(" %-12s %8lu %8lu %8lu %8lu %8lu\n", c->name, (unsigned long)s->calls,
+			(unsigned long)(s->waitTotal / s->calls), (unsigned long)s->waitMax,
+			(unsigned long)(s->runTotal / s->calls), (unsigned long)s->runMax);
+}
+
+static void consoleStatsHist(const char* label, const uint16_t* hist) {
+	static const char* const bounds[CONSOLE_HIST_BUCKETS] = {
+		"<4us", "<16us", "<64us", "<256us", "<1ms", "<4ms", "<16ms", "<65ms", "<262ms", "more"
+	};
+
+	printf(" %s", label);
+	for (uint8_t i = 0; i < CONSOLE_HIST_BUCKETS; i++)
+		if (hist[i]) printf(" %s:%u", bounds[i], hist[i]);
+	printf("\n");
+}
+
+// cmdstats            calls, wait and run time of every command used
+// cmdstats <name>     histograms of one command
+// cmdstats reset
+int consoleStats(char* args) {
+	const consoleCmd* entry;
+
+	if (args && strcmp(args, "reset") == 0) {
+		for (entry = __start_fw_cmd; entry < __stop_fw_cmd; entry++)
+			if (entry->stats) memset(entry->stats, 0, sizeof(consoleCmdStats));
+		for (entry = consoleCmdList; entry; entry = entry->next)
+			memset(entry->stats, 0, sizeof(consoleCmdStats));
+		return 0;
+	}
+
+	if (args && args[0]) {
+		entry = consoleFind(args);
+		if (!entry || !entry->stats) {
+			printf("no command %s\n", args);
+			return 0;
+		}
+		printf("%s: %lu calls\n", entry->name, (unsigned long)entry->stats->calls);
+		consoleStatsHist("wait", entry->stats->waitHist);
+		consoleStatsHist("run ", entry->stats->runHist);
+		return 0;
+	}
+
+	printf(" %-12s %8s %8s %8s %8s %8s\n", "command", "calls", "wait us", "max", "run us", "max");
+	for (entry = __start_fw_cmd; entry < __stop_fw_cmd; entry++) consoleStatsLine(entry);
+	for (entry = consoleCmdList; entry; entry = entry->next) consoleStatsLine(entry);
+	return 0;
+}
+
+
+// next command after prev in name order, flash table and runtime ones together. The table is
+// in link order and takes no RAM to sort, help walks it once per line. NULL - none left
+static const consoleCmd* consoleHelpNext(const char* prev, const char* prefix, size_t len) {
+    const consoleCmd* best = NULL;
+    const consoleCmd* entry;
+
+    for (entry = __start_fw_cmd; entry < __stop_fw_cmd; entry++)
+        if ((!prev || strcmp(entry->name, prev) > 0) && strncmp(entry->name, prefix, len) == 0
+                && (!best || strcmp(entry->name, best->name) < 0))
+            best = entry;
+    for (entry = consoleCmdList; entry; entry = entry->next)
+        if ((!prev || strcmp(entry->name, prev) > 0) && strncmp(entry->name, prefix, len) == 0
+                && (!best || strcmp(entry->name, best->name) < 0))
+            best = entry;
+    return best;
+}
+
+int consoleHelp(char* args) {
+    const consoleCmd* entry = NULL;
     size_t filter_len = (args && args[0]) ? strlen(args) : 0;
     int cnt = 0;
 
@@ -304,12 +616,9 @@ void consoleHelp(char* args) {
         printf("Available:\n");
     }
 
-    while (current) {
-        if (!filter_len || strncmp(current->name, args, filter_len) == 0) {
-            printf(" - %s (%p)\n", current->name, (void*)current->handler);
-            cnt++;
-        }
-        current = current->next;
+    while ((entry = consoleHelpNext(entry ? entry->name : NULL, filter_len ? args : "", filter_len))) {
+        printf(" - %s (%p)\n", entry->name, (void*)entry->handler);
+        cnt++;
         kernel_process(1);
     }
 
@@ -318,6 +627,7 @@ void consoleHelp(char* args) {
     } else {
         printf("Total: %d\n", cnt);
     }
+    return 0;
 }
 
 #endif
@@ -355,12 +665,12 @@ int getPortPinFromArgs(char* args, GPIO_TypeDef** port, uint16_t* pin) {
 }
 
 
-void consoleOn(char* args) {
+int consoleOn(char* args) {
     GPIO_TypeDef* port;
     uint16_t mask;
     if (!getPortPinFromArgs(args, &port, &mask)) {
         printf("Usage: on PE0  (0 → all pins)\n");
-        return;
+        return 0;
     }
 
     HAL_GPIO_WritePin(port, mask, GPIO_PIN_SET);
@@ -371,12 +681,12 @@ void consoleOn(char* args) {
     }
 }
 
-void consoleOff(char* args) {
+int consoleOff(char* args) {
     GPIO_TypeDef* port;
     uint16_t mask;
     if (!getPortPinFromArgs(args, &port, &mask)) {
         printf("Usage: off PE0  (0 → all pins)\n");
-        return;
+        return 0;
     }
 
     HAL_GPIO_WritePin(port, mask, GPIO_PIN_RESET);
@@ -71,40 +71,90 @@ Why it wins: uses a modest ~9 KB RAM, sends the minimal data each refresh, avo
 typedef int (*consoleCmdHandler)(char* args);
 
 
+#define CONSOLE_HIST_BUCKETS 10 // x4 steps: <4us, <16us ... <262ms, longer
+
+// per command timing in RAM, ~70 bytes each, see cmdstats
+typedef struct consoleCmdStats {
+    uint32_t calls;
+    uint32_t waitMax;   // us from line received to start
+    uint32_t runMax;    // us in the handler
+    uint64_t waitTotal;
+    uint64_t runTotal;
+    uint16_t waitHist[CONSOLE_HIST_BUCKETS]; // saturating
+    uint16_t runHist[CONSOLE_HIST_BUCKETS];
+} consoleCmdStats;
+
 typedef struct consoleCmd {
     const char* name;
     consoleCmdHandler handler;
-    struct ConsoleCmd* next;
+    struct consoleCmd* next;
+    consoleCmdStats* stats;
 } consoleCmd;
 
 
+// Declare a command in flash at file level, only its stats take RAM:  CONSOLE_CMD(ls, fsList);
+// handler is int f(char* args). Linker provides __start_fw_cmd/__stop_fw_cmd like for MODULE(),
+// consoleInit hashes the table once
+#define CONSOLE_CMD(n, h) \
+	static consoleCmdStats __cmdstats_##n; \
+	static const consoleCmd __cmd_##n __attribute__((used, section("fw_cmd"))) = { #n, &h, NULL, &__cmdstats_##n }
 
 
-typedef struct consoleCmd consoleCmd;
-
 void consoleInit(uint32_t);
-void consoleRegister(char* name, consoleCmdHandler handler);
+void consoleRegister(char* name, consoleCmdHandler handler); // runtime commands, kept in RAM
+const consoleCmd* consoleFind(const char* name);
 
 // Resets terminal: clears formatting and moves cursor to bottom of window
 void resetTerminal(void);
 
 
-void consoleHelp(char* args);
-void consoleAbout(char* args);
-void consoleTasks(char* args);
-void consoleTasksReset(char* args);
-void consoleOn(char* args);
-void consoleOff(char* args);
+int consoleHelp(char* args);
+int consoleAbout(char* args);
+int consoleTasks(char* args);
+int consoleTasksReset(char* args);
+int consoleCmdQueue(char* args);
+int consoleStats(char* args);
+int consoleOn(char* args);
+int consoleOff(char* args);
 
 
+	enum ConsoleColor {
+		BLACK = 0,
+		RED,
+		GREEN,
+		YELLOW,
+		BLUE,
+		MAGENTA,
+		CYAN,
+		WHITE,
+		DEFAULT_COLOR = 9
+	};
+	void setTextColor(enum ConsoleColor color);
+	void setBackgroundColor(enum ConsoleColor color);
 
 
 	#ifdef USING_RICH_CONSOLE
 
+	// virtual screen, two of them are kept in RAM (4 bytes per cell in total)
+	#ifndef CONSOLE_SCREEN_W
+		#define CONSOLE_SCREEN_W 80
+	#endif
+	#ifndef CONSOLE_SCREEN_H
+		#define CONSOLE_SCREEN_H 25
+	#endif
+	#define CONSOLE_GAP_BRIDGE 6 // reprint up to this many unchanged cells instead of moving cursor
+
+	// fg in low nibble, bg in high nibble
+	#define CONSOLE_COLOR(fg, bg) ((uint8_t)(((fg) & 0x0F) | ((bg) << 4)))
+
+	typedef struct consoleCell {
+		char    ch;
+		uint8_t color;
+	} consoleCell;
 
 	typedef struct consoleApp {
 		const char           *name;       // unique identifier
-		void                (*onDraw)();    // draw callback
+		void                (*onDraw)(struct consoleApp*); // draw callback, paints into back buffer
 		uint8_t               x, y;       // top left corner (based console coords)
 		uint8_t               w, h;       // window size
 		enum ConsoleColor   		fg;
@@ -114,12 +164,18 @@ void consoleOff(char* args);
 	} consoleApp;
 
 	// Register a new application. Must be done before using it.
-	void 	 consoleAppRegister(char *name, void (*onDraw)(), uint8_t x, uint8_t y, uint8_t w, uint8_t h, enum ConsoleColor fg, enum ConsoleColor bg);
+	void 	 consoleAppRegister(char *name, void (*onDraw)(consoleApp*), uint8_t x, uint8_t y, uint8_t w, uint8_t h, enum ConsoleColor fg, enum ConsoleColor bg);
 	void     consoleAppShow(char *name);// Show (open) a registered app by name
 	void     consoleAppHide(char *name);// Hide (close) a visible app by name
 	void     consoleAppKill(char *name);// Remove an app completely
 	void     consoleAppDrawAll(uint32_t);// Draw all visible apps (called from your main loop or console refresh)
 
+	// app content, x/y relative to the inside of the frame, clipped to the window
+	void consoleAppPrint(consoleApp* app, int x, int y, const char* fmt, ...);
+	// terminal content is unknown (cleared or scrolled), next frame is sent in full
+	void consoleAppInvalidate(void);
+	int consoleAppStats(char* args);
+
 	void gotoxy(int x, int y);
 	void cls(void);
 	void drawFrame(int x, int y, int w, int h);
@@ -128,21 +184,6 @@ void consoleOff(char* args);
 	#endif
 
 
-	enum ConsoleColor {
-		BLACK = 0,
-		RED,
-		GREEN,
-		YELLOW,
-		BLUE,
-		MAGENTA,
-		CYAN,
-		WHITE,
-		DEFAULT_COLOR = 9
-	};
-	void setTextColor(enum ConsoleColor color);
-	void setBackgroundColor(enum ConsoleColor color);
-
-
 #endif
 
 #endif /* SYS_CONSOLE_H_ */
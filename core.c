@@ -18,53 +18,113 @@ static tTask taskQueue = { 0 };
 uint32_t taskTimeout = TASK_TIMEOUT;
 uint32_t taskRealtimeFail = TASK_REALTIME_FAIL;
 uint32_t tasksTotalExecuted = 0;
+#ifdef USING_CMD_QUEUE
+// command lines waiting to run, each with its own storage
+typedef struct tCmdSlot {
+	char     line[CMD_BUFFER_SIZE];
+	uint32_t queuedAt; // us
+} tCmdSlot;
+
+_Static_assert(CMD_QUEUE_SIZE <= 32, "CMD_QUEUE_SIZE above 32");
+
+static tCmdSlot cmdSlots[CMD_QUEUE_SIZE];
+static uint8_t cmdOrder[CMD_QUEUE_SIZE]; // queued slots in arrival order
+static uint8_t cmdHead = 0; // free running over cmdOrder, written by the transports
+static uint8_t cmdTail = 0; // free running, the slot is released once its command returns
+static uint32_t cmdFree = (1ULL << CMD_QUEUE_SIZE) - 1; // slots no transport or line holds
+static uint8_t cmdBusy = 0;
+static uint8_t cmdScheduled = 0; // runner task is waiting in the queue
+static uint32_t cmdWait = 0; // us the running line spent in the queue
+
+// command line being executed, shared by all transports
+char* cmd = cmdSlots[0].line;
+volatile uint8_t cmdLoaded;
+
+// stats, see cmdq
+static uint32_t cmdExecuted, cmdFull, cmdPeak, cmdWaitMax, cmdRunMax, cmdSince;
+static uint64_t cmdWaitTotal, cmdRunTotal;
+#endif
 
+static tTaskGroup taskGroups[TASK_GROUP_LIMIT] = { { .name = "-" } }; // 0 - ungrouped tasks
 
-void onBoot() {
-	// core tasks
-	int timing = 10;
+static void taskGroupUnlink(tTask* task);
 
-	//SysTick_Config(1600);//5x speed Temporary !TODO
+// module table, filled by MODULE() across the sources
+extern const tModule __start_fw_modules[];
+extern const tModule __stop_fw_modules[];
+static uint32_t modulesStarted = 0;
+static uint32_t modulesReady = 0;
+static uint32_t modulesAll = 0;
+static uint32_t bootStartedAt = 0;
+static uint32_t moduleStartedAt[32]; // by id bit, MF_ASYNC ready timeout
 
-	usTimerInit();
 
-	taskQueue.next = NULL;
-	onBeforeLoad(0);
+void moduleReady(uint32_t id) {
+	modulesReady |= id;
+}
 
+uint32_t moduleIsReady(uint32_t id) {
+	return (modulesReady & id) == id;
+}
 
-	// libs
-#ifdef USING_USB
-	tTask* usbi = after("USB_INIT",timing+=10, &usbInit); // this can start asap
-	usbi->timeout = 1000 * ST_MS * 15;
-	timing+=ST_SEC;
-#else
-	#ifdef USING_UART
-		tTask* usbi = after("UART_INIT",timing+=10, &uartInit); // this can start asap
-		usbi->timeout = 1000 * ST_MS * 15;
-		timing+=ST_SEC;
-	#endif
-#endif
+// boot pass: start every module with ready dependencies, onLoad once all are ready
+static void bootProcessor(uint32_t depth) {
+	const tModule* m;
+	tTask* boot;
 
+	for (m = __start_fw_modules; m < __stop_fw_modules; m++) {
+		if ((modulesStarted & m->id) || (m->depends & ~modulesReady)) continue;
 
-#ifdef USING_CONSOLE
-	tTask* cns = after("CNS_INIT",timing+=10, &consoleInit);
-	cns->timeout = 1000 * ST_MS * 50;
-#endif
+		modulesStarted |= m->id;
+		moduleStartedAt[__builtin_ctz(m->id)] = uwTick;
+		m->init(depth);
+		if (!(m->flags & MF_ASYNC)) modulesReady |= m->id;
+	}
 
-#ifdef USING_BUTTON
-	after("BTN_INIT", timing+=10, &buttonInit);
-#endif
+	// a module that never reports ready must not hold the rest of the boot
+	for (m = __start_fw_modules; m < __stop_fw_modules; m++) {
+		uint32_t waited = uwTick - moduleStartedAt[__builtin_ctz(m->id)];
+		if (!(modulesStarted & m->id) || moduleIsReady(m->id)) continue;
+		if (waited <= (m->readyTimeout ? m->readyTimeout : MODULE_READY_TIMEOUT)) continue;
 
+		printf("boot> %s not ready after %lums, going on without it\n", m->name, (unsigned long)waited);
+		modulesReady |= m->id;
+	}
 
-#ifdef USING_FILESYSTEM
-	after("FS_INIT", timing+=10, &fsInit);
-#endif
+	if (moduleIsReady(modulesAll)) {
+		printf("boot> ");
+		for (m = __start_fw_modules; m < __stop_fw_modules; m++) printf("%s ", m->name);
+		printf("ready in %lums (%lums since reset)\n",
+				(unsigned long)(uwTick - bootStartedAt), (unsigned long)uwTick);
+		onLoad(depth);
+		return;
+	}
 
-#ifdef USING_TCP
-	after("TCP_INIT", timing+=10, &tcpInit);
-#endif
+	// someone still initializing, check again next tick
+	boot = after("BOOT", ST_MS, &bootProcessor);
+	if (boot) boot->timeout = BOOT_TIMEOUT;
+}
+
+
+void onBoot() {
+	const tModule* m;
+	tTask* boot;
+
+	//SysTick_Config(1600);//5x speed Temporary !TODO
+
+	usTimerInit();
+
+	taskQueue.next = NULL;
+	onBeforeLoad(0);
+
+	// libs, dependencies on modules not compiled in are satisfied from the start
+	bootStartedAt = uwTick;
+	for (m = __start_fw_modules; m < __stop_fw_modules; m++) modulesAll |= m->id;
+	modulesReady = ~modulesAll;
+
+	boot = exec("BOOT", &bootProcessor);
+	if (boot) boot->timeout = BOOT_TIMEOUT;
 
-	after("LOAD",timing+=10, &onLoad);
 	while (1==1) {
 		kernel_process(0);
 	}
@@ -87,6 +147,11 @@ __attribute__((weak))  void onTaskError(tTask* task, uint32_t msg, uint32_t time
 			task->error_flag|=msg;
 	}
 
+#ifdef USING_LOG
+	// called from inside the scheduler loop, keep it short. The name is in RAM and LOG keeps
+	// only words, the callback address stands in for it: decode with addr2line
+	LOG(LOG_WARN, MOD_CORE, "task %08lX error %lu, %lu", (uint32_t)(task ? task->callback : NULL), msg, time);
+#else
 	printf("\x1b[31m");
 	if (task!=NULL) {
 		task->name[TASK_NAME_LENGTH] = '\0';
@@ -104,7 +169,7 @@ __attribute__((weak))  void onTaskError(tTask* task, uint32_t msg, uint32_t time
 			break;
 	}
 	printf("\x1b[0m\n");
-
+#endif
 }
 
 
@@ -115,11 +180,13 @@ void kernel_process(int depth) {
 	uint32_t beforeT;
 	uint32_t runningTaskCount = 0;
 	uint8_t result = 0;
+	uint32_t elapsed;
 
 	if (depth > TASKER_ULTIMATE_DEPTH) {
 		onTaskError(NULL, TE_ULTIMATE_DEPTH, 0);
 		return;
 	}
+	MEM_STACK_MARK(depth);
 
 	while (current && current->next != NULL) {
 		if (++runningTaskCount > TASKER_ULTIMATE_LIMIT) {
@@ -130,7 +197,18 @@ void kernel_process(int depth) {
 		prev = current;
 		current = current->next;
 
-		if ((int32_t)(uwTick - current->runAt) >= 0 && current->callback && current->state == TS_READY) {
+		// cancelled task, released on top level only, nested levels may still point to it
+		if (!current->callback && current->state == TS_READY) {
+			if (!depth) {
+				prev->next = current->next;
+				memFree(MEM_CORE, current);
+				current = prev;
+			}
+			continue;
+		}
+
+		if ((int32_t)(uwTick - current->runAt) >= 0 && current->callback && current->state == TS_READY
+				&& !taskGroups[current->group].paused) {
 
 			handler = current->callback;
 
@@ -148,7 +226,10 @@ void kernel_process(int depth) {
 				result = handler(depth+1);
 				current->state = TS_READY;
 				current->counter++;
-				current->duration+=(usTimerRead() - beforeT);
+				elapsed = usTimerRead() - beforeT;
+				current->duration+=elapsed;
+				taskGroups[current->group].counter++;
+				taskGroups[current->group].duration+=elapsed;
 
 				if (!result)
 					if ((int32_t)(usTimerRead() - beforeT) > (int32_t)current->timeout)
@@ -161,11 +242,14 @@ void kernel_process(int depth) {
 				current->state = TS_RUNNING;
 				result = handler(depth+1);
 				current->state = TS_READY;
+				taskGroups[current->group].counter++;
+				taskGroups[current->group].duration+=(usTimerRead() - beforeT);
 
 				if (!result)
 					if ((int32_t)(usTimerRead() - beforeT) > (int32_t)current->timeout)
 						onTaskError(current, TE_TIMEOUT, usTimerRead() - beforeT);
-				free(current);
+				taskGroupUnlink(current);
+				memFree(MEM_CORE, current);
 				current = prev->next;
 			}
 
@@ -173,6 +257,22 @@ void kernel_process(int depth) {
 	}
 }
 
+// remove task from its group chain, groups are short, so plain walk
+static void taskGroupUnlink(tTask* task) {
+	tTask **link;
+	if (!task->group) return;
+
+	link = &taskGroups[task->group].head;
+	while (*link) {
+		if (*link == task) {
+			*link = task->groupNext;
+			break;
+		}
+		link = &(*link)->groupNext;
+	}
+	task->group = 0;
+}
+
 // allow to handle some task
 void osDelay(uint32_t time) {
 	uint32_t haltAt = uwTick + time;
@@ -207,11 +307,16 @@ uint32_t usTimerRead(void) {
 
 
 tTask* taskSchedule(char *name, int after, int type, void (*handler)()) {
+	return taskScheduleGroup(name, after, type, 0, handler);
+}
+
+tTask* taskScheduleGroup(char *name, int after, int type, unsigned char group, void (*handler)()) {
 	if (type & TT_ONCE) taskRemove(handler);
+	if (group >= TASK_GROUP_LIMIT) group = 0;
 	tTask *current = &taskQueue;
 
 
-	tTask *task = malloc(sizeof(tTask));
+	tTask *task = memAlloc(MEM_CORE, sizeof(tTask));
 	if (!task) return NULL;
 
 	strncpy(task->name, name, TASK_NAME_LENGTH);
@@ -225,6 +330,12 @@ tTask* taskSchedule(char *name, int after, int type, void (*handler)()) {
 	task->callback = handler;
 	task->cycleLength = (type & TT_REPEAT ? after : 0);
 	task->next = NULL;
+	task->group = group;
+	task->groupNext = NULL;
+	if (group) {
+		task->groupNext = taskGroups[group].head;
+		taskGroups[group].head = task;
+	}
 
 
 	while (current->next) {
@@ -257,9 +368,10 @@ uint32_t taskRemove(void (*handler)()) {
 
 		if (current->callback == handler) {
 			prev->next = current->next;
-			free(current);
+			taskGroupUnlink(current);
+			memFree(MEM_CORE, current);
 			count++;
-			current = prev->next;
+			current = prev; // the removed task may have been the last one
 		}
 	}
 	return count;
@@ -277,16 +389,183 @@ uint32_t taskExists(void (*handler)()) {
 	return count;
 }
 
+unsigned char taskGroupCreate(char* name) {
+	for (unsigned char i = 1; i < TASK_GROUP_LIMIT; i++) {
+		if (!taskGroups[i].name[0]) {
+			strncpy(taskGroups[i].name, name, TASK_NAME_LENGTH);
+			return i;
+		}
+	}
+	return 0;
+}
+
+// O(group size), tasks are only marked, kernel_process frees them when it is safe
+uint32_t taskGroupCancel(unsigned char group) {
+	tTask *current;
+	uint32_t count = 0;
+	if (!group || group >= TASK_GROUP_LIMIT) return 0;
+
+	current = taskGroups[group].head;
+	while (current) {
+		current->callback = NULL;
+		current->group = 0;
+		current = current->groupNext;
+		count++;
+	}
+	taskGroups[group].head = NULL;
+	return count;
+}
+
+void taskGroupPause(unsigned char group) {
+	if (!group || group >= TASK_GROUP_LIMIT) return;
+	taskGroups[group].paused = 1;
+}
+
+void taskGroupResume(unsigned char group) {
+	tTask *current;
+	if (!group || group >= TASK_GROUP_LIMIT) return;
+
+	taskGroups[group].paused = 0;
+	// skip cycles missed while paused instead of catching up with realtime errors
+	for (current = taskGroups[group].head; current; current = current->groupNext) {
+		if ((int32_t)(uwTick - current->runAt) > 0) current->runAt = uwTick;
+	}
+}
+
+#ifdef USING_CMD_QUEUE
+static void cmdRunner(uint32_t depth);
+
+// runner task carries the name of the command it is about to run, `tasks` shows it
+static void cmdSchedule(void) {
+	char name[TASK_NAME_LENGTH+1];
+
+	strncpy(name, cmdSlots[cmdOrder[cmdTail & (CMD_QUEUE_SIZE - 1)]].line, TASK_NAME_LENGTH);
+	name[TASK_NAME_LENGTH] = '\0';
+	if (execPriority(name, &cmdRunner)) cmdScheduled = 1;
+}
+
+char* cmdClaim(void) {
+	for (uint8_t i = 0; i < CMD_QUEUE_SIZE; i++) {
+		if (!(cmdFree & (1U << i))) continue;
+		cmdFree &= ~(1U << i);
+		cmdSlots[i].line[0] = '\0';
+		return cmdSlots[i].line;
+	}
+	cmdFull++;
+	return NULL;
+}
+
+void cmdSubmit(char* line) {
+	tCmdSlot* slot = (tCmdSlot*)line; // line is the first member
+	uint8_t depth;
+
+	slot->queuedAt = usTimerRead();
+	cmdOrder[cmdHead & (CMD_QUEUE_SIZE - 1)] = slot - cmdSlots;
+	cmdHead++;
+	depth = cmdHead - cmdTail;
+	if (depth > cmdPeak) cmdPeak = depth;
+
+	// one runner at a time, a running command schedules the next one when it returns
+	if (!cmdBusy && !cmdScheduled) cmdSchedule();
+}
+
+void cmdRelease(char* line) {
+	cmdFree |= 1U << ((tCmdSlot*)line - cmdSlots);
+}
+
+uint8_t cmdQueue(const char* line) {
+	char* slot = cmdClaim();
+
+	if (!slot) return 0;
+	strncpy(slot, line, CMD_BUFFER_SIZE - 1);
+	slot[CMD_BUFFER_SIZE - 1] = '\0';
+	cmdSubmit(slot);
+	return 1;
+}
+
+uint32_t cmdPending(void) {
+	return (uint8_t)(cmdHead - cmdTail);
+}
+
+uint32_t cmdQueueWait(void) {
+	return cmdWait;
+}
+
+// runs queued lines oldest first, back to back for up to CMD_BATCH_TIME.
+// A command parking in kernel_process never sees the next one start.
+static void cmdRunner(uint32_t depth) {
+	tCmdSlot* slot;
+	uint32_t pass, start, wait, run;
+
+	cmdScheduled = 0;
+	if (cmdBusy) return;
+
+	cmdBusy = 1;
+	pass = usTimerRead();
+	while (cmdHead != cmdTail) {
+		slot = &cmdSlots[cmdOrder[cmdTail & (CMD_QUEUE_SIZE - 1)]];
+		start = usTimerRead();
+		wait = start - slot->queuedAt;
+		cmd = slot->line;
+		cmdWait = wait;
+		onCommand(depth);
+		run = usTimerRead() - start;
+		cmdTail++; // slot is reused only now, the command may keep pointers into its line
+		cmdRelease(slot->line);
+
+		cmdExecuted++;
+		cmdWaitTotal += wait;
+		cmdRunTotal += run;
+		if (wait > cmdWaitMax) cmdWaitMax = wait;
+		if (run > cmdRunMax) cmdRunMax = run;
+		if (usTimerRead() - pass >= CMD_BATCH_TIME) break;
+	}
+	cmdBusy = 0;
+
+	if (cmdHead != cmdTail) cmdSchedule(); // rest on the next pass, other tasks go first
+}
+
+#ifdef USING_CONSOLE
+// cmdq [reset]
+int consoleCmdQueue(char* args) {
+	uint32_t elapsed = uwTick - cmdSince;
+
+	if (args && strcmp(args, "reset") == 0) {
+		cmdExecuted = cmdFull = cmdPeak = cmdWaitMax = cmdRunMax = 0;
+		cmdWaitTotal = cmdRunTotal = 0;
+		cmdSince = uwTick;
+		return 0;
+	}
+	printf("command queue %lu/%u, peak %lu, full %lu\n",
+			(unsigned long)cmdPending(), CMD_QUEUE_SIZE, (unsigned long)cmdPeak, (unsigned long)cmdFull);
+	printf(" executed %lu (%lu/s)\n", (unsigned long)cmdExecuted,
+			(unsigned long)(elapsed ? (uint64_t)cmdExecuted * ST_SEC / elapsed : 0));
+	if (!cmdExecuted) return 0;
+	printf(" wait avg %luus max %luus, run avg %luus max %luus\n",
+			(unsigned long)(cmdWaitTotal / cmdExecuted), (unsigned long)cmdWaitMax,
+			(unsigned long)(cmdRunTotal / cmdExecuted), (unsigned long)cmdRunMax);
+	return 0;
+}
+
+CONSOLE_CMD(cmdq, consoleCmdQueue);
+#endif
+#endif
+
 #ifdef USING_CONSOLE
-void consoleTasks(char* args) {
+int consoleTasks(char* args) {
 	tTask* current = taskQueue.next;
     printf("\n === Debug Tasks ===\n");
 	printf("Time now %lu:\n",  uwTick);
 	while (current) {
 		//current->callback =  cb=%p
 		current->name[TASK_NAME_LENGTH] = '\0';
+		if (!current->callback) { // cancelled
+			current = current->next;
+			continue;
+		}
 
 		if (current->state == TS_RUNNING)  printf("<RUNNING> ");
+		if (taskGroups[current->group].paused)  printf("<PAUSED> ");
 
 		printf("-[%s] runAt=%lu, wait=%i ", current->name, (unsigned long int)current->runAt, abs(uwTick - current->runAt));
 		if (current->error_flag) {
@@ -297,11 +576,35 @@ void consoleTasks(char* args) {
 			printf("Cnt: %i ", (int)current->counter);
 			printf("Dur (avg): %ius ", (int)(current->duration / (uint64_t)current->counter));
 		}
+		if (current->group) printf("Grp: %s ", taskGroups[current->group].name);
 		printf("\n");
 		current = current->next;
 	}
+
+	// cpu time per group
+	uint64_t total = 0;
+	for (int i = 0; i < TASK_GROUP_LIMIT; i++) total += taskGroups[i].duration;
+
+	printf(" === Task Groups ===\n");
+	for (int i = 0; i < TASK_GROUP_LIMIT; i++) {
+		tTaskGroup* group = &taskGroups[i];
+		if (!group->name[0]) continue;
+
+		int members = 0;
+		for (current = group->head; current; current = current->groupNext) members++;
+
+		printf("-[%s] tasks=%i ", group->name, members);
+		if (group->paused) printf("PAUSED ");
+		if (group->counter) {
+			printf("Cnt: %i ", (int)group->counter);
+			printf("Dur (avg): %ius ", (int)(group->duration / (uint64_t)group->counter));
+			printf("CPU: %i%% ", (int)(total ? group->duration * 100 / total : 0));
+		}
+		printf("\n");
+	}
+	return 0;
 }
-void consoleTasksReset(char* args) {
+int consoleTasksReset(char* args) {
 	tTask* current = taskQueue.next;
     printf("\n === Reset Tasks ===\n");
 	while (current) {
@@ -315,6 +618,11 @@ void consoleTasksReset(char* args) {
 		printf("\n");
 		current = current->next;
 	}
+	for (int i = 0; i < TASK_GROUP_LIMIT; i++) {
+		taskGroups[i].counter = 0;
+		taskGroups[i].duration = 0;
+	}
+	return 0;
 }
 #endif
 
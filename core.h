@@ -14,14 +14,48 @@
 	#include <stdint.h>
 	#include <main.h>
 	#include "stdlib.h"
+	#include "ring.h"
+
+	#define CMD_BUFFER_SIZE 128 // command line received by any transport
+	#define CMD_QUEUE_SIZE 8 // lines waiting to run, power of two
+	#define CMD_BATCH_TIME 500 // us, queued commands run back to back within one task pass
+
+	// telemetry streams over rpc frames, transports must see USING_RPC
+#ifdef USING_TELEMETRY
+	#ifndef USING_RPC
+		#define USING_RPC
+	#endif
+#endif
+
+	// console sessions over TCP run on the lwIP module
+#ifdef USING_TCP_CONSOLE
+	#ifndef USING_TCP
+		#define USING_TCP
+	#endif
+#endif
+
+	// command lines arrive from a transport, see cmdQueue
+#if defined(USING_USB) || defined(USING_UART) || defined(USING_TCP_CONSOLE)
+	#define USING_CMD_QUEUE
+#endif
 
 	// other sys libraries
 #ifdef USING_USB
 	#include "usb.h"
-#else
-	#ifdef USING_UART
-		#include "uart.h"
-	#endif
+#endif
+
+#ifdef USING_UART
+	#include "uart.h"
+#endif
+
+	// console output, shared by all transports
+	#include "output.h"
+
+	// binary requests next to the console, USING_RPC or USING_TELEMETRY
+	#include "rpc.h"
+
+#ifdef USING_TELEMETRY
+	#include "telemetry.h"
 #endif
 
 
@@ -47,6 +81,9 @@
 	#define TASKER_ULTIMATE_LIMIT 128 // max task count
 	#define TASKER_ULTIMATE_DEPTH 8 // recursion depth
 	#define TASK_NAME_LENGTH 8
+	#define TASK_GROUP_LIMIT 8 // max task groups, group 0 holds ungrouped tasks
+	#define BOOT_TIMEOUT 1000 * ST_MS * 50 // module init functions are allowed to run long
+	#define MODULE_READY_TIMEOUT ST_SEC * 5 // MF_ASYNC module not ready by then is reported, boot goes on
 
 	// ========== types =====================
 	typedef struct tTask tTask; // alias
@@ -63,10 +100,31 @@
 		unsigned char error_flag;
 		uint32_t counter;
 		uint64_t duration;
+		unsigned char group;
 		void (*callback)(uint32_t);
 		 tTask *next;
+		 tTask *groupNext; // next task in the same group
 	};
 
+	// tasks sharing a group id can be paused, resumed or cancelled together
+	typedef struct tTaskGroup {
+		char name[TASK_NAME_LENGTH + 1];
+		unsigned char paused;
+		uint32_t counter;
+		uint64_t duration;
+		tTask *head; // members, chained by groupNext
+	} tTaskGroup;
+
+	// module descriptor, lives in flash in the "fw_modules" section
+	typedef struct tModule {
+		const char* name;
+		uint32_t id;        // MOD_xxx bit
+		uint32_t depends;   // MOD_xxx bits which must be ready before init
+		unsigned char flags;
+		void (*init)(uint32_t);
+		uint32_t readyTimeout; // MF_ASYNC: ms to wait for moduleReady(), 0 - MODULE_READY_TIMEOUT
+	} tModule;
+
 	// quickly translate timing in user friendly names
 	// x10
 	enum {
@@ -95,6 +153,26 @@
 		TS_RUNNING = 1,
 	};
 
+	// module ids, dependency on a module which is not compiled in counts as ready
+	enum {
+		MOD_USB = 1,
+		MOD_UART = 2,
+		MOD_CONSOLE = 4,
+		MOD_BUTTON = 8,
+		MOD_FILESYSTEM = 16,
+		MOD_TCP = 32,
+		MOD_MEMORY = 64,
+		MOD_CORE = 128, // scheduler itself, log filter only
+		MOD_LOG = 256,
+		MOD_RPC = 512,
+		MOD_TELEMETRY = 1024,
+		MOD_USER = 0x10000 // first id free for application modules, use MOD_USER << n (was 256)
+	};
+
+	enum {
+		MF_ASYNC = 1 // module calls moduleReady() itself, otherwise ready once init returns
+	};
+
 	// =============  user API ======================
 
 	// Schedule a task. Returns a pointer to the created task for later modification.
@@ -106,6 +184,7 @@
 	void osDelay(uint32_t time); // can be used on driver inicialization to avoid halting...
 
 	tTask* taskSchedule(char* name, int after, int type, void (*callback)(uint32_t));
+	tTask* taskScheduleGroup(char* name, int after, int type, unsigned char group, void (*callback)(uint32_t));
 
 	// remove all tasks by handler function, returns count
 	uint32_t taskRemove(void (*callback)(uint32_t));
@@ -116,6 +195,34 @@
 	// add message and params to task
 	void taskSetData(tTask* task, uint32_t msg);
 
+	// create a named task group, returns group id or 0 if all groups are taken
+	unsigned char taskGroupCreate(char* name);
+
+	// cancel all tasks of the group, returns count. Memory is released by the scheduler.
+	uint32_t taskGroupCancel(unsigned char group);
+
+	// paused group tasks stay scheduled but are skipped until resumed
+	void taskGroupPause(unsigned char group);
+	void taskGroupResume(unsigned char group);
+
+
+	// command lines of all transports run one after another, in arrival order.
+	// Returns 0 when the queue is full, the transport keeps the line and offers it again.
+	uint8_t cmdQueue(const char* line);
+	// a transport may read its line straight into a slot instead: cmdClaim takes a free one
+	// (CMD_BUFFER_SIZE, NULL - all taken), cmdSubmit queues it once the line is complete, cmdRelease
+	// gives it back unused. A claimed slot holding a partial line does not hold up the others
+	char* cmdClaim(void);
+	void cmdSubmit(char* line);
+	void cmdRelease(char* line);
+	uint32_t cmdPending(void); // queued lines, the running one included
+	uint32_t cmdQueueWait(void); // us the running command waited in the queue
+
+
+	// mark module as ready, modules depending on it are started on next boot pass
+	void moduleReady(uint32_t id);
+	uint32_t moduleIsReady(uint32_t id);
+
 
 	// ================ macros ===================
 	// create immediate task to be run on the main thread, assuring once
@@ -130,6 +237,22 @@
 	#define repeat(n,a,b) taskSchedule(n,a,TT_REPEAT | TT_ONCE,b)
     #define repeatPriority(n,a,b) taskSchedule(n,a,TT_PRIORIT | TT_REPEAT | TT_ONCE,b)
 
+	// same as above, but task joins group g
+	#define execGroup(g,n,b) taskScheduleGroup(n,0,TT_ONCE,g,b)
+	#define afterGroup(g,n,a,b) taskScheduleGroup(n,a,0,g,b)
+	#define repeatGroup(g,n,a,b) taskScheduleGroup(n,a,TT_REPEAT | TT_ONCE,g,b)
+
+
+
+	// register module in the module table, placed in any .c file
+	// MODULE(console, MOD_CONSOLE, MOD_USB | MOD_UART, 0, &consoleInit);
+	// Linker provides __start_fw_modules/__stop_fw_modules. If your linker script
+	// discards unknown sections, add KEEP(*(fw_modules)) to a flash output section.
+	#define MODULE(n, i, d, f, cb) MODULE_WAIT(n, i, d, f, cb, 0)
+	// MF_ASYNC module with its own ready timeout in ms
+	#define MODULE_WAIT(n, i, d, f, cb, t) \
+		static const tModule __module_##n __attribute__((used, section("fw_modules"))) = { #n, i, d, f, cb, t }
+
 
 
 	// ===============  kernel functions ===================
@@ -152,6 +275,12 @@
 	__attribute__((weak))  void onTaskError(tTask*, uint32_t, uint32_t);
 
 
+	// memory instrumentation hooks, compile to plain malloc/free without USING_MEMORY
+	#include "mem.h"
+
+	// deferred logging, LOG() compiles out without USING_LOG
+	#include "log.h"
+
 
 
 
@@ -20,7 +20,7 @@
   #include "stm32f3xx.h"
 #elif defined(STM32F7)
     #include "stm32f7xx.h"
-	#define FLASH_PAGE_SIZE 	128 * 1024
+	#define FLASH_PAGE_SIZE 	(128 * 1024)
 
 #else
   #error "Unsupported STM32 family"
@@ -31,90 +31,560 @@
 
 //static uint32_t fsCurrentWriteAddr = FS_START_ADDR;
 
+// name index, see FsIndexEntry. Open addressing, linear probing
+static FsIndexEntry* fsIndex = NULL;
+static uint16_t fsIndexSlots = 0;  // power of two
+static uint16_t fsIndexCount = 0;
+static uint8_t  fsIndexValid = 0;  // 0 - out of RAM, lookups scan flash
+
+// free map, bit per chunk, 1 - erased. Chunks come back only with a page erase
+static uint32_t* fsFreeMap = NULL; // NULL - out of RAM, allocation scans flash
+static uint32_t fsChunks = 0;
+static uint32_t fsFreeCount = 0;
+static uint32_t fsNextFree = 0;    // next-fit cursor, chunk index
+
+#define FS_CHUNK_ADDR(i)  (FS_START_ADDR + (i) * sizeof(FsChunk))
+#define FS_FREE_BIT(i)    (fsFreeMap[(i) >> 5] & (1U << ((i) & 31)))
+
+// dead (deleted, still programmed) chunks per page, what erasing the page gives back
+static uint16_t* fsPageDead = NULL; // NULL - out of RAM, no garbage collection
+static uint32_t* fsPageErases = NULL; // copy of the page headers, NULL with the gc off
+static uint32_t fsPages = 0;
+static uint8_t fsBusy = 0;          // write in progress, it yields between chunks
+
+#define FS_PAGE_CHUNKS    (FLASH_PAGE_SIZE / sizeof(FsChunk))
+#define FS_PAGE_OF(addr)  (((addr) - FS_START_ADDR) / FLASH_PAGE_SIZE)
+#define FS_PAGE_ADDR(p)   (FS_START_ADDR + (p) * FLASH_PAGE_SIZE)
+#if defined(STM32F3)
+#define FS_PAGE_HEAD(i)   ((i) % FS_PAGE_CHUNKS == 0) // chunk index holds the page header, never allocated
+#else
+#define FS_PAGE_HEAD(i)   0
+#endif
+#define FS_CHAIN_MAX      (1 + (FS_MAX_FILE_SIZE + FS_PAYLOAD_SIZE - 1) / FS_PAYLOAD_SIZE)
+
+// garbage collector, one page at a time
+enum { GC_IDLE = 0, GC_COST, GC_FIND, GC_COPY, GC_RETIRE, GC_UNDO, GC_ERASE };
+
+typedef struct fsGcState {
+    uint8_t  state;
+    uint32_t force;               // pages left to collect with any dead chunk, fsgc run / full volume
+    uint8_t  failed;              // flash error, the page is given up after GC_UNDO
+    uint32_t page;                // victim page index
+    uint16_t freeBefore;          // erased chunks the victim had, taken out of the free map
+    uint16_t deadBefore;
+    uint32_t owed;                // chunks the victim's chains still need, writes leave them free
+    uint32_t cost;                // GC_COST: chunks counted so far
+    uint16_t slot;                // index cursor of the cost and find walks, the next step goes on there
+    uint8_t  rewalk;              // an index entry moved behind the cursor, find walks once more
+    uint8_t  tries;               // candidates passed over as too costly in this pick
+    uint32_t triedPage, triedScore;
+    uint32_t sliceStart;          // us, walks yield past FS_GC_SLICE
+    uint32_t skipPage;            // given up, not picked again until its dead count changes
+    uint16_t skipDead;
+    uint8_t  wear;                // victim is a cold page collected for its static data
+    uint32_t sinceWear;           // page erases since the last one
+    uint32_t wearMoves;
+    uint8_t  count, pos;          // chain part being moved, pos counts down copying, up retiring/undoing
+    uint8_t  extent;              // moving an extent: head first, data, then the link; retired by its head
+    uint8_t  split;               // an extent with no run left to move into goes over as a chain
+    uint32_t from[FS_CHAIN_MAX];  // old chain, head first
+    uint32_t to[FS_CHAIN_MAX];
+    // stats
+    uint32_t pages, reclaimed, copied, aborts, errors;
+    uint32_t unitMax, sliceMax, eraseMax; // us
+    uint64_t busyUs;
+    uint32_t syncRuns;            // writes that had to collect first
+    uint64_t syncUs;
+} fsGcState;
+
+static fsGcState fsGc;
+
+MODULE(filesystem, MOD_FILESYSTEM, 0, 0, &fsInit);
+
+#ifdef USING_CONSOLE
+static int fsGetCmd(char* name);
+
+CONSOLE_CMD(fsdebug, fsDebugChunks);
+CONSOLE_CMD(fstest, fsTest);
+CONSOLE_CMD(fsformat, fsFormat);
+CONSOLE_CMD(filesystem, fsPrintUsage);
+CONSOLE_CMD(ls, fsList);
+CONSOLE_CMD(set, fsSet);
+CONSOLE_CMD(get, fsGetCmd);
+CONSOLE_CMD(del, fsDelete);
+CONSOLE_CMD(fsgc, fsGcCmd);
+CONSOLE_CMD(fswear, fsWearCmd);
+#endif
+
 
 
 static int fsChunkIsFree(FsChunk* chunk) {
     return chunk->type == FS_TYPE_FREE || chunk->type == 0xFF;
 }
 
+static void fsMount(void);
+static int fsDeleteChain(uint32_t addr, const char* name);
+static void fsDeleteCopy(uint32_t addr, uint32_t kept);
+static void fsGcStep(void);
+static uint32_t fsPageEraseCount(uint32_t page);
+static void fsPageCounts(void);
+
 void fsInit() {
+    fsMount();
+    tTask* gc = repeat("FS_GC", FS_GC_PERIOD, &fsMaintain);
+    gc->timeout = 50 * 1000; // page erase, 20..40 ms for 2 KB on F3
+    gc->realtime_fail = ST_SEC;
+    printf("filesystem loaded, %u files, %lu free chunks\n", fsIndexCount, (unsigned long)fsFreeCount);
+}
 
-    printf("filesystem loaded\n");
+// FNV-1a folded to 16 bits, over the part of the name that is stored
+static uint16_t fsHash(const char* name) {
+    uint32_t h = 2166136261u;
+    for (uint8_t i = 0; i < FS_NAME_LEN && name[i]; i++) h = (h ^ (uint8_t)name[i]) * 16777619u;
+    return (h >> 16) ^ (h & 0xFFFF);
+}
 
-#ifdef USING_CONSOLE
-    consoleRegister("fsdebug", &fsDebugChunks);
-    consoleRegister("fstest", &fsTest);
-    consoleRegister("fsformat", &fsFormat);
-    consoleRegister("filesystem", &fsPrintUsage);
-    consoleRegister("ls", &fsList);
-    consoleRegister("set", &fsSet);
-    consoleRegister("get", &fsGet);
-    consoleRegister("del", &fsDelete);
+// chunks the one at addr takes up: an extent head covers its data, never past its page
+static uint32_t fsSpan(uint32_t addr) {
+    const FsChunk* c = (const FsChunk*)addr;
+    uint32_t n, left;
+
+    if ((c->type & 0x0F) != FS_TYPE_EXTENT) return 1;
+    n = 1 + FS_EXTENT_CHUNKS(c->reserved1 | (c->reserved2 << 8));
+    left = FS_PAGE_CHUNKS - (addr - FS_START_ADDR) / sizeof(FsChunk) % FS_PAGE_CHUNKS;
+    return n < left ? n : left;
+}
+
+// live file head, an extent only once its data is complete
+static int fsIsHead(uint32_t addr) {
+    const FsChunk* c = (const FsChunk*)addr;
+    uint8_t t = c->type & 0x0F;
+
+    return c->notDeleted == 0xFF
+        && (t == FS_TYPE_FILE_HEAD || (t == FS_TYPE_EXTENT && c->link == addr + sizeof(FsChunk)));
+}
+
+static int fsIsExtent(uint32_t addr) {
+    return (((const FsChunk*)addr)->type & 0x0F) == FS_TYPE_EXTENT;
+}
+
+// chunk after addr in the file of head, extent data follows its head in place
+static uint32_t fsNext(uint32_t head, uint32_t addr) {
+    if (!fsIsExtent(head)) return ((const FsChunk*)addr)->link;
+    addr += sizeof(FsChunk);
+    return addr < head + fsSpan(head) * sizeof(FsChunk) ? addr : FS_INVALID_ADDR;
+}
+
+static int fsHeadIs(uint32_t addr, const char* name) {
+    const FsChunk* c = (const FsChunk*)addr;
+    return fsIsHead(addr) && strncmp((const char*)c->data, name, FS_NAME_LEN) == 0;
+}
+
+// bytes, heads written before sizes were kept count whole data chunks
+static uint16_t fsHeadSize(uint32_t addr) {
+    const FsChunk* c = (const FsChunk*)addr;
+    uint16_t size = c->reserved1 | (c->reserved2 << 8);
+    uint32_t next = c->link;
+
+    if (size != FS_SIZE_UNKNOWN || fsIsExtent(addr)) return size;
+    for (size = 0; next >= FS_START_ADDR && next < FS_END_ADDR && size < FS_MAX_FILE_SIZE; next = c->link) {
+        c = (const FsChunk*)next;
+        if ((c->type & 0x0F) != FS_TYPE_FILE_DATA) break;
+        size += FS_PAYLOAD_SIZE;
+    }
+    return size;
+}
+
+static FsIndexEntry* fsIndexSlot(const char* name, uint16_t hash) {
+    uint16_t mask = fsIndexSlots - 1;
+
+    for (uint16_t i = hash & mask; fsIndex[i].addr; i = (i + 1) & mask)
+        if (fsIndex[i].hash == hash && fsHeadIs(fsIndex[i].addr, name)) return &fsIndex[i];
+    return NULL;
+}
+
+static void fsIndexPut(FsIndexEntry* table, uint16_t slots, uint32_t addr, uint16_t hash, uint16_t size) {
+    uint16_t i = hash & (slots - 1);
+
+    while (table[i].addr) i = (i + 1) & (slots - 1);
+    table[i].addr = addr;
+    table[i].hash = hash;
+    table[i].size = size;
+}
+
+static uint8_t fsIndexGrow(void) {
+    uint16_t slots = fsIndexSlots ? fsIndexSlots * 2 : FS_INDEX_MIN;
+    FsIndexEntry* table = memAlloc(MEM_FS, slots * sizeof(FsIndexEntry));
+
+    if (!table) return 0;
+    memset(table, 0, slots * sizeof(FsIndexEntry));
+    for (uint16_t i = 0; i < fsIndexSlots; i++)
+        if (fsIndex[i].addr) fsIndexPut(table, slots, fsIndex[i].addr, fsIndex[i].hash, fsIndex[i].size);
+    if (fsIndex) memFree(MEM_FS, fsIndex);
+    fsIndex = table;
+    fsIndexSlots = slots;
+    fsGc.slot = 0; // gc walks start over on the new table
+    fsGc.cost = 0;
+    return 1;
+}
+
+static void fsIndexAdd(uint32_t addr, const char* name, uint16_t size) {
+    if (!fsIndexValid) return;
+    if ((fsIndexCount + 1) * 4 > fsIndexSlots * 3 && !fsIndexGrow()) {
+        fsIndexValid = 0;
+        return;
+    }
+    fsIndexPut(fsIndex, fsIndexSlots, addr, fsHash(name), size);
+    fsIndexCount++;
+}
+
+// no tombstones: later entries of the probe run move back into the gap
+static void fsIndexDrop(uint32_t addr, const char* name) {
+    uint16_t mask = fsIndexSlots - 1;
+    uint16_t gap, i;
+
+    if (!fsIndexValid) return;
+    for (gap = fsHash(name) & mask; fsIndex[gap].addr != addr; gap = (gap + 1) & mask)
+        if (!fsIndex[gap].addr) return;
+
+    for (i = (gap + 1) & mask; fsIndex[i].addr; i = (i + 1) & mask) {
+        uint16_t home = fsIndex[i].hash & mask;
+        if (((i - home) & mask) >= ((i - gap) & mask)) { // home is not between the gap and i
+            if (gap < fsGc.slot && i >= fsGc.slot) fsGc.rewalk = 1; // the gc walk is past the gap
+            fsIndex[gap] = fsIndex[i];
+            gap = i;
+        }
+    }
+    fsIndex[gap].addr = 0;
+    fsIndexCount--;
+}
+
+// mount: one pass over flash for the index and the free map,
+// the first live head of a name wins like in a flash scan
+static void fsMount(void) {
+    char name[FS_NAME_LEN + 1];
+
+    if (fsIndex) memFree(MEM_FS, fsIndex);
+    fsIndex = NULL;
+    fsIndexSlots = fsIndexCount = 0;
+    fsIndexValid = fsIndexGrow();
+
+    if (fsFreeMap) memFree(MEM_FS, fsFreeMap);
+    fsChunks = (FS_END_ADDR - FS_START_ADDR) / sizeof(FsChunk);
+    fsFreeMap = memAlloc(MEM_FS, (fsChunks + 31) / 32 * sizeof(uint32_t));
+    if (fsFreeMap) memset(fsFreeMap, 0, (fsChunks + 31) / 32 * sizeof(uint32_t));
+    fsFreeCount = fsNextFree = 0;
+
+    if (fsPageDead) memFree(MEM_FS, fsPageDead);
+    if (fsPageErases) memFree(MEM_FS, fsPageErases);
+    fsPages = fsChunks / FS_PAGE_CHUNKS;
+#if defined(STM32F3)
+    fsPageDead = memAlloc(MEM_FS, fsPages * sizeof(uint16_t));
+    fsPageErases = memAlloc(MEM_FS, fsPages * sizeof(uint32_t));
+#else
+    fsPageDead = NULL; // sector erase not done yet, see fsFormat
+    fsPageErases = NULL;
+#endif
+    if (!fsPageDead || !fsPageErases) {
+        if (fsPageDead) memFree(MEM_FS, fsPageDead);
+        if (fsPageErases) memFree(MEM_FS, fsPageErases);
+        fsPageDead = NULL;
+        fsPageErases = NULL;
+    }
+    if (fsPageErases) {
+        memset(fsPageDead, 0, fsPages * sizeof(uint16_t));
+        fsPageCounts();
+    }
+    fsGc.state = GC_IDLE;
+    fsGc.owed = 0;
+    fsGc.tries = 0;
+    fsGc.skipPage = FS_INVALID_ADDR;
+    fsGc.wear = 0;
+
+    uint32_t dups = 0, span;
+    for (uint32_t i = 0; i < fsChunks; i += span) {
+        const FsChunk* c = (const FsChunk*)FS_CHUNK_ADDR(i);
+        uint8_t t = c->type & 0x0F;
+        span = 1;
+        if (FS_PAGE_HEAD(i) && (t == FS_TYPE_PAGE || fsChunkIsFree((FsChunk*)c)))
+            continue; // header, or a page erased before there were headers: it gets one with its next erase
+        if (fsChunkIsFree((FsChunk*)c)) {
+            if (fsFreeMap) fsFreeMap[i >> 5] |= 1U << (i & 31);
+            fsFreeCount++;
+            continue;
+        }
+        span = fsSpan(FS_CHUNK_ADDR(i)); // extent data is never parsed as chunks
+        if (t == FS_TYPE_FILE_DATA && c->notDeleted == 0xFF) continue;
+        if (!fsIsHead(FS_CHUNK_ADDR(i))) {
+            // deleted, or an extent a reset cut short
+            if (fsPageDead && i / FS_PAGE_CHUNKS < fsPages) fsPageDead[i / FS_PAGE_CHUNKS] += span;
+            continue;
+        }
+
+        memcpy(name, c->data, FS_NAME_LEN);
+        name[FS_NAME_LEN] = '\0';
+        if (fsIndexValid && fsIndexSlot(name, fsHash(name))) {
+            dups++;
+            continue;
+        }
+        fsIndexAdd(FS_CHUNK_ADDR(i), name, fsHeadSize(FS_CHUNK_ADDR(i)));
+    }
+
+    // a reset between the copy and the old chain being deleted by the gc leaves two
+    // complete copies, the one not indexed goes now
+    for (uint32_t i = 0; dups && fsIndexValid && i < fsChunks; i += span) {
+        const FsChunk* c = (const FsChunk*)FS_CHUNK_ADDR(i);
+        FsIndexEntry* e;
+        span = fsChunkIsFree((FsChunk*)c) ? 1 : fsSpan(FS_CHUNK_ADDR(i));
+        if (!fsIsHead(FS_CHUNK_ADDR(i))) continue;
+
+        memcpy(name, c->data, FS_NAME_LEN);
+        name[FS_NAME_LEN] = '\0';
+        e = fsIndexSlot(name, fsHash(name));
+        if (e && e->addr != FS_CHUNK_ADDR(i)) {
+            fsDeleteCopy(FS_CHUNK_ADDR(i), e->addr);
+            dups--;
+        }
+    }
+}
+
+// first free chunk at or after from, wrapping. Needs fsFreeCount > 0
+static uint32_t fsFreeFind(uint32_t from) {
+    uint32_t words = (fsChunks + 31) >> 5;
+    uint32_t w = from >> 5;
+    uint32_t bits = fsFreeMap[w] & (~0U << (from & 31));
+
+    while (!bits) {
+        w = (w + 1 == words) ? 0 : w + 1;
+        bits = fsFreeMap[w];
+    }
+    return (w << 5) + __builtin_ctz(bits);
+}
+
+static int fsFreeRun(uint32_t i, uint32_t n) {
+    for (uint32_t k = 0; k < n; k++)
+        if (i + k >= fsChunks || !FS_FREE_BIT(i + k)) return 0;
+    return 1;
+}
+
+// first run of n free chunks in a page, -1 if none
+static int32_t fsPageRun(uint32_t p, uint32_t n) {
+    uint32_t run = 0;
+
+    for (uint32_t i = p * FS_PAGE_CHUNKS + 1; i < (p + 1) * FS_PAGE_CHUNKS; i++) {
+        run = FS_FREE_BIT(i) ? run + 1 : 0;
+        if (run == n) return i + 1 - n;
+    }
+    return -1;
+}
+
+// moves the cursor so a file lands in one run of n free chunks. The cursor's page is
+// filled while the file fits, then the coldest page with room is taken (hottest for
+// static data moved by wear leveling), then the first run anywhere.
+// Stays put when there is none and the file is scattered
+static void fsFreeReserve(uint32_t n, uint8_t hot) {
+    uint32_t run = 0, first = 0, best = FS_INVALID_ADDR;
+    int32_t bestRun = -1;
+
+    if (!fsFreeMap || n > fsFreeCount) return;
+    if (fsFreeRun(fsNextFree, n)) return;
+    for (uint32_t p = 0; fsPageErases && n < FS_PAGE_CHUNKS && p < fsPages; p++) {
+        if (best != FS_INVALID_ADDR && (hot ? fsPageErases[p] <= fsPageErases[best] : fsPageErases[p] >= fsPageErases[best]))
+            continue;
+        int32_t r = fsPageRun(p, n);
+        if (r < 0) continue;
+        best = p;
+        bestRun = r;
+    }
+    if (bestRun >= 0) {
+        fsNextFree = bestRun;
+        return;
+    }
+    for (uint32_t k = 0, i = fsNextFree; k < fsChunks; ) {
+        if (!(i & 31) && !fsFreeMap[i >> 5]) { // nothing free in this word
+            uint32_t skip = (fsChunks - i < 32) ? fsChunks - i : 32;
+            run = 0;
+            k += skip;
+            i += skip;
+        } else {
+            if (!FS_FREE_BIT(i)) run = 0;
+            else if (!run++) first = i;
+            if (run == n) {
+                fsNextFree = first;
+                return;
+            }
+            k++;
+            i++;
+        }
+        if (i == fsChunks) {
+            i = 0;
+            run = 0; // runs do not wrap
+        }
+    }
+}
+
+static int fsChunkErased(uint32_t addr);
+
+// claims a run of n chunks for an extent if the cursor sits on one inside a page and every
+// chunk of it is still erased. Returns the first chunk address, 0 if the file has to be a chain
+static uint32_t fsFreeTake(uint32_t n) {
+    uint32_t i = fsNextFree;
+
+    if (!fsFreeMap || i / FS_PAGE_CHUNKS != (i + n - 1) / FS_PAGE_CHUNKS || !fsFreeRun(i, n)) return 0;
+    for (uint32_t k = 0; k < n; k++)
+        if (!fsChunkErased(FS_CHUNK_ADDR(i + k))) return 0;
+    for (uint32_t k = i; k < i + n; k++)
+        fsFreeMap[k >> 5] &= ~(1U << (k & 31));
+    fsFreeCount -= n;
+    fsNextFree = (i + n == fsChunks) ? 0 : i + n;
+    return FS_CHUNK_ADDR(i);
+}
+
+static int fsErasePage(uint32_t addr) {
+#if defined(STM32F3)
+    FLASH_EraseInitTypeDef eraseInit = {0};
+    uint32_t pageError = 0;
+    HAL_StatusTypeDef r;
+
+    eraseInit.TypeErase   = FLASH_TYPEERASE_PAGES;
+    eraseInit.PageAddress = addr;
+    eraseInit.NbPages     = 1;
+    #if defined(FLASH_BANK_1)
+    eraseInit.Banks       = FLASH_BANK_1;
+    #endif
+
+    HAL_FLASH_Unlock();
+    r = HAL_FLASHEx_Erase(&eraseInit, &pageError);
+    HAL_FLASH_Lock();
+    return r == HAL_OK ? 0 : -1;
+#else
+    return -1; // sectors, see fsFormat
 #endif
 }
 
+// erase count from the page header, 0 for a page without one
+static uint32_t fsPageEraseCount(uint32_t page) {
+    const FsChunk* h = (const FsChunk*)page;
+    uint32_t n;
+
+    if ((h->type & 0x0F) != FS_TYPE_PAGE) return 0;
+    memcpy(&n, h->data, sizeof(n));
+    return n;
+}
+
+static int fsProgramChunk(uint32_t addr, const FsChunk* c);
+
+// header of a freshly erased page
+static int fsPageStamp(uint32_t page, uint32_t erases) {
+    FsChunk h;
+
+    memset(&h, 0xFF, sizeof(h));
+    h.type = FS_TYPE_PAGE;
+    memcpy(h.data, &erases, sizeof(erases));
+    return fsProgramChunk(page, &h);
+}
+
+static int fsChunkErased(uint32_t addr) {
+    for (uint32_t a = addr; a < addr + sizeof(FsChunk); a += 4)
+        if (*(__IO uint32_t*)a != 0xFFFFFFFFU) return 0;
+    return 1;
+}
+
+// erase counts from the page headers. A reset between a page erase and its header leaves
+// chunk 0 erased and the count lost: the page gets the highest count there is and its header,
+// so wear leveling does not take it for the cold one
+static void fsPageCounts(void) {
+    uint32_t hot = 0;
+
+    for (uint32_t p = 0; p < fsPages; p++) {
+        fsPageErases[p] = fsPageEraseCount(FS_PAGE_ADDR(p));
+        if (fsPageErases[p] > hot) hot = fsPageErases[p];
+    }
+    for (uint32_t p = 0; p < fsPages; p++) {
+        if (!fsChunkErased(FS_PAGE_ADDR(p))) continue;
+        fsPageErases[p] = hot;
+        fsPageStamp(FS_PAGE_ADDR(p), hot);
+    }
+}
+
 
-void fsTest(char* param) {
+// fstest [bytes]    write, read back, delete; prints flash taken and timing
+int fsTest(char* param) {
     const char* filename = "testfile";
     size_t size = CHUNK_PAYLOAD_SIZE * 3;
+    uint32_t t, writeUs, readUs, head, chunks = 0;
+    uint8_t extent;
 
+    if (param && atoi(param) > 0) size = atoi(param);
+    if (size > FS_MAX_FILE_SIZE) size = FS_MAX_FILE_SIZE;
     printf("Starting fs test\n");
     kernel_process(1);
 
-    char* testData = malloc(size);
+    char* testData = memAlloc(MEM_FS, size);
     if (!testData) {
         setTextColor(RED);
         printf("Error: Memory allocation failed\n");
         setTextColor(DEFAULT_COLOR);
-        return;
+        return 0;
     }
     for (size_t i = 0; i < size; ++i) {
         testData[i] = 'A' + (i % 26);
     }
 
     // 1) Write
+    t = usTimerRead();
     if (fsWriteBinary(filename, testData, size) != 0) {
         setTextColor(RED);
         printf("Error: Write failed\n");
         setTextColor(DEFAULT_COLOR);
-        free(testData);
-        return;
+        memFree(MEM_FS, testData);
+        return 0;
     }
+    writeUs = usTimerRead() - t;
+    head = fsFind(filename);
+    extent = head && fsIsExtent(head);
+    for (uint32_t a = head; a >= FS_START_ADDR && a < FS_END_ADDR && chunks < FS_CHAIN_MAX;
+            a = fsNext(head, a))
+        chunks++;
 
     // 2) Read & verify
-    char* readBuf = malloc(size + 1);
+    char* readBuf = memAlloc(MEM_FS, size + 1);
     if (!readBuf) {
         setTextColor(RED);
         printf("Error: Memory allocation failed\n");
         setTextColor(DEFAULT_COLOR);
-        free(testData);
-        return;
+        memFree(MEM_FS, testData);
+        return 0;
     }
+    t = usTimerRead();
+    for (uint8_t r = 0; r < FS_TEST_READS - 1; r++)
+        fsRead(filename, readBuf, size + 1);
     if (fsRead(filename, readBuf, size + 1) != 0) {
         setTextColor(RED);
         printf("Error: Read failed\n");
         setTextColor(DEFAULT_COLOR);
-        free(testData);
-        free(readBuf);
-        return;
+        memFree(MEM_FS, testData);
+        memFree(MEM_FS, readBuf);
+        return 0;
     }
+    readUs = usTimerRead() - t;
     if (memcmp(readBuf, testData, size) != 0) {
         setTextColor(RED);
         printf("Error: Data mismatch\n");
         setTextColor(DEFAULT_COLOR);
-        free(testData);
-        free(readBuf);
-        return;
+        memFree(MEM_FS, testData);
+        memFree(MEM_FS, readBuf);
+        return 0;
     }
-    free(readBuf);
+    memFree(MEM_FS, readBuf);
 
     // 3) Delete
     if (fsDelete(filename) != 0) {
         setTextColor(RED);
         printf("Error: Delete failed\n");
         setTextColor(DEFAULT_COLOR);
-        free(testData);
-        return;
+        memFree(MEM_FS, testData);
+        return 0;
     }
 
     // 4) Ensure it's gone
@@ -122,16 +592,24 @@ void fsTest(char* param) {
         setTextColor(RED);
         printf("Error: File still exists after delete\n");
         setTextColor(DEFAULT_COLOR);
-        free(testData);
-        return;
+        memFree(MEM_FS, testData);
+        return 0;
     }
 
-    free(testData);
+    memFree(MEM_FS, testData);
+
+    printf("%u B as %s: %lu chunks, %lu B of flash (%lu%% data)\n", (unsigned)size,
+           extent ? "extent" : "chain", (unsigned long)chunks,
+           (unsigned long)(chunks * sizeof(FsChunk)), (unsigned long)(size * 100 / (chunks * sizeof(FsChunk))));
+    printf("write %lu us, read %lu us (%lu KB/s)\n", (unsigned long)writeUs,
+           (unsigned long)(readUs / FS_TEST_READS),
+           (unsigned long)(readUs ? (uint64_t)size * FS_TEST_READS * 1000000 / 1024 / readUs : 0));
 
     // Success
     setTextColor(GREEN);
     printf("All Tests passed\n");
     setTextColor(DEFAULT_COLOR);
+    return 0;
 }
 
 
@@ -154,7 +632,7 @@ uint8_t fsPageIsEmpty(uint32_t pageIndex) {
 }
 
 
-uint8_t fsPrintUsage(char* param) {
+int fsPrintUsage(char* param) {
     const uint32_t pageSize      = FLASH_PAGE_SIZE;
     const uint32_t chunkSize     = sizeof(FsChunk);
     const uint32_t chunksPerPage = pageSize / chunkSize;
@@ -175,15 +653,15 @@ uint8_t fsPrintUsage(char* param) {
     FsChunk chunk;
     while (addr + pageSize <= end) {
         int usedInPage = 0;
-        // count used vs free chunks in this page
-        for (uint32_t off = 0; off < pageSize; off += chunkSize) {
+        // count used vs free chunks in this page, an extent with its data
+        for (uint32_t off = 0, span; off < pageSize; off += span * chunkSize) {
             memcpy(&chunk, (void*)(addr + off), chunkSize);
             uint8_t t = chunk.type & 0x0F;
-            if ((t == FS_TYPE_FILE_HEAD || t == FS_TYPE_FILE_DATA)
-                && chunk.notDeleted == 0xFF)
+            span = fsChunkIsFree(&chunk) ? 1 : fsSpan(addr + off);
+            if ((t == FS_TYPE_FILE_DATA && chunk.notDeleted == 0xFF) || fsIsHead(addr + off))
             {
-                usedInPage++;
-                if (t == FS_TYPE_FILE_HEAD) {
+                usedInPage += span;
+                if (t != FS_TYPE_FILE_DATA) {
                     fileCount++;
                 }
             }
@@ -242,44 +720,35 @@ uint8_t fsPrintUsage(char* param) {
 }
 
 
-void fsFormat(char* param)
+int fsFormat(char* param)
 {
 #if defined(STM32F3)
 
-    FLASH_EraseInitTypeDef eraseInit = {0};
-    uint32_t pageError = 0;
-
     // Start at the first page at or after FS_START_ADDR
     uint32_t addr = FS_START_ADDR & ~(FLASH_PAGE_SIZE - 1);
 
-    HAL_FLASH_Unlock();
-
-    // Erase pages up through FS_END_ADDR
+    // Erase pages up through FS_END_ADDR, erase counts survive
     while (addr + FLASH_PAGE_SIZE <= FS_END_ADDR) {
-        eraseInit.TypeErase   = FLASH_TYPEERASE_PAGES;
-        eraseInit.PageAddress = addr;
-        eraseInit.NbPages     = 1;
-    #if defined(FLASH_BANK_1)
-        eraseInit.Banks       = FLASH_BANK_1;
-    #endif
+        uint32_t erases = fsPageEraseCount(addr);
 
-        if (HAL_FLASHEx_Erase(&eraseInit, &pageError) != HAL_OK) {
-            printf("fsFormat: Erase failed at 0x%08lX (err page 0x%08lX)\n",
-                   (unsigned long)addr, (unsigned long)pageError);
+        if (fsErasePage(addr) < 0) {
+            printf("fsFormat: Erase failed at 0x%08lX\n", (unsigned long)addr);
             break;
         }
+        fsPageStamp(addr, erases + 1);
 
         addr += FLASH_PAGE_SIZE;
     }
 
-    HAL_FLASH_Lock();
+    fsMount();
 #else
     printf("No formatting for your device yet\n");
 #endif
+    return 0;
 }
 
 // long execution time
-void fsDebugChunks(char* params) {
+int fsDebugChunks(char* params) {
 	/*
     printf("Chunk Debug:\n");
     uint32_t addr = FS_START_ADDR;
@@ -299,6 +768,7 @@ void fsDebugChunks(char* params) {
         addr += sizeof(FsChunk);
         kernel_process(1); // TODO! depth
     }*/
+    return 0;
 }
 
 
@@ -306,24 +776,39 @@ int fsFind(char* name) {
     uint32_t addr = FS_START_ADDR;
     FsChunk chunk;
 
+    if (fsIndexValid) {
+        FsIndexEntry* e = fsIndexSlot(name, fsHash(name));
+        return e ? e->addr : 0;
+    }
+
     while (addr + sizeof(FsChunk) <= FS_END_ADDR) {
         memcpy(&chunk, (void*)addr, sizeof(FsChunk));
         // Only match live file heads whose name equals `name`
-        if ((chunk.type & 0x0F) == FS_TYPE_FILE_HEAD
-            && chunk.notDeleted == 0xFF
-            && strncmp((char*)chunk.data, name, FS_NAME_LEN) == 0)
+        if (fsIsHead(addr) && strncmp((char*)chunk.data, name, FS_NAME_LEN) == 0)
         {
             return addr;
         }
-        addr += sizeof(FsChunk);
+        addr += fsChunkIsFree(&chunk) ? sizeof(FsChunk) : fsSpan(addr) * sizeof(FsChunk);
         kernel_process(1);
     }
     return 0;
 }
 
 
+// claims the next free chunk (next-fit), returns its address or -1 when flash is full
 int32_t fsFindFreeChunk(void) {
     FsChunk chunk;
+
+    while (fsFreeMap && fsFreeCount) {
+        uint32_t i = fsFreeFind(fsNextFree);
+        fsFreeMap[i >> 5] &= ~(1U << (i & 31));
+        fsFreeCount--;
+        fsNextFree = (i + 1 == fsChunks) ? 0 : i + 1;
+        if (fsChunkErased(FS_CHUNK_ADDR(i))) return FS_CHUNK_ADDR(i);
+        // half written before a reset, left for the page erase
+    }
+    if (fsFreeMap) return -1;
+
     const uint32_t base       = FS_START_ADDR;
     const uint32_t end        = FS_END_ADDR;
     const uint32_t chunkSize  = sizeof(FsChunk);
@@ -332,65 +817,86 @@ int32_t fsFindFreeChunk(void) {
     const uint32_t totalBytes = end - base + 1U;
     const uint32_t nChunks    = totalBytes / chunkSize;
 
-    // scan from chunk index nChunks-1 down to 0
-    for (uint32_t i = nChunks; i > 0U; --i) {
-        uint32_t addr = base + (i - 1U) * chunkSize;
+    // scan up from chunk index 0, extent data is skipped as a whole
+    for (uint32_t i = 0; i < nChunks; ) {
+        uint32_t addr = base + i * chunkSize;
         memcpy(&chunk, (void*)addr, chunkSize);
-        if (fsChunkIsFree(&chunk)) {
+        if (!FS_PAGE_HEAD(i) && fsChunkIsFree(&chunk)) {
             return (int32_t)addr;
         }
+        i += fsChunkIsFree(&chunk) ? 1 : fsSpan(addr);
         kernel_process(1);  // give time to other tasks
     }
 
     return -1;
 }
 
-int fsDelete(char *name) {
-    if (!name || !*name)
-        return 1;  // invalid name
-
-    uint32_t addr = fsFind(name);
-    if (addr == FS_INVALID_ADDR)
-        return 2;  // not found
-
-    FsChunk chk;
-    while ((addr != FS_INVALID_ADDR) && (addr > 0)) {
-        memcpy(&chk, (void*)addr, sizeof(chk));
-
+// clears notDeleted of one chunk, the chunk counts as dead for its page
+static int fsMarkDeleted(uint32_t addr) {
+    // Calculate half-word address for notDeleted (offsets 2–3)
+    uint32_t hw_addr = addr + offsetof(FsChunk, notDeleted);
+    // Read existing half-word
+    uint16_t existingHW = *(__IO uint16_t*)hw_addr;
+    // Desired: keep high byte (reserved2), clear low byte (notDeleted)
+    uint16_t desiredHW  = existingHW & 0xFF00;
 
-        // Calculate half-word address for notDeleted (offsets 2–3)
-        uint32_t hw_addr = addr + offsetof(FsChunk, notDeleted);
-        // Read existing half-word
-        uint16_t existingHW = *(__IO uint16_t*)hw_addr;
-        // Desired: keep high byte (reserved2), clear low byte (notDeleted)
-        uint16_t desiredHW  = existingHW & 0xFF00;
+    if (existingHW == desiredHW)
+        return 0;  // already dead
 
-        // Debug each half-word
+    // Only allow 1→0 transitions
+    if ((desiredHW & existingHW) != desiredHW)
+        return 3;
 
-        // Only allow 1→0 transitions
-        if ((desiredHW & existingHW) != desiredHW)
-            return 3;
+    // Clear stale flags, unlock, wait for BUSY to clear
+    //FLASH->SR = FLASH_SR_PGERR | FLASH_SR_WRPERR | FLASH_SR_EOP;
 
-        // Clear stale flags, unlock, wait for BUSY to clear
-        //FLASH->SR = FLASH_SR_PGERR | FLASH_SR_WRPERR | FLASH_SR_EOP;
-
-        HAL_FLASH_Unlock();
-        while (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) {}
+    HAL_FLASH_Unlock();
+    while (__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY)) {}
 
-        // Program the half-word
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, hw_addr, desiredHW) != HAL_OK) {
-            HAL_FLASH_Lock();
-            return 4;  // flash program error
-        }
+    // Program the half-word
+    if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, hw_addr, desiredHW) != HAL_OK) {
         HAL_FLASH_Lock();
-
-        // Move to the next chunk
-        addr = (chk.link == FS_INVALID_ADDR) ? FS_INVALID_ADDR : chk.link;
+        return 4;  // flash program error
     }
+    HAL_FLASH_Lock();
+    if (fsPageDead) fsPageDead[FS_PAGE_OF(addr)] += fsSpan(addr);
+    return 0;
+}
 
+// deletes head and data chunks, name drops the head from the index.
+// An extent goes with its head
+static int fsDeleteChain(uint32_t addr, const char* name) {
+    uint32_t head = addr;
+    int r;
+
+    // the gc moved the file and the old copy is still live, it goes first:
+    // mount must not find it after a reset
+    while (fsGc.state == GC_RETIRE && fsGc.to[0] == head) fsGcStep();
+    if (fsIsExtent(head)) {
+        if ((r = fsMarkDeleted(head)) == 0 && name) fsIndexDrop(head, name);
+        return r;
+    }
+    for (uint8_t n = 0; addr >= FS_START_ADDR && addr < FS_END_ADDR && n < FS_CHAIN_MAX; n++) {
+        uint32_t next = ((const FsChunk*)addr)->link;
+        if ((r = fsMarkDeleted(addr)) != 0)
+            return r;
+        if (addr == head && name) fsIndexDrop(head, name);
+        addr = next;
+    }
     return 0;
 }
 
+int fsDelete(char *name) {
+    if (!name || !*name)
+        return 1;  // invalid name
+
+    uint32_t addr = fsFind(name);
+    if (!addr)
+        return 2;  // not found
+
+    return fsDeleteChain(addr, name);
+}
+
 
 
 
@@ -434,7 +940,7 @@ static int _WritePreChecks(const char *name, size_t size) {
     }
     /* Remove any existing file by the same name */
     int existing = fsFind(name);
-    if (existing >= 0) {
+    if (existing) {
         if (fsDelete(name) != 0) {
             printf("WARN: failed to delete existing '%s'\n", name);
         }
@@ -445,6 +951,37 @@ static int _WritePreChecks(const char *name, size_t size) {
 // adjust how many bytes we write per chunk
 #define CHUNK_PAYLOAD_SIZE  FS_PAYLOAD_SIZE
 
+/* Program len bytes half-word at a time, only 1→0 transitions. An odd last byte is padded with 0xFF */
+static int fsProgram(uint32_t addr, const void* src, size_t len) {
+    const uint8_t *bytes = (const uint8_t*)src;
+
+    HAL_FLASH_Unlock();
+    for (size_t w = 0; w < (len + 1)/2; ++w) {
+        uint32_t a = addr + 2*w;
+        uint16_t ex = *(__IO uint16_t*)a;
+        uint16_t de = bytes[2*w] | ((2*w + 1 < len ? bytes[2*w + 1] : 0xFF) << 8);
+        if ((de & ex) != de) { printf("ERR 0→1 at hw %zu\n", w);
+                              HAL_FLASH_Lock(); return -1; }
+        if (ex != de)
+            if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, a, de) != HAL_OK) {
+                printf("ERR write hw %zu\n", w);
+                HAL_FLASH_Lock(); return -1;
+            }
+    }
+    HAL_FLASH_Lock();
+    return 0;
+}
+
+static int fsProgramChunk(uint32_t addr, const FsChunk* c) {
+    return fsProgram(addr, c, sizeof(FsChunk));
+}
+
+// type last: an extent head cut short by a reset never shows up with half its size
+static int fsProgramHead(uint32_t addr, const FsChunk* c) {
+    if (fsProgram(addr + 2, (const uint8_t*)c + 2, sizeof(FsChunk) - 2) < 0) return -1;
+    return fsProgram(addr, c, 2);
+}
+
 /* 2) Write header chunk (32B) half-word at a time */
 static uint32_t _WriteHeaderChunk(const char *name, size_t size) {
     int32_t addr = fsFindFreeChunk();         // returns a 32B-aligned flash address
@@ -455,21 +992,10 @@ static uint32_t _WriteHeaderChunk(const char *name, size_t size) {
     hdr.type = FS_TYPE_FILE_HEAD;
     // link left 0xFFFFFFFF until first data chunk
     strncpy((char*)hdr.data, name, FS_PAYLOAD_SIZE);
+    hdr.reserved1 = size & 0xFF;
+    hdr.reserved2 = size >> 8;
 
-    HAL_FLASH_Unlock();
-    uint16_t *words = (uint16_t*)&hdr;
-    for (size_t w = 0; w < sizeof(hdr)/2; ++w) {
-        uint32_t a = addr + 2*w;
-        uint16_t ex = *(__IO uint16_t*)a, de = words[w];
-        if ((de & ex) != de) { printf("ERR 0→1 at hw %zu\n", w);
-                              HAL_FLASH_Lock(); return 0; }
-        if (ex != de)
-            if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, a, de) != HAL_OK) {
-                printf("ERR write hw %zu\n", w);
-                HAL_FLASH_Lock(); return 0;
-            }
-    }
-    HAL_FLASH_Lock();
+    if (fsProgramChunk(addr, &hdr) < 0) return 0;
     return addr;
 }
 
@@ -484,20 +1010,7 @@ static uint32_t _WriteChunk(const void *buf, size_t len) {
     c.link = 0xFFFFFFFF;
     memcpy(c.data, buf, len);
 
-    HAL_FLASH_Unlock();
-    uint16_t *words = (uint16_t*)&c;
-    for (size_t w = 0; w < sizeof(c)/2; ++w) {
-        uint32_t a = addr + 2*w;
-        uint16_t ex = *(__IO uint16_t*)a, de = words[w];
-        if ((de & ex) != de) { printf("ERR 0→1 at hw %zu\n", w);
-                              HAL_FLASH_Lock(); return 0; }
-        if (ex != de)
-            if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, a, de) != HAL_OK) {
-                printf("ERR write hw %zu\n", w);
-                HAL_FLASH_Lock(); return 0;
-            }
-    }
-    HAL_FLASH_Lock();
+    if (fsProgramChunk(addr, &c) < 0) return 0;
     return addr;
 }
 
@@ -528,11 +1041,68 @@ static int _MarkHeader(uint32_t hdr_addr, uint32_t next_addr) {
 
 
 
+static int fsWriteChain(char *name, char *data, int size);
+static void fsGcReclaim(uint32_t need);
+
 int fsWriteBinary(char *name, char *data, int size) {
+    int r;
+
+    fsBusy++; // the gc keeps off a chain being built
+    r = fsWriteChain(name, data, size);
+    fsBusy--;
+    return r;
+}
+
+// head first with the link still erased, then the data in place, then the link that makes
+// the file complete. A reset before it leaves a head that mount counts dead with its data
+static int fsWriteExtent(uint32_t head, const char *name, const char *data, int size) {
+    uint32_t n = FS_EXTENT_CHUNKS(size);
+    FsChunk hdr;
+    int r = 0;
+
+    memset(&hdr, 0xFF, sizeof(hdr));
+    hdr.type = FS_TYPE_EXTENT;
+    strncpy((char*)hdr.data, name, FS_NAME_LEN);
+    hdr.reserved1 = size & 0xFF;
+    hdr.reserved2 = size >> 8;
+    if (fsProgramHead(head, &hdr) < 0) {
+        fsMarkDeleted(head);
+        return 1;
+    }
+
+    for (uint32_t k = 0; k < n && r == 0; k++) {
+        uint32_t len = (k + 1 < n) ? sizeof(FsChunk) : size - k * sizeof(FsChunk);
+        r = fsProgram(head + (k + 1) * sizeof(FsChunk), data + k * sizeof(FsChunk), len);
+        kernel_process(1);
+    }
+    if (r < 0 || _MarkHeader(head, head + sizeof(FsChunk)) < 0) {
+        fsMarkDeleted(head); // the run goes dead with it
+        return 1;
+    }
+    fsIndexAdd(head, name, size);
+    return 0;
+}
+
+static int fsWriteChain(char *name, char *data, int size) {
     if (_WritePreChecks(name, size) < 0) return 1;
+    uint32_t need = 1 + (size + CHUNK_PAYLOAD_SIZE - 1) / CHUNK_PAYLOAD_SIZE;
+    if (fsPageDead) {
+        // a page worth of free chunks stays for the gc to move live data into,
+        // more while the chains of a victim are on their way
+        if (fsFreeCount < need + FS_PAGE_CHUNKS + fsGc.owed) fsGcReclaim(need + FS_PAGE_CHUNKS);
+        if (fsFreeCount < need + FS_PAGE_CHUNKS + fsGc.owed) { printf("ERR filesystem full\n"); return 1; }
+    }
+#if FS_EXTENTS
+    // one run of chunks in a page: the data goes without chunk headers or links
+    uint32_t extent = 1 + FS_EXTENT_CHUNKS(size);
+    fsFreeReserve(extent, 0);
+    if ((extent = fsFreeTake(extent)) != 0) return fsWriteExtent(extent, name, data, size);
+#endif
+    fsFreeReserve(need, 0);
 
     uint32_t header_addr = _WriteHeaderChunk(name, size);
     if (!header_addr) return 1;
+    fsIndexAdd(header_addr, name, size); // the head is what lookups find, even if data fails below
 
     const uint8_t *ptr      = (const uint8_t*)data;
     size_t        remaining = size;
@@ -565,19 +1135,566 @@ int fsWriteBinary(char *name, char *data, int size) {
 }
 
 
+static void fsFreeGive(uint32_t addr) {
+    uint32_t i = (addr - FS_START_ADDR) / sizeof(FsChunk);
+
+    if (FS_PAGE_HEAD(i) || FS_FREE_BIT(i) || !fsChunkErased(addr)) return;
+    fsFreeMap[i >> 5] |= 1U << (i & 31);
+    fsFreeCount++;
+}
+
+// chain of a head, head first, or an extent head and its data. 0 - longer than any file
+static uint8_t fsChain(uint32_t head, uint32_t* out) {
+    uint8_t n = 0;
+
+    for (uint32_t a = head; a >= FS_START_ADDR && a < FS_END_ADDR; a = fsNext(head, a)) {
+        if (n == FS_CHAIN_MAX) return 0;
+        out[n++] = a;
+    }
+    return n;
+}
+
+// the gc copies a chain only up to its last chunk in the victim page, both copies share
+// the rest. Only the chunks in front of the first shared one belong to the copy at addr
+static void fsDeleteCopy(uint32_t addr, uint32_t kept) {
+    uint8_t n = fsChain(kept, fsGc.from); // gc is idle while mounting
+    uint32_t next;
+
+    if (!n) return; // kept chain broken, can't tell what is shared
+    if (fsIsExtent(addr)) {
+        fsMarkDeleted(addr);
+        return;
+    }
+    for (uint8_t k = 0; addr >= FS_START_ADDR && addr < FS_END_ADDR && k < FS_CHAIN_MAX; k++) {
+        for (uint8_t j = 0; j < n; j++)
+            if (fsGc.from[j] == addr) return;
+        next = ((const FsChunk*)addr)->link;
+        if (fsMarkDeleted(addr)) return;
+        addr = next;
+    }
+}
+
+// coldest and hottest page
+static void fsWearRange(uint32_t* cold, uint32_t* hot) {
+    *cold = *hot = 0;
+    for (uint32_t p = 1; p < fsPages; p++) {
+        if (fsPageErases[p] < fsPageErases[*cold]) *cold = p;
+        if (fsPageErases[p] > fsPageErases[*hot]) *hot = p;
+    }
+}
+
+static uint32_t fsPageFree(uint32_t p) {
+    uint32_t free = 0;
+
+    for (uint32_t i = p * FS_PAGE_CHUNKS; i < (p + 1) * FS_PAGE_CHUNKS; i++)
+        if (FS_FREE_BIT(i)) free++;
+    return free;
+}
+
+// chunks of the page holding live file data. Chunk 0 of a page erased before there were
+// headers can be one of them
+static uint32_t fsPageLive(uint32_t p, uint32_t free) {
+    const FsChunk* h = (const FsChunk*)FS_PAGE_ADDR(p);
+    uint32_t used = free + fsPageDead[p] + ((h->type & 0x0F) == FS_TYPE_PAGE || fsChunkIsFree((FsChunk*)h));
+
+    return used < FS_PAGE_CHUNKS ? FS_PAGE_CHUNKS - used : 0;
+}
+
+// walks hand the rest of the slice back, the next step goes on from the cursor
+static int fsGcYield(void) {
+    return usTimerRead() - fsGc.sliceStart >= FS_GC_SLICE;
+}
+
+// candidate victim, GC_COST counts what copying it out takes before it is taken
+static int fsGcStart(uint32_t page, uint8_t wear) {
+    uint32_t free = fsPageFree(page);
+
+    if (fsPageLive(page, free) > fsFreeCount - free) return 0; // live chunks must have somewhere to go
+    fsGc.page = page;
+    fsGc.wear = wear;
+    fsGc.cost = 0;
+    fsGc.slot = 0;
+    fsGc.state = GC_COST;
+    return 1;
+}
+
+// takes the victim, its erased chunks leave the free map so nothing is written there before the erase
+static void fsGcTake(uint32_t free) {
+    uint32_t first = fsGc.page * FS_PAGE_CHUNKS;
+
+    for (uint32_t i = first; i < first + FS_PAGE_CHUNKS; i++)
+        fsFreeMap[i >> 5] &= ~(1U << (i & 31));
+    fsFreeCount -= free;
+    fsGc.freeBefore = free;
+    fsGc.deadBefore = fsPageDead[fsGc.page];
+    fsGc.owed = fsGc.cost;
+    if (!fsGc.wear) {
+        fsGc.tries = 0;
+        if (fsGc.force) fsGc.force--;
+    }
+    fsGc.slot = 0;
+    fsGc.rewalk = 0;
+    fsGc.state = GC_FIND;
+}
+
+// chunks collecting the page copies, every chain up to its last chunk there, the chain parts
+// leading to live chunks must have somewhere to go too. Past the room there is the page is
+// passed over, a cold one waits for the next FS_WEAR_EVERY erases
+static void fsGcCost(void) {
+    uint32_t lo = FS_CHUNK_ADDR(fsGc.page * FS_PAGE_CHUNKS), hi = lo + FLASH_PAGE_SIZE;
+    uint32_t free = fsPageFree(fsGc.page), room = fsFreeCount - free;
+
+    for (uint16_t s = fsGc.slot; s < fsIndexSlots && fsGc.cost <= room; s++) {
+        uint32_t n = 0, last = 0;
+        if (s != fsGc.slot && fsGcYield()) {
+            fsGc.slot = s;
+            return;
+        }
+        if (!fsIndex[s].addr) continue;
+
+        for (uint32_t a = fsIndex[s].addr; a >= FS_START_ADDR && a < FS_END_ADDR && n < FS_CHAIN_MAX;
+                a = fsNext(fsIndex[s].addr, a)) {
+            n++;
+            if (a >= lo && a < hi) last = n;
+        }
+        fsGc.cost += last;
+    }
+    if (fsGc.cost <= room) {
+        fsGcTake(free);
+        return;
+    }
+    fsGc.state = GC_IDLE;
+    if (fsGc.wear) {
+        fsGc.wear = 0;
+        fsGc.sinceWear = 0;
+    } else fsGc.tries++;
+}
+
+// victim is the page with most dead chunks, pages more than FS_WEAR_SPREAD erases
+// above the coldest count half of them. A page too costly to copy out is passed over
+// for the next best, FS_GC_TRIES of them, one per pick
+static int fsGcPick(void) {
+    uint32_t best = fsGc.triedPage, score = fsGc.triedScore, cold, hot;
+    uint8_t forced = fsGc.force != 0;
+
+    if (!fsGc.tries) best = score = FS_INVALID_ADDR;
+    fsWearRange(&cold, &hot);
+    for (; fsGc.tries < FS_GC_TRIES; fsGc.tries++) {
+        uint32_t lastBest = best, lastScore = score;
+
+        best = score = 0;
+        for (uint32_t p = 0; p < fsPages; p++) {
+            uint32_t s = fsPageDead[p] * 2;
+            if (p == fsGc.skipPage && fsPageDead[p] == fsGc.skipDead) continue;
+            if (fsPageErases[p] > fsPageErases[cold] + FS_WEAR_SPREAD) s /= 2;
+            if (s > lastScore || (s == lastScore && p <= lastBest)) continue; // tried
+            if (s > score) {
+                score = s;
+                best = p;
+            }
+        }
+        if (!score) {
+            if (!fsGc.tries) fsGc.force = 0;
+            break;
+        }
+        if (!forced && fsPageDead[best] * 100 < FS_PAGE_CHUNKS * FS_GC_DEAD_PCT
+                && fsFreeCount >= 2 * FS_PAGE_CHUNKS)
+            break;
+        if (fsGcStart(best, 0)) {
+            fsGc.triedPage = best;
+            fsGc.triedScore = score;
+            return 1;
+        }
+    }
+    if (fsGc.tries && fsGc.force) fsGc.force--;
+    fsGc.tries = 0;
+    return 0;
+}
+
+// static wear leveling: data that never changes keeps its page cold while the rest wears.
+// Every FS_WEAR_EVERY erases at most, the coldest page holding data is collected once it is
+// FS_WEAR_SPREAD erases behind the hottest, its data goes to hot pages
+static int fsGcPickCold(void) {
+    uint32_t cold = FS_INVALID_ADDR, lo, hot;
+
+    if (fsGc.sinceWear < FS_WEAR_EVERY) return 0;
+    fsWearRange(&lo, &hot);
+    for (uint32_t p = 0; p < fsPages; p++) {
+        if (!fsPageLive(p, fsPageFree(p))) continue; // nothing live
+        if (cold == FS_INVALID_ADDR || fsPageErases[p] < fsPageErases[cold]) cold = p;
+    }
+    if (cold == FS_INVALID_ADDR || fsPageErases[hot] - fsPageErases[cold] <= FS_WEAR_SPREAD) return 0;
+    return fsGcStart(cold, 1);
+}
+
+// gives the victim up, its erased chunks go back to the free map. Extent data
+// may look erased, it is stepped over with its head
+static void fsGcDrop(void) {
+    uint32_t first = fsGc.page * FS_PAGE_CHUNKS;
+
+    for (uint32_t i = first; i < first + FS_PAGE_CHUNKS; i += fsSpan(FS_CHUNK_ADDR(i)))
+        fsFreeGive(FS_CHUNK_ADDR(i));
+    fsGc.skipPage = fsGc.page;
+    fsGc.skipDead = fsPageDead[fsGc.page];
+    fsGc.wear = 0;
+    fsGc.owed = 0;
+    fsGc.state = GC_IDLE;
+}
+
+// copy not finished: unwritten chunks go back, written ones are unreachable and get deleted by GC_UNDO,
+// a chunk cut between two steps with them. A started extent keeps its whole run, GC_UNDO deletes its head
+static void fsGcAbort(void) {
+    if (!fsGc.extent && fsGc.pos && !fsChunkErased(fsGc.to[fsGc.pos - 1])) fsGc.pos--;
+    if (!fsGc.extent)
+        for (uint8_t i = 0; i < fsGc.pos; i++)
+            fsFreeGive(fsGc.to[i]);
+    else if (fsChunkErased(fsGc.to[0]))
+        for (uint8_t i = 0; i < fsGc.count; i++)
+            fsFreeGive(fsGc.to[i]);
+    else
+        fsGc.pos = 0;
+    fsGc.aborts++;
+    fsGc.state = GC_UNDO;
+}
+
+// next file with a chunk in the victim page gets a new home up to its last chunk there,
+// the rest of the chain stays where it is. The walk goes on from the cursor and yields past
+// FS_GC_SLICE, the moved file's slot is looked at again. None left - erase
+static void fsGcFind(void) {
+    uint32_t lo = FS_CHUNK_ADDR(fsGc.page * FS_PAGE_CHUNKS), hi = lo + FLASH_PAGE_SIZE;
+
+    for (uint16_t s = fsGc.slot, walked = 0;; s++, walked++) {
+        uint8_t n, i;
+        if (s >= fsIndexSlots) {
+            if (!fsGc.rewalk) break;
+            fsGc.rewalk = 0; // a delete moved an entry the walk had not seen behind it
+            s = 0;
+        }
+        if (walked && fsGcYield()) {
+            fsGc.slot = s;
+            return;
+        }
+        if (!fsIndex[s].addr) continue;
+
+        n = fsChain(fsIndex[s].addr, fsGc.from);
+        if (!n) {
+            fsGcDrop(); // broken chain, can't tell where it goes
+            return;
+        }
+        while (n && (fsGc.from[n - 1] < lo || fsGc.from[n - 1] >= hi)) n--;
+        if (!n) continue;
+
+        fsFreeReserve(n, fsGc.wear);
+        fsGc.extent = fsIsExtent(fsIndex[s].addr);
+        fsGc.split = 0;
+        if (fsGc.extent) {
+            uint32_t a = fsFreeTake(n);
+            if (a)
+                for (i = 0; i < n; i++)
+                    fsGc.to[i] = a + i * sizeof(FsChunk);
+            else {
+                // free space is in pieces: chunks with headers, the chain format takes any of them
+                fsGc.extent = 0;
+                fsGc.split = 1;
+                n = 1 + (fsHeadSize(fsGc.from[0]) + FS_PAYLOAD_SIZE - 1) / FS_PAYLOAD_SIZE;
+            }
+        }
+        for (i = 0; i < n && !fsGc.extent; i++) {
+            int32_t a = fsFindFreeChunk();
+            if (a < 0) {
+                while (i) fsFreeGive(fsGc.to[--i]);
+                fsGcDrop();
+                return;
+            }
+            fsGc.to[i] = a;
+        }
+        fsGc.count = fsGc.pos = n;
+        fsGc.owed = fsGc.owed > n ? fsGc.owed - n : 0;
+        fsGc.slot = s;
+        fsGc.state = GC_COPY;
+        return;
+    }
+    fsGc.owed = 0;
+    fsGc.state = GC_ERASE;
+}
+
+// chunk i of the chain a split extent turns into
+static void fsGcSplit(uint8_t i, FsChunk* c) {
+    uint16_t at = (i - 1) * FS_PAYLOAD_SIZE, size = fsHeadSize(fsGc.from[0]);
+
+    memset(c, 0xFF, sizeof(*c));
+    if (i == 0) {
+        memcpy(c, (const void*)fsGc.from[0], sizeof(*c));
+        c->type = (c->type & 0xF0) | FS_TYPE_FILE_HEAD;
+    } else {
+        c->type = FS_TYPE_FILE_DATA;
+        memcpy(c->data, (const uint8_t*)fsGc.from[0] + sizeof(FsChunk) + at,
+               size - at < FS_PAYLOAD_SIZE ? size - at : FS_PAYLOAD_SIZE);
+    }
+    c->link = i + 1 < fsGc.count ? fsGc.to[i + 1] : FS_INVALID_ADDR;
+}
+
+// programs what still differs from src, FS_GC_PROGRAMS half-words a step. Those already
+// there are skipped, so the next step goes on where this one stopped. 1 - all there
+static int fsGcProgram(uint32_t addr, const void* src, uint32_t len, uint16_t* budget) {
+    const uint8_t* b = (const uint8_t*)src;
+    uint32_t w, n = (len + 1) / 2, end = 0;
+
+    for (w = 0; w < n; w++) {
+        uint16_t de = b[2*w] | ((2*w + 1 < len ? b[2*w + 1] : 0xFF) << 8);
+        if (*(__IO uint16_t*)(addr + 2*w) == de) continue;
+        if (!*budget) break;
+        (*budget)--;
+        end = 2*w + 2;
+    }
+    if (end && fsProgram(addr, src, end < len ? end : len) < 0) return -1;
+    return w == n;
+}
+
+// chunks are copied last first, so the head that makes the copy visible comes when it is complete.
+// The last one keeps its link to the part of the chain that is not moved.
+// An extent goes head first, its link is written with the last data chunk. A split one is cut into
+// data chunks on the way. A chunk takes more than one step, 16 half-words are over FS_GC_SLICE on F3
+static void fsGcCopy(void) {
+    char name[FS_NAME_LEN + 1];
+    uint8_t i = fsGc.extent ? fsGc.count - fsGc.pos : fsGc.pos - 1;
+    uint16_t budget = FS_GC_PROGRAMS;
+    uint32_t link;
+    FsChunk c;
+    int r;
+
+    if (((const FsChunk*)fsGc.from[0])->notDeleted != 0xFF) {
+        fsGcAbort(); // deleted or overwritten meanwhile
+        return;
+    }
+    if (fsGc.split) fsGcSplit(i, &c);
+    else memcpy(&c, (const void*)fsGc.from[i], sizeof(c));
+    if (fsGc.extent) {
+        if (i == 0) c.link = FS_INVALID_ADDR;
+    } else
+    if (i + 1 < fsGc.count) c.link = fsGc.to[i + 1];
+    if (fsGc.extent && i == 0) { // type last, as fsProgramHead
+        r = fsGcProgram(fsGc.to[0] + 2, (const uint8_t*)&c + 2, sizeof(c) - 2, &budget);
+        if (r > 0) r = fsGcProgram(fsGc.to[0], &c, 2, &budget);
+    } else r = fsGcProgram(fsGc.to[i], &c, sizeof(c), &budget);
+    link = fsGc.to[0] + sizeof(FsChunk);
+    if (r > 0 && fsGc.extent && fsGc.pos == 1 && ((const FsChunk*)fsGc.to[0])->link != link) {
+        if (budget < 2) return; // one word, next step
+        if (_MarkHeader(fsGc.to[0], link) < 0) r = -1;
+    }
+    if (r < 0) {
+        fsGc.errors++;
+        fsGc.failed = 1;
+        fsGcAbort();
+        return;
+    }
+    if (!r || --fsGc.pos) return;
+
+    memcpy(name, ((const FsChunk*)fsGc.to[0])->data, FS_NAME_LEN);
+    name[FS_NAME_LEN] = '\0';
+    fsIndexDrop(fsGc.from[0], name);
+    fsIndexAdd(fsGc.to[0], name, fsHeadSize(fsGc.to[0]));
+    fsGc.state = GC_RETIRE;
+}
+
+static void fsGcErase(void) {
+    uint32_t first = fsGc.page * FS_PAGE_CHUNKS;
+
+    if (fsErasePage(FS_CHUNK_ADDR(first)) < 0) {
+        fsGc.errors++;
+        fsGcDrop();
+        return;
+    }
+    // chunk 0 keeps the erase count
+    if (fsPageStamp(FS_CHUNK_ADDR(first), ++fsPageErases[fsGc.page]) < 0) fsGc.errors++;
+    for (uint32_t i = first + 1; i < first + FS_PAGE_CHUNKS; i++)
+        fsFreeMap[i >> 5] |= 1U << (i & 31);
+    fsFreeCount += FS_PAGE_CHUNKS - 1;
+    fsPageDead[fsGc.page] = 0;
+    fsGc.reclaimed += fsGc.deadBefore;
+    fsGc.pages++;
+    fsGc.sinceWear++;
+    if (fsGc.wear) {
+        fsGc.wearMoves++;
+        fsGc.sinceWear = 0;
+        fsGc.wear = 0;
+    }
+    fsGc.state = GC_IDLE;
+}
+
+static void fsGcStep(void) {
+    switch (fsGc.state) {
+    case GC_IDLE:  fsGcPick(); break;
+    case GC_COST:  fsGcCost(); break;
+    case GC_FIND:  fsGcFind(); break;
+    case GC_COPY:  fsGcCopy(); break;
+    case GC_RETIRE:
+        if (fsMarkDeleted(fsGc.from[fsGc.pos])) fsGc.errors++;
+        fsGc.copied += fsGc.extent || fsGc.split ? fsGc.count : 1;
+        if (fsGc.extent || fsGc.split || ++fsGc.pos == fsGc.count) fsGc.state = GC_FIND;
+        break;
+    case GC_UNDO:
+        if (fsGc.pos < fsGc.count && fsMarkDeleted(fsGc.to[fsGc.pos])) fsGc.errors++;
+        if (!fsGc.extent && ++fsGc.pos < fsGc.count) break;
+        fsGc.state = GC_FIND;
+        if (fsGc.failed) fsGcDrop(); // flash trouble, leave the page alone
+        fsGc.failed = 0;
+        break;
+    case GC_ERASE: fsGcErase(); break;
+    }
+}
+
+// foreground collection for a write that does not fit, yields between steps.
+// Stops when a page was given up or gave nothing, the rest of the volume is live
+static void fsGcReclaim(uint32_t need) {
+    uint32_t before = fsFreeCount, pages = fsGc.pages, start = usTimerRead();
+    uint8_t picked = 0;
+
+    if (!fsPageDead || !fsFreeMap || !fsIndexValid) return;
+    fsGc.syncRuns++;
+    if (fsGc.state == GC_IDLE) fsGc.tries = 0;
+    while (fsFreeCount < need || fsGc.state != GC_IDLE) {
+        if (fsGc.state == GC_IDLE) {
+            if (!fsGc.tries) { // a pick passing over costly pages goes on
+                if (picked && (fsGc.pages == pages || fsFreeCount <= before)) break;
+                picked = 1;
+                before = fsFreeCount;
+                pages = fsGc.pages;
+                fsGc.force = 1;
+            }
+            if (!fsGcPick()) break;
+        }
+        fsGc.sliceStart = usTimerRead();
+        fsGcStep();
+        kernel_process(1);
+    }
+    fsGc.syncUs += usTimerRead() - start;
+}
+
+// task: steps of one chunk each while they fit FS_GC_SLICE, a page erase gets a run of its own
+void fsMaintain(uint32_t param) {
+    uint32_t start = usTimerRead(), t, took;
+
+    if (fsBusy || !fsPageDead || !fsFreeMap || !fsIndexValid) return;
+    fsGc.sliceStart = start;
+    if (fsGc.state == GC_IDLE && !fsGcPickCold() && !fsGcPick()) return;
+
+    for (uint8_t steps = 0; fsGc.state != GC_IDLE; steps++) {
+        if (fsGc.state == GC_ERASE) {
+            if (steps) break;
+            fsGcErase();
+            took = usTimerRead() - start;
+            if (took > fsGc.eraseMax) fsGc.eraseMax = took;
+            fsGc.busyUs += took;
+            return;
+        }
+        if (steps && usTimerRead() - start + fsGc.unitMax > FS_GC_SLICE) break;
+
+        t = usTimerRead();
+        fsGcStep();
+        took = usTimerRead() - t;
+        if (took > fsGc.unitMax) fsGc.unitMax = took;
+    }
+    took = usTimerRead() - start;
+    if (took > fsGc.sliceMax) fsGc.sliceMax = took;
+    fsGc.busyUs += took;
+}
+
+// fsgc           dead space and collector stats
+// fsgc run       collect every page with a dead chunk, not only the worthwhile ones
+// fsgc reset
+int fsGcCmd(char* args) {
+    static const char* states[] = { "idle", "sizing", "finding", "copying", "retiring", "undoing", "erasing" };
+    uint32_t dead = 0, pages = 0;
+
+    if (args && strcmp(args, "run") == 0) {
+        fsGc.force = fsPages;
+        return 0;
+    }
+    if (args && strcmp(args, "reset") == 0) {
+        fsGc.pages = fsGc.reclaimed = fsGc.copied = fsGc.aborts = fsGc.errors = 0;
+        fsGc.unitMax = fsGc.sliceMax = fsGc.eraseMax = 0;
+        fsGc.busyUs = fsGc.syncUs = 0;
+        fsGc.syncRuns = 0;
+        return 0;
+    }
+    if (!fsPageDead || !fsFreeMap || !fsIndexValid) {
+        printf("gc off, no RAM for the index\n");
+        return 0;
+    }
+    for (uint32_t p = 0; p < fsPages; p++) {
+        dead += fsPageDead[p];
+        if (fsPageDead[p]) pages++;
+    }
+    printf("gc %s%s, %lu dead chunks on %lu of %lu pages, %lu free\n", states[fsGc.state],
+            fsGc.force ? " (run)" : "", (unsigned long)dead, (unsigned long)pages,
+            (unsigned long)fsPages, (unsigned long)fsFreeCount);
+    printf(" pages erased %lu, reclaimed %lu B, copied %lu chunks, aborts %lu, errors %lu\n",
+            (unsigned long)fsGc.pages, (unsigned long)fsGc.reclaimed * sizeof(FsChunk),
+            (unsigned long)fsGc.copied, (unsigned long)fsGc.aborts, (unsigned long)fsGc.errors);
+    printf(" slice max %luus (limit %u), step max %luus, erase max %luus\n",
+            (unsigned long)fsGc.sliceMax, FS_GC_SLICE, (unsigned long)fsGc.unitMax, (unsigned long)fsGc.eraseMax);
+    printf(" gc time %lu ms in the task, %lu ms in %lu writes that waited for it\n",
+            (unsigned long)(fsGc.busyUs / 1000), (unsigned long)(fsGc.syncUs / 1000), (unsigned long)fsGc.syncRuns);
+    uint64_t us = fsGc.busyUs + fsGc.syncUs;
+    printf(" reclaimed %lu B per second of gc time\n",
+            (unsigned long)(us ? (uint64_t)fsGc.reclaimed * sizeof(FsChunk) * 1000000 / us : 0));
+    return 0;
+}
+
+// fswear         page erase counts and static wear leveling moves
+int fsWearCmd(char* args) {
+    uint32_t cold, hot, bucket[8] = {0}, width, top = 0;
+    uint64_t sum = 0;
+
+    if (!fsPageErases) {
+        printf("no wear data\n");
+        return 0;
+    }
+    fsWearRange(&cold, &hot);
+    for (uint32_t p = 0; p < fsPages; p++)
+        sum += fsPageErases[p];
+    printf("erases min %lu avg %lu max %lu over %lu pages, spread limit %u\n",
+            (unsigned long)fsPageErases[cold], (unsigned long)(sum / fsPages),
+            (unsigned long)fsPageErases[hot], (unsigned long)fsPages, FS_WEAR_SPREAD);
+    printf(" static data moves %lu, erases since the last %lu\n",
+            (unsigned long)fsGc.wearMoves, (unsigned long)fsGc.sinceWear);
+
+    width = (fsPageErases[hot] - fsPageErases[cold]) / 8 + 1;
+    for (uint32_t p = 0; p < fsPages; p++)
+        bucket[(fsPageErases[p] - fsPageErases[cold]) / width]++;
+    for (uint8_t b = 0; b < 8; b++)
+        if (bucket[b] > top) top = bucket[b];
+    for (uint8_t b = 0; b < 8; b++) {
+        printf(" %6lu+ %4lu ", (unsigned long)(fsPageErases[cold] + b * width), (unsigned long)bucket[b]);
+        for (uint32_t k = 0; k < (bucket[b] * 40 + top - 1) / top; k++)
+            printf("#");
+        printf("\n");
+    }
+    return 0;
+}
+
+
 int fsRead(char* name, char* buffer, int maxLen) {
     if (!name || !buffer || maxLen < 1)
         return -1;
 
     // 1) Find the header chunk
     uint32_t addr = fsFind(name);
-    if (addr == FS_INVALID_ADDR)
+    if (!addr)
         return -1;
+    if (maxLen > fsHeadSize(addr) + 1)
+        maxLen = fsHeadSize(addr) + 1;
 
     FsChunk chunk;
     memcpy(&chunk, (void*)addr, sizeof(chunk));
 
-    // 2) Confirm it’s a file head
+    // 2) Confirm it’s a file head, extent data is one copy
+    if ((chunk.type & 0x0F) == FS_TYPE_EXTENT) {
+        memcpy(buffer, (const void*)(addr + sizeof(FsChunk)), maxLen - 1);
+        buffer[maxLen - 1] = '\0';
+        return 0;
+    }
     if ((chunk.type & 0x0F) != FS_TYPE_FILE_HEAD)
         return -1;
 
@@ -604,16 +1721,39 @@ int fsRead(char* name, char* buffer, int maxLen) {
 }
 
 
-int fsList(const char* unused) {
+int fsSize(char* name) {
+    uint32_t addr;
+
+    if (fsIndexValid) {
+        FsIndexEntry* e = fsIndexSlot(name, fsHash(name));
+        return e ? e->size : -1;
+    }
+    addr = fsFind(name);
+    return addr ? fsHeadSize(addr) : -1;
+}
+
+int fsList(char* prefix) {
+    size_t prefixLen = prefix ? strlen(prefix) : 0;
     printf("Flat file list:\n");
     uint32_t addr = FS_START_ADDR;
     FsChunk chunk;
 
+    // index holds every live file, names are read from their heads
+    if (fsIndexValid) {
+        for (uint16_t i = 0; i < fsIndexSlots; i++) {
+            const FsChunk* c = (const FsChunk*)fsIndex[i].addr;
+            if (!c || strncmp((const char*)c->data, prefix ? prefix : "", prefixLen)) continue;
+            printf(" - %.*s  %u B  @0x%06X\n", FS_NAME_LEN, (const char*)c->data,
+                   fsIndex[i].size, (unsigned int)fsIndex[i].addr);
+        }
+        return 1;
+    }
+
     while (addr + sizeof(FsChunk) <= FS_END_ADDR) {
         memcpy(&chunk, (void*)addr, sizeof(chunk));
         // Only list live file headers
-        if ((chunk.type & 0x0F) == FS_TYPE_FILE_HEAD
-            && chunk.notDeleted == 0xFF)
+        if (fsIsHead(addr)
+            && strncmp((char*)chunk.data, prefix ? prefix : "", prefixLen) == 0)
         {
             // Print up to CHUNK_PAYLOAD_SIZE chars from data[]
             printf(" - %.*s  @0x%06X\n",
@@ -621,7 +1761,7 @@ int fsList(const char* unused) {
                    (char*)chunk.data,
                    (unsigned int)addr);
         }
-        addr += sizeof(FsChunk);
+        addr += fsChunkIsFree(&chunk) ? sizeof(FsChunk) : fsSpan(addr) * sizeof(FsChunk);
         kernel_process(1);
     }
     return 1;
@@ -646,6 +1786,13 @@ char* fsGet(char* name) {
     return buffer;
 }
 
+#ifdef USING_CONSOLE
+// get <name>, fsGet prints the value
+static int fsGetCmd(char* name) {
+    return fsGet(name) ? 0 : 1;
+}
+#endif
+
 
 int fsSet(char* msg) {
     if (!msg) return -1;
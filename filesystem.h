@@ -25,8 +25,10 @@
 [header: ledCfg]
   └──> data
 
+[extent: big] data data data   (head followed by its data in place, no per chunk header)
 
-	fs_background_maint(); // slowly frees dead space
+
+	fsMaintain(); // task, slowly frees dead space page by page
  *
  */
 
@@ -57,11 +59,34 @@
 
 
 	// --- Flash FS Constants ---
-	#define CHUNK_SIZE       	32
-	#define FS_PAYLOAD_SIZE  	24    // 32 − 4(link) − 4(type+reserved)
+#ifndef FS_CHUNK_SIZE
+	#define FS_CHUNK_SIZE       32      // bytes, power of two from 32. Flash format changes with it, fsformat
+#endif
+#if FS_CHUNK_SIZE < 32 || (FS_CHUNK_SIZE & (FS_CHUNK_SIZE - 1))
+	#error "FS_CHUNK_SIZE must be a power of two, 32 or more"
+#endif
+#ifndef FS_EXTENTS
+	#define FS_EXTENTS          1       // new files as extents where a run of chunks fits, 0 - chains only
+#endif
+	#define CHUNK_SIZE       	FS_CHUNK_SIZE
+	#define FS_PAYLOAD_SIZE  	(FS_CHUNK_SIZE - 8)    // chain data chunk − 4(link) − 4(type+reserved)
 	#define FS_NAME_LEN         24      // max filename length
 	#define FS_MAX_FILE_SIZE    1024    // max file size in bytes (adjustable)
 	#define FS_INVALID_ADDR     0xFFFFFFFF
+	#define FS_SIZE_UNKNOWN     0xFFFF  // head written before sizes were kept
+	#define FS_INDEX_MIN        16      // RAM index slots at least, power of two, grows x2 at 3/4
+
+	// garbage collection: live chunks of the page with most dead ones are copied out, then it is erased
+	#define FS_GC_PERIOD        ST_MS * 2          // maintenance task
+	#define FS_GC_SLICE         (TASK_TIMEOUT / 2) // us of copying per run, a page erase runs alone
+	#define FS_GC_PROGRAMS      (FS_GC_SLICE / 70) // half-words a copy step programs, 70 us each at most on F3
+	#define FS_GC_DEAD_PCT      25      // page is collected when this much of it is dead,
+	                                    // any dead chunk counts once free space is under 2 pages
+	#define FS_GC_TRIES         4       // pages looked at when the best one can't be copied out
+	#define FS_WEAR_SPREAD      16      // erase count gap to the hottest page that makes the coldest
+	                                    // page's data move, hot pages also wait for their dead chunks
+	#define FS_WEAR_EVERY       16      // page erases between such moves at least
+	#define FS_TEST_READS       16      // fstest reads the file this many times for the read rate
 
 
 
@@ -70,25 +95,40 @@
 	#define FS_TYPE_DEAD        0x0
 	#define FS_TYPE_FILE_HEAD   0x1
 	#define FS_TYPE_FILE_DATA   0x2
+	#define FS_TYPE_PAGE        0x3     // first chunk of every page, erase count in data[0..3]
+	#define FS_TYPE_EXTENT      0x4     // head with its data in the next size / FS_CHUNK_SIZE chunks,
+	                                    // link points at the data once it is complete
 
 
 
 
 	typedef struct {
 	    uint8_t   type;        // file head/data/etc.
-	    uint8_t   reserved1;   // padding
+	    uint8_t   reserved1;   // head: size low byte
 	    uint8_t   notDeleted;  // 0xFF = alive, 0x00 = deleted
-	    uint8_t   reserved2;   // padding
+	    uint8_t   reserved2;   // head: size high byte, 0xFFFF - FS_SIZE_UNKNOWN
 	    uint32_t  link;        // next-chunk address
 	    uint8_t   data[FS_PAYLOAD_SIZE];
 	} __attribute__((packed)) FsChunk;
 
+	#define FS_EXTENT_CHUNKS(size) (((size) + FS_CHUNK_SIZE - 1) / FS_CHUNK_SIZE) // data chunks of an extent
+
+	// RAM index of live files, built by one scan in fsInit and kept by write/delete.
+	// Names stay in flash, a hash hit is confirmed against the head chunk.
+	typedef struct {
+	    uint32_t  addr;        // head chunk, 0 - empty slot
+	    uint16_t  hash;
+	    uint16_t  size;        // bytes
+	} FsIndexEntry;
+
 
 	// --- Core API ---
 
 
 	void fsInit();                                     // Initialize the filesystem
-	void fsMaintain();                                 // Background defragmentation
+	void fsMaintain(uint32_t);                         // Background garbage collection, one slice
+	int fsGcCmd(char* args);                          // fsgc [run|reset]
+	int fsWearCmd(char* args);                        // fswear, erase count distribution
 
 	int fsDelete(char* name);
 	int fsWriteBinary(char* name, char* data, int len);   // Create or overwrite file
@@ -97,17 +137,18 @@
 	char* fsGet(char* name);
 	int fsRead(char* name, char* buffer, int maxLen);     // Read file data
 	int fsDelete(char* name);                             // Mark file as deleted
-	int fsList();
-	void fsFormat(char* param);
-	void fsTest(char*);
-	int fsFind(char* name);
+	int fsList(char* prefix);                              // ls [prefix]
+	int fsSize(char* name);                               // bytes, -1 if no such file
+	int fsFormat(char* param);
+	int fsTest(char*);                                   // fstest [bytes], write/read timing
+	int fsFind(char* name);                               // head chunk address, 0 if no such file
 
 	// --- Internal Access ---
 
 	// --- Maintenance ---
-	void fsFormat();                                   // Full flash format
-	uint8_t fsPrintUsage(char*);                         // Dump free/used status
-	void fsDebugChunks(char* params);					// debug chunks
+	int fsFormat();                                   // Full flash format
+	int fsPrintUsage(char*);                         // Dump free/used status
+	int fsDebugChunks(char* params);					// debug chunks
 
 
 #endif
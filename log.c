@@ -0,0 +1,199 @@
+/*
+ * log.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *      Deferred formatting log ring
+ */
+
+#include "log.h"
+
+#ifdef USING_LOG
+
+uint8_t logLevel = LOG_DEBUG;
+uint32_t logModules = 0xFFFFFFFFU;
+
+static uint8_t logRing[LOG_RING_SIZE];
+static volatile uint32_t logHead = 0; // free running, masked on access
+static volatile uint32_t logTail = 0;
+static uint8_t logMode = LOG_MODE_TEXT;
+static uint32_t logRecords = 0;
+static uint32_t logDropped = 0;
+static uint32_t logBytes = 0;
+
+static const char* logLevelNames[] = { "DBG", "INF", "WRN", "ERR" };
+
+MODULE(log, MOD_LOG, 0, 0, &logInit);
+
+#ifdef USING_CONSOLE
+CONSOLE_CMD(log, logCommand);
+#endif
+
+void logInit(uint32_t msg) {
+	tTask* proc = repeat("LOG_PR", LOG_RATE, &logProcessor);
+	proc->timeout = 1000 * ST_SS;
+	proc->realtime_fail = ST_SEC;
+	printf("log loaded\n");
+}
+
+static void logPut(uint32_t pos, const void* data, uint32_t len) {
+	const uint8_t* src = data;
+	while (len--) logRing[pos++ & (LOG_RING_SIZE - 1)] = *src++;
+}
+
+static void logGet(uint32_t pos, void* data, uint32_t len) {
+	uint8_t* dst = data;
+	while (len--) *dst++ = logRing[pos++ & (LOG_RING_SIZE - 1)];
+}
+
+// hot path: copy a few words, no formatting, safe from interrupts
+void logWrite(uint8_t level, const char* fmt, const uint32_t* args, uint8_t argc) {
+	uint8_t head[10];
+	uint32_t now = uwTick;
+	uint32_t id = (uint32_t)fmt;
+	uint32_t len;
+	uint32_t primask;
+
+	if (argc > LOG_MAX_ARGS) argc = LOG_MAX_ARGS;
+	len = sizeof(head) + argc * sizeof(uint32_t);
+
+	head[0] = LOG_SYNC;
+	head[1] = (level << 4) | argc;
+	memcpy(&head[2], &now, sizeof(now));
+	memcpy(&head[6], &id, sizeof(id));
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	if (LOG_RING_SIZE - (logHead - logTail) < len) {
+		logDropped++;
+		__set_PRIMASK(primask);
+		return;
+	}
+	logPut(logHead, head, sizeof(head));
+	logPut(logHead + sizeof(head), args, argc * sizeof(uint32_t));
+	logHead += len;
+	logRecords++;
+	__set_PRIMASK(primask);
+}
+
+// background: format or forward records, one pass drains what is there
+void logProcessor(uint32_t param) {
+	uint8_t head[10];
+	uint32_t args[LOG_MAX_ARGS] = { 0 };
+	uint32_t ts, id, len;
+	uint8_t argc, level;
+
+	while (logHead != logTail && logMode != LOG_MODE_HOLD) {
+		logGet(logTail, head, sizeof(head));
+		argc = head[1] & 0x0F;
+		level = head[1] >> 4;
+		len = sizeof(head) + argc * sizeof(uint32_t);
+		memcpy(&ts, &head[2], sizeof(ts));
+		memcpy(&id, &head[6], sizeof(id));
+
+		if (logMode == LOG_MODE_BINARY) {
+			uint8_t record[sizeof(head) + LOG_MAX_ARGS * sizeof(uint32_t)];
+			logGet(logTail, record, len);
+			fwrite(record, 1, len, stdout);
+			logBytes += len;
+		} else {
+			logGet(logTail + sizeof(head), args, argc * sizeof(uint32_t));
+			printf("%lu %s ", (unsigned long)ts, level < LOG_OFF ? logLevelNames[level] : "?");
+			printf((const char*)id, args[0], args[1], args[2], args[3], args[4], args[5]);
+			printf("\n");
+		}
+		logTail += len;
+	}
+	if (logMode == LOG_MODE_BINARY) fflush(stdout);
+}
+
+static const char logBenchFormat[] __attribute__((section(".fw_log"))) = "bench %i at %lu";
+
+// takes the bench records out from 'from' on, records logged meanwhile by interrupts stay
+static void logBenchDrop(uint32_t from) {
+	uint8_t record[10 + LOG_MAX_ARGS * sizeof(uint32_t)];
+	uint32_t to = from, id, len;
+	uint32_t primask;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	while (from != logHead) {
+		logGet(from, record, 10);
+		len = 10 + (record[1] & 0x0F) * sizeof(uint32_t);
+		memcpy(&id, &record[6], sizeof(id));
+		if (id == (uint32_t)logBenchFormat) {
+			logRecords--;
+		} else {
+			if (to != from) {
+				logGet(from, record, len);
+				logPut(to, record, len);
+			}
+			to += len;
+		}
+		from += len;
+	}
+	logHead = to;
+	__set_PRIMASK(primask);
+}
+
+// time the same message through LOG and through printf
+static void logBench(void) {
+	char line[64];
+	uint32_t beforeT, logT, printfT, from;
+	int printfBytes, logBytesPerCall;
+	uint8_t mode = logMode;
+
+	logMode = LOG_MODE_HOLD; // keep the ring out of the measurement
+	from = logHead;
+	beforeT = usTimerRead();
+	for (int i = 0; i < LOG_BENCH_COUNT; i++) {
+		// what LOG expands to, with a format the records can be told apart by
+		if (LOG_ERROR >= logLevel && (MOD_LOG & logModules)) {
+			const uint32_t args[] = { i, beforeT };
+			logWrite(LOG_ERROR, logBenchFormat, args, 2);
+		}
+	}
+	logT = usTimerRead() - beforeT;
+	logBytesPerCall = 10 + 2 * sizeof(uint32_t);
+
+	beforeT = usTimerRead();
+	for (int i = 0; i < LOG_BENCH_COUNT; i++)
+		printf("bench %i at %lu\n", i, (unsigned long)beforeT);
+	printfT = usTimerRead() - beforeT;
+	printfBytes = snprintf(line, sizeof(line), "bench %i at %lu\n", LOG_BENCH_COUNT - 1, (unsigned long)beforeT);
+
+	logBenchDrop(from);
+	logMode = mode;
+
+	printf("LOG:    %lu.%02luus/call, %i bytes/call\n", (unsigned long)(logT / LOG_BENCH_COUNT),
+			(unsigned long)(logT * 100 / LOG_BENCH_COUNT % 100), logBytesPerCall);
+	printf("printf: %lu.%02luus/call, %i bytes/call\n", (unsigned long)(printfT / LOG_BENCH_COUNT),
+			(unsigned long)(printfT * 100 / LOG_BENCH_COUNT % 100), printfBytes);
+}
+
+// log [text|binary|hold|level <0-4>|modules <hex mask>|bench]
+int logCommand(char* args) {
+	if (!args || !*args) {
+		printf("Log: mode %i, level %i, modules 0x%08lX\n", logMode, logLevel, (unsigned long)logModules);
+		printf("Records: %lu, dropped %lu, pending %lu bytes, sent %lu bytes\n",
+				(unsigned long)logRecords, (unsigned long)logDropped,
+				(unsigned long)(logHead - logTail), (unsigned long)logBytes);
+	} else if (strcmp(args, "text") == 0) {
+		logMode = LOG_MODE_TEXT;
+	} else if (strcmp(args, "binary") == 0) {
+		logMode = LOG_MODE_BINARY;
+	} else if (strcmp(args, "hold") == 0) {
+		logMode = LOG_MODE_HOLD;
+	} else if (strncmp(args, "level ", 6) == 0) {
+		logLevel = atoi(args + 6);
+	} else if (strncmp(args, "modules ", 8) == 0) {
+		logModules = strtoul(args + 8, NULL, 16);
+	} else if (strcmp(args, "bench") == 0) {
+		logBench();
+	} else {
+		printf("Usage: log [text|binary|hold|level <0-4>|modules <hex>|bench]\n");
+	}
+	return 0;
+}
+
+#endif
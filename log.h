@@ -0,0 +1,81 @@
+/*
+ * log.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *
+ *	Deferred logging. Call site stores only format id, timestamp and raw arguments
+ *	into a RAM ring, formatting happens later in a background task or on the host.
+ *
+ *	1. Define USING_LOG
+ *	2. LOG(LOG_INFO, MOD_FILESYSTEM, "written %i bytes", len);
+ *	   Arguments are stored as uint32_t: integers, chars, pointers (cast them).
+ *	   %s works for strings in flash only, RAM strings change before they are printed.
+ *	3. Optional, linker script: .fw_log (INFO) : { KEEP(*(.fw_log)) } keeps formats out of flash,
+ *	   only usable with binary mode then.
+ *	4. Binary mode: host decodes the stream with tools/logdecode.py firmware.elf
+ *
+ *	Record: A5 | level << 4 | argc | timestamp ms (4) | format id (4) | args (4 * argc), little endian
+ */
+
+#ifndef SYS_LOG_H_
+#define SYS_LOG_H_
+
+#include "core.h"
+
+	enum {
+		LOG_DEBUG = 0,
+		LOG_INFO,
+		LOG_WARN,
+		LOG_ERROR,
+		LOG_OFF
+	};
+
+#ifdef USING_LOG
+
+	// compile time filter, anything below is not compiled at all
+	#ifndef LOG_LEVEL_MIN
+		#define LOG_LEVEL_MIN LOG_DEBUG
+	#endif
+	#ifndef LOG_MODULES
+		#define LOG_MODULES 0xFFFFFFFFU // MOD_xxx bits
+	#endif
+
+	#define LOG_RING_SIZE 	1024 // power of two
+	#define LOG_MAX_ARGS 	6
+	#define LOG_SYNC 		0xA5
+	#define LOG_RATE 		ST_MS
+	#define LOG_BENCH_COUNT 32
+
+	enum {
+		LOG_MODE_TEXT = 0, // formatted on device by the background task
+		LOG_MODE_BINARY,   // raw records on the console link, decoded on host
+		LOG_MODE_HOLD      // kept in ring, nothing sent
+	};
+
+	// runtime filter
+	extern uint8_t logLevel;
+	extern uint32_t logModules;
+
+	void logInit(uint32_t);
+	void logWrite(uint8_t level, const char* fmt, const uint32_t* args, uint8_t argc);
+	void logProcessor(uint32_t);
+	int logCommand(char* args);
+
+	#define LOG(level, module, fmt, ...) do { \
+		if ((level) >= LOG_LEVEL_MIN && ((module) & LOG_MODULES)) { \
+			static const char __logfmt[] __attribute__((section(".fw_log"))) = fmt; \
+			if ((level) >= logLevel && ((module) & logModules)) { \
+				const uint32_t __logargs[] = { 0, ##__VA_ARGS__ }; \
+				logWrite((level), __logfmt, __logargs + 1, sizeof(__logargs) / sizeof(uint32_t) - 1); \
+			} \
+		} \
+	} while (0)
+
+#else
+
+	#define LOG(level, module, fmt, ...) do { } while (0)
+
+#endif
+
+#endif /* SYS_LOG_H_ */
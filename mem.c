@@ -0,0 +1,151 @@
+/*
+ * mem.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *      Stack painting and heap accounting
+ */
+
+#include "mem.h"
+
+#ifdef USING_MEMORY
+#include <malloc.h>
+
+// from linker script
+extern uint32_t _estack;
+extern uint32_t _Min_Stack_Size;
+extern uint32_t end;
+
+#define MEM_STACK_TOP 		((uint32_t)&_estack)
+#define MEM_STACK_BOTTOM 	(MEM_STACK_TOP - (uint32_t)&_Min_Stack_Size)
+
+uint32_t memStackLow[MEM_STACK_DEPTHS];
+static memModuleStats memModules[MEM_MODULES];
+static const char* memModuleNames[MEM_MODULES] = { "core", "console", "buttons", "fs", "rpc" };
+
+#ifdef MEM_WRAP_MALLOC
+static uint32_t heapUsed = 0;
+static uint32_t heapPeak = 0;
+static uint32_t heapAllocs = 0;
+static uint32_t heapFails = 0;
+#endif
+
+MODULE(memory, MOD_MEMORY, 0, 0, &memInit);
+
+#ifdef USING_CONSOLE
+CONSOLE_CMD(mem, memStats);
+#endif
+
+// fill unused stack with a pattern, everything below the current frame is free
+static void memStackPaint(void) {
+	uint32_t *addr = (uint32_t*)MEM_STACK_BOTTOM;
+	uint32_t *stop = (uint32_t*)(__get_MSP() - MEM_STACK_MARGIN);
+
+	while (addr < stop) *addr++ = MEM_STACK_PAINT;
+
+	for (int i = 0; i < MEM_STACK_DEPTHS; i++) memStackLow[i] = 0xFFFFFFFFU;
+}
+
+void memInit(uint32_t msg) {
+	memStackPaint();
+	printf("memory loaded\n");
+}
+
+// first word that lost the pattern is the deepest the stack has been
+uint32_t memStackUsed(void) {
+	uint32_t *addr = (uint32_t*)MEM_STACK_BOTTOM;
+	while (addr < (uint32_t*)MEM_STACK_TOP && *addr == MEM_STACK_PAINT) addr++;
+	return MEM_STACK_TOP - (uint32_t)addr;
+}
+
+void* memAlloc(uint8_t module, size_t size) {
+	memModuleStats* stats = &memModules[module];
+	void* ptr = malloc(size);
+
+	if (!ptr) {
+		stats->fails++;
+		return NULL;
+	}
+
+	stats->allocs++;
+	stats->bytes += malloc_usable_size(ptr);
+	if (stats->bytes > stats->peak) stats->peak = stats->bytes;
+	return ptr;
+}
+
+void memFree(uint8_t module, void* ptr) {
+	if (!ptr) return;
+	memModules[module].frees++;
+	memModules[module].bytes -= malloc_usable_size(ptr);
+	free(ptr);
+}
+
+#ifdef MEM_WRAP_MALLOC
+void* __real_malloc(size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size) {
+	void* ptr = __real_malloc(size);
+	if (!ptr) {
+		heapFails++;
+		return NULL;
+	}
+	heapAllocs++;
+	heapUsed += malloc_usable_size(ptr);
+	if (heapUsed > heapPeak) heapPeak = heapUsed;
+	return ptr;
+}
+
+void __wrap_free(void* ptr) {
+	if (!ptr) return;
+	heapUsed -= malloc_usable_size(ptr);
+	__real_free(ptr);
+}
+#endif
+
+int memStats(char* args) {
+	struct mallinfo mi = mallinfo();
+	uint32_t stackSize = MEM_STACK_TOP - MEM_STACK_BOTTOM;
+	uint32_t stackUsed = memStackUsed();
+	uint32_t heapLimit = MEM_STACK_BOTTOM - (uint32_t)&end;
+
+	if (args && strcmp(args, "reset") == 0) {
+		for (int i = 0; i < MEM_MODULES; i++) memModules[i].peak = memModules[i].bytes;
+#ifdef MEM_WRAP_MALLOC
+		heapPeak = heapUsed;
+#endif
+		memStackPaint();
+		printf("memory marks reset\n");
+		return 0;
+	}
+
+	printf("\n === Memory ===\n");
+	printf("Stack: %lu of %lu bytes used (max)%s\n", (unsigned long)stackUsed, (unsigned long)stackSize,
+			stackUsed >= stackSize ? " OVERFLOW" : "");
+	for (int i = 0; i < MEM_STACK_DEPTHS; i++) {
+		if (memStackLow[i] == 0xFFFFFFFFU) continue;
+		printf(" depth %i: %lu bytes\n", i, (unsigned long)(MEM_STACK_TOP - memStackLow[i]));
+	}
+
+	printf("Heap: %lu used, %lu arena (peak), %lu limit\n",
+			(unsigned long)mi.uordblks, (unsigned long)mi.arena, (unsigned long)heapLimit);
+	// newlib does not tell the largest free block, the count of free blocks hints at fragmentation
+	if (mi.arena)
+		printf(" free in arena %lu bytes (%lu%% of it) in %lu blocks\n", (unsigned long)mi.fordblks,
+				(unsigned long)(mi.fordblks * 100 / mi.arena), (unsigned long)mi.ordblks);
+#ifdef MEM_WRAP_MALLOC
+	printf(" malloc: %lu calls, %lu failed, %lu live, %lu peak\n",
+			(unsigned long)heapAllocs, (unsigned long)heapFails, (unsigned long)heapUsed, (unsigned long)heapPeak);
+#endif
+
+	printf("Module    allocs  frees  fails  bytes  peak\n");
+	for (int i = 0; i < MEM_MODULES; i++) {
+		memModuleStats* m = &memModules[i];
+		printf(" %-8s %6lu %6lu %6lu %6lu %5lu\n", memModuleNames[i],
+				(unsigned long)m->allocs, (unsigned long)m->frees, (unsigned long)m->fails,
+				(unsigned long)m->bytes, (unsigned long)m->peak);
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * mem.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *
+ *	Memory instrumentation: stack high-water marks and heap usage.
+ *
+ *	1. Define USING_MEMORY
+ *	2. Allocate through memAlloc/memFree to get per module counters
+ *	3. Optional: link with -Wl,--wrap=malloc,--wrap=free and define MEM_WRAP_MALLOC
+ *	   to count every malloc/free call, not only framework ones
+ *
+ *	Stack region is taken from the linker script (_estack, _Min_Stack_Size), heap starts at end.
+ *	Cost per scheduler pass is one stack pointer compare, safe to leave in production.
+ */
+
+#ifndef SYS_MEM_H_
+#define SYS_MEM_H_
+
+#include "core.h"
+
+	// modules with own allocation counters
+	enum {
+		MEM_CORE = 0,
+		MEM_CONSOLE,
+		MEM_BUTTONS,
+		MEM_FS,
+		MEM_RPC,
+		MEM_MODULES
+	};
+
+#ifdef USING_MEMORY
+
+	#define MEM_STACK_PAINT 	0xC5C5C5C5U
+	#define MEM_STACK_MARGIN 	64 // bytes under the current stack pointer left unpainted
+	#define MEM_STACK_DEPTHS 	(TASKER_ULTIMATE_DEPTH + 1)
+
+	typedef struct memModuleStats {
+		uint32_t allocs;
+		uint32_t frees;
+		uint32_t fails;
+		uint32_t bytes; // currently allocated
+		uint32_t peak;
+	} memModuleStats;
+
+	// lowest stack pointer seen per kernel_process nesting depth
+	extern uint32_t memStackLow[MEM_STACK_DEPTHS];
+
+	void memInit(uint32_t);
+	void* memAlloc(uint8_t module, size_t size);
+	void memFree(uint8_t module, void* ptr);
+	uint32_t memStackUsed(void); // painted high-water mark in bytes
+	int memStats(char* args);
+
+	#define MEM_STACK_MARK(depth) do { \
+		uint32_t sp = __get_MSP(); \
+		if (sp < memStackLow[depth]) memStackLow[depth] = sp; \
+	} while (0)
+
+#else
+
+	#define memAlloc(m, s) malloc(s)
+	#define memFree(m, p) free(p)
+	#define MEM_STACK_MARK(depth)
+
+#endif
+
+#endif /* SYS_MEM_H_ */
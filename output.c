@@ -0,0 +1,334 @@
+/*
+ * output.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *      Shared output ring with independent sink cursors
+ */
+
+#include "output.h"
+
+#ifdef USING_OUTPUT
+
+static uint8_t outputRing[OUTPUT_RING_SIZE];
+static volatile uint32_t outputHead = 0; // free running, masked on access
+static outputSink outputSinks[OUTPUT_SINK_LIMIT];
+static volatile uint8_t outputDraining = 0;
+static uint8_t outputBlocking = 0;
+
+#define OUTPUT_MASK (OUTPUT_RING_SIZE - 1)
+
+#ifdef USING_CONSOLE
+CONSOLE_CMD(sinks, outputStats);
+#endif
+
+void outputInit(uint32_t msg) {
+	tTask* proc = repeat("OUT_PR", OUTPUT_RATE, &outputProcessor);
+	proc->timeout = 1000 * ST_SS;
+	proc->realtime_fail = ST_SEC;
+}
+
+// where a new sink starts reading: up to OUTPUT_SINK_BACKLOG of what is still in the ring,
+// from a line start, so output printed before the transport came up is not lost
+static uint32_t outputSinkStart(uint32_t limit) {
+	uint32_t head = outputHead, back = head;
+
+	if (back > OUTPUT_SINK_BACKLOG) back = OUTPUT_SINK_BACKLOG;
+	if (back > limit) back = limit;
+	if (back == head) return 0; // nothing lost since reset, whole lines
+
+	for (uint32_t at = head - back; at != head; at++)
+		if (outputRing[at & OUTPUT_MASK] == '\n') return at + 1;
+	return head;
+}
+
+outputSink* outputSinkAdd(const char* name, outputSinkWrite write, uint8_t policy) {
+	for (int i = 0; i < OUTPUT_SINK_LIMIT; i++) {
+		outputSink* sink = &outputSinks[i];
+		if (sink->write) continue;
+
+		memset(sink, 0, sizeof(*sink));
+		sink->name = name;
+		sink->policy = policy;
+		sink->limit = OUTPUT_RING_SIZE;
+		sink->rateTick = uwTick;
+
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		sink->tail = outputSinkStart(sink->limit);
+		sink->write = write;
+		__set_PRIMASK(primask);
+
+		// first sink starts the retry task
+		if (!taskExists(&outputProcessor)) outputInit(0);
+		return sink;
+	}
+	return NULL;
+}
+
+void outputSinkRemove(outputSink* sink) {
+	if (sink) sink->write = NULL;
+}
+
+static void outputSkipPop(outputSink* sink) {
+	memmove(&sink->skip[0], &sink->skip[1], (sink->skips - 1) * sizeof(outputSkip));
+	sink->skips--;
+	sink->markSent = 0;
+}
+
+// ring range [from, to) is not for this sink, interrupts off
+static void outputSkipAdd(outputSink* sink, uint32_t from, uint32_t to, uint8_t mark) {
+	sink->truncated++;
+	sink->dropped += to - from;
+
+	if (sink->skips) {
+		outputSkip* last = &sink->skip[sink->skips - 1];
+		if (last->to == from) { // consecutive drops, one marker
+			last->to = to;
+			return;
+		}
+		if (sink->skips == OUTPUT_SKIP_LIMIT) { // no room to remember, data in between is lost too
+			sink->dropped += from - last->to;
+			last->to = to;
+			last->mark |= mark;
+			return;
+		}
+	}
+	sink->skip[sink->skips].from = from;
+	sink->skip[sink->skips].to = to;
+	sink->skip[sink->skips].mark = mark;
+	sink->skips++;
+}
+
+// move the cursor up to 'to', data passed over outside skip ranges counts as dropped, interrupts off
+static void outputSinkDiscard(outputSink* sink, uint32_t to) {
+	while ((int32_t)(to - sink->tail) > 0) {
+		uint32_t end = to;
+		if (sink->skips && (int32_t)(sink->skip[0].from - end) < 0) end = sink->skip[0].from;
+
+		sink->dropped += end - sink->tail;
+		sink->tail = end;
+		if (sink->tail == to) break;
+
+		// reached a skip range, already counted
+		sink->tail = sink->skip[0].to;
+		outputSkipPop(sink);
+	}
+}
+
+// truncate marker in front of a skip range, returns 1 once it is out
+static uint8_t outputSinkMark(outputSink* sink) {
+	static const char mark[] = OUTPUT_TRUNCATE_MARK;
+	int sent = sink->write((const uint8_t*)mark + sink->markSent, sizeof(mark) - 1 - sink->markSent);
+
+	if (sent < 0) return 1; // offline, nobody misses the marker
+	sink->markSent += sent;
+	return sink->markSent >= sizeof(mark) - 1;
+}
+
+// hand contiguous spans to the sink until it is empty or busy
+static void outputSinkDrain(outputSink* sink) {
+	while (sink->write && sink->tail != outputHead) {
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		uint32_t tail = sink->tail;
+		uint32_t stop = outputHead;
+		uint8_t atSkip = sink->skips && sink->skip[0].from == tail;
+		uint8_t mark = atSkip && sink->skip[0].mark;
+		if (sink->skips && !atSkip) stop = sink->skip[0].from;
+		__set_PRIMASK(primask);
+
+		if (atSkip) {
+			if (mark && !outputSinkMark(sink)) break; // busy
+			primask = __get_PRIMASK();
+			__disable_irq();
+			if (sink->tail == tail && sink->skips) {
+				sink->tail = sink->skip[0].to;
+				outputSkipPop(sink);
+			}
+			__set_PRIMASK(primask);
+			continue;
+		}
+
+		uint32_t pos = tail & OUTPUT_MASK;
+		uint32_t len = stop - tail;
+		if (len > OUTPUT_RING_SIZE - pos) len = OUTPUT_RING_SIZE - pos;
+		if (len > 0xFFFF) len = 0xFFFF;
+
+		int sent = sink->write(&outputRing[pos], len);
+		if (sent == 0) break;
+		if (sent < 0) {
+			sink->dropped += len; // offline
+			sent = len;
+		} else {
+			sink->bytes += sent;
+		}
+
+		primask = __get_PRIMASK();
+		__disable_irq();
+		if (sink->tail == tail) sink->tail += sent; // else a writer already discarded past it
+		__set_PRIMASK(primask);
+		if ((uint32_t)sent < len) break;
+	}
+}
+
+void outputFlush(void) {
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if (outputDraining) { // sink printed something while being drained
+		__set_PRIMASK(primask);
+		return;
+	}
+	outputDraining = 1;
+	__set_PRIMASK(primask);
+
+	for (int i = 0; i < OUTPUT_SINK_LIMIT; i++) outputSinkDrain(&outputSinks[i]);
+	outputDraining = 0;
+}
+
+void outputProcessor(uint32_t param) {
+	outputFlush();
+}
+
+// apply back-pressure policy for len more bytes, returns 0 when this sink does not get them
+static uint8_t outputSinkRoom(outputSink* sink, uint32_t len, uint8_t policy) {
+	uint32_t startedAt = uwTick;
+	uint32_t waitedAt = 0;
+
+	if (policy == OUT_DEFAULT) policy = sink->policy;
+
+	// a message bigger than the limit still goes to an idle sink
+	while (outputHead != sink->tail && outputHead + len - sink->tail > sink->limit) {
+		// one level of yielding only, nested writes and writes from interrupts drop
+		if (policy == OUT_BLOCK && !outputBlocking && !(__get_IPSR())
+				&& uwTick - startedAt < OUTPUT_BLOCK_TIMEOUT) {
+			if (!waitedAt) waitedAt = usTimerRead();
+			outputBlocking = 1;
+			outputFlush();
+			kernel_process(1);
+			outputBlocking = 0;
+			continue;
+		}
+		if (policy == OUT_DROP_NEWEST || policy == OUT_TRUNCATE) return 0;
+
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		outputSinkDiscard(sink, len < sink->limit ? outputHead + len - sink->limit : outputHead);
+		__set_PRIMASK(primask);
+	}
+
+	if (waitedAt) {
+		uint32_t waited = usTimerRead() - waitedAt;
+		sink->waitUs += waited;
+		if (waited > sink->waitMaxUs) sink->waitMaxUs = waited;
+	}
+	return 1;
+}
+
+int outputWritePolicy(const char* data, int len, uint8_t policy) {
+	int left = len;
+	uint8_t take[OUTPUT_SINK_LIMIT];
+
+	while (left > 0) {
+		// pieces up to half of the ring, so blocking sinks can make progress
+		uint32_t piece = left > OUTPUT_RING_SIZE / 2 ? OUTPUT_RING_SIZE / 2 : left;
+
+		for (int i = 0; i < OUTPUT_SINK_LIMIT; i++)
+			take[i] = outputSinks[i].write ? outputSinkRoom(&outputSinks[i], piece, policy) : 1;
+
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		uint32_t pos = outputHead & OUTPUT_MASK;
+		uint32_t first = piece > OUTPUT_RING_SIZE - pos ? OUTPUT_RING_SIZE - pos : piece;
+
+		for (int i = 0; i < OUTPUT_SINK_LIMIT; i++) {
+			outputSink* sink = &outputSinks[i];
+			if (!sink->write) continue;
+			if (!take[i]) outputSkipAdd(sink, outputHead, outputHead + piece,
+					(policy == OUT_DEFAULT ? sink->policy : policy) == OUT_TRUNCATE);
+			// whatever the policy, the ring must not lap unread data
+			if (outputHead + piece - sink->tail > OUTPUT_RING_SIZE) {
+				uint32_t to = outputHead + piece - OUTPUT_RING_SIZE;
+				uint32_t dropped = sink->dropped;
+				// skip ranges start at message boundaries, cut there rather than mid message,
+				// the range stays so a marker still goes out
+				for (int s = 0; s < sink->skips; s++) {
+					if ((int32_t)(sink->skip[s].to - to) >= 0) {
+						to = sink->skip[s].from;
+						break;
+					}
+				}
+				outputSinkDiscard(sink, to);
+				// output the sink had taken is lost, maybe mid line, mark it whatever the policy
+				if (sink->dropped != dropped && sink->skips) sink->skip[0].mark = 1;
+			}
+		}
+
+		memcpy(&outputRing[pos], data, first);
+		memcpy(outputRing, data + first, piece - first);
+		outputHead += piece;
+		__set_PRIMASK(primask);
+
+		for (int i = 0; i < OUTPUT_SINK_LIMIT; i++) {
+			uint32_t backlog = outputHead - outputSinks[i].tail;
+			if (outputSinks[i].write && backlog > outputSinks[i].peak) outputSinks[i].peak = backlog;
+		}
+
+		data += piece;
+		left -= piece;
+	}
+
+	outputFlush();
+	return len;
+}
+
+int outputWrite(const char* data, int len) {
+	return outputWritePolicy(data, len, OUT_DEFAULT);
+}
+
+// implementation of console write for printf(...), all sinks get the same output
+int _write(int file, char *data, int len) {
+	return outputWrite(data, len);
+}
+
+static const char* const outputPolicyNames[] = { "oldest", "block", "newest", "trunc" };
+
+// sinks [reset] | sinks <name> <oldest|block|newest|trunc> [limit]
+int outputStats(char* args) {
+	char name[12], policy[8];
+	uint32_t limit = 0;
+
+	if (args && sscanf(args, "%11s %7s %lu", name, policy, &limit) >= 2) {
+		for (int i = 0; i < OUTPUT_SINK_LIMIT; i++) {
+			outputSink* sink = &outputSinks[i];
+			if (!sink->write || strcmp(sink->name, name)) continue;
+			for (int p = 0; p < 4; p++)
+				if (strcmp(policy, outputPolicyNames[p]) == 0) sink->policy = p;
+			if (limit) sink->limit = limit < OUTPUT_RING_SIZE ? limit : OUTPUT_RING_SIZE;
+		}
+	}
+
+	printf("Sink      policy    sent  dropped  cut  backlog/limit  peak   B/s  wait us (max)\n");
+	for (int i = 0; i < OUTPUT_SINK_LIMIT; i++) {
+		outputSink* sink = &outputSinks[i];
+		if (!sink->write) continue;
+
+		uint32_t elapsed = uwTick - sink->rateTick;
+		uint32_t rate = elapsed ? (uint32_t)((uint64_t)(sink->bytes - sink->rateBytes) * ST_SEC / elapsed) : 0;
+		printf(" %-8s %-6s %8lu %8lu %4lu %6lu/%-6lu %5lu %5lu %8lu (%lu)\n", sink->name,
+				outputPolicyNames[sink->policy & 3],
+				(unsigned long)sink->bytes, (unsigned long)sink->dropped, (unsigned long)sink->truncated,
+				(unsigned long)(outputHead - sink->tail), (unsigned long)sink->limit,
+				(unsigned long)sink->peak, (unsigned long)rate,
+				(unsigned long)sink->waitUs, (unsigned long)sink->waitMaxUs);
+		sink->rateBytes = sink->bytes;
+		sink->rateTick = uwTick;
+
+		if (args && strcmp(args, "reset") == 0) {
+			sink->dropped = sink->truncated = sink->peak = sink->waitUs = sink->waitMaxUs = 0;
+		}
+	}
+	return 0;
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * output.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *
+ *	Console output fan-out. printf -> _write -> one shared ring, every sink
+ *	(USB CDC, UART, TCP session, flash log...) reads it with its own cursor,
+ *	so a slow sink drops or waits on its own without stalling the others.
+ *
+ *	Sink write function takes what it can: returns bytes taken, 0 when busy,
+ *	negative when offline (data is discarded and counted as dropped).
+ *	Enabled automatically by USING_USB, USING_UART or USING_TCP_CONSOLE, or define USING_OUTPUT.
+ *
+ *	Back-pressure: every sink has a policy (what happens when its backlog is
+ *	over sink->limit), outputWritePolicy() overrides it for one call, e.g.
+ *	a burst of telemetry that should rather be lost than delay the caller.
+ */
+
+#ifndef SYS_OUTPUT_H_
+#define SYS_OUTPUT_H_
+
+#include "core.h"
+
+#if defined(USING_USB) || defined(USING_UART) || defined(USING_TCP_CONSOLE)
+	#ifndef USING_OUTPUT
+		#define USING_OUTPUT
+	#endif
+#endif
+
+#ifdef USING_OUTPUT
+
+	#define OUTPUT_RING_SIZE 		2048 // power of two, shared by all sinks
+#ifdef USING_TCP_CONSOLE
+	#define OUTPUT_SINK_LIMIT 		6    // usb, uart and up to 4 tcp sessions
+#else
+	#define OUTPUT_SINK_LIMIT 		4
+#endif
+	#define OUTPUT_SKIP_LIMIT 		4    // dropped messages remembered per sink, more are merged
+	#define OUTPUT_SINK_BACKLOG 	(OUTPUT_RING_SIZE / 2) // earlier output a new sink still gets, boot log
+	#define OUTPUT_RATE 			ST_MS
+	#define OUTPUT_BLOCK_TIMEOUT 	ST_MS * 100 // blocking sink turns into dropping after this
+	#define OUTPUT_TRUNCATE_MARK 	"~\n"       // printed where OUT_TRUNCATE cut the output, or the ring lapped taken output
+
+	// what happens when a sink is too slow to keep up
+	enum {
+		OUT_DROP_OLDEST = 0, // oldest unsent data of this sink is overwritten
+		OUT_BLOCK,           // writer yields to the scheduler until the sink catches up
+		OUT_DROP_NEWEST,     // message that does not fit is not sent to this sink
+		OUT_TRUNCATE,        // as drop newest, the sink gets OUTPUT_TRUNCATE_MARK instead
+		OUT_DEFAULT = 0xFF   // per call: use the policy of each sink
+	};
+
+	typedef int (*outputSinkWrite)(const uint8_t* data, uint16_t len);
+
+	// ring range a sink has to jump over
+	typedef struct outputSkip {
+		uint32_t from;
+		uint32_t to;
+		uint8_t  mark; // send truncate marker first
+	} outputSkip;
+
+	typedef struct outputSink {
+		const char*     name;
+		outputSinkWrite write;
+		uint8_t         policy;
+		uint32_t        limit;    // backlog allowed before policy kicks in, ring size by default
+		uint32_t        tail;     // next byte to send, free running
+		uint32_t        bytes;    // sent
+		uint32_t        dropped;
+		uint32_t        truncated; // messages cut by drop newest / truncate
+		uint32_t        peak;     // largest backlog seen
+		uint32_t        rateBytes; // for throughput between stats calls
+		uint32_t        rateTick;
+		uint32_t        waitUs;    // writer time spent blocked on this sink
+		uint32_t        waitMaxUs;
+		outputSkip      skip[OUTPUT_SKIP_LIMIT];
+		uint8_t         skips;
+		uint8_t         markSent;
+	} outputSink;
+
+	void outputInit(uint32_t);
+	outputSink* outputSinkAdd(const char* name, outputSinkWrite write, uint8_t policy);
+	void outputSinkRemove(outputSink* sink);
+
+	int outputWrite(const char* data, int len);
+	int outputWritePolicy(const char* data, int len, uint8_t policy); // policy for this call only
+	void outputFlush(void);              // push pending data to sinks now
+	void outputProcessor(uint32_t);      // retries busy sinks
+	int outputStats(char* args);
+
+#endif
+
+#endif /* SYS_OUTPUT_H_ */
@@ -0,0 +1,183 @@
+/*
+ * ring.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *
+ *	Single producer / single consumer byte ring shared by the drivers.
+ *	Size is a power of two, head and tail are free running and masked on access.
+ *	Producer only moves head, consumer only moves tail, so an interrupt on one side
+ *	and a task on the other need no irq masking.
+ *
+ *	RING(usbRx, 256);                       // static ring with its buffer
+ *	ringWrite(&usbRx, data, len);           // producer, bulk copy, returns bytes taken
+ *	while ((len = ringReadLine(&usbRx, line, sizeof(line), &lineLen)) >= 0) ...
+ *
+ *	DMA as producer: ringWriteSpan() gives the contiguous free space, ringCommit() publishes it.
+ *	DMA as consumer: ringSpan() gives the contiguous data, ringSkip() releases it.
+ */
+
+#ifndef SYS_RING_H_
+#define SYS_RING_H_
+
+#include <stdint.h>
+#include <string.h>
+
+	typedef struct tRing {
+		uint8_t*          buf;
+		uint32_t          mask;  // size - 1
+		volatile uint32_t head;  // written by producer only
+		volatile uint32_t tail;  // written by consumer only
+	} tRing;
+
+	#define RING_POW2(size) ((size) > 0 && ((size) & ((size) - 1)) == 0)
+
+	// static ring with its buffer
+	#define RING(n, size) \
+		_Static_assert(RING_POW2(size), "ring size must be a power of two"); \
+		static uint8_t __ring_##n[size]; \
+		tRing n = { __ring_##n, (size) - 1, 0, 0 }
+
+	static inline void ringInit(tRing* r, void* buf, uint32_t size) {
+		r->buf = buf;
+		r->mask = size - 1;
+		r->head = r->tail = 0;
+	}
+
+	static inline uint32_t ringSize(const tRing* r) {
+		return r->mask + 1;
+	}
+
+	// bytes waiting, exact on the consumer side
+	static inline uint32_t ringUsed(const tRing* r) {
+		return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - r->tail;
+	}
+
+	// room left, exact on the producer side
+	static inline uint32_t ringFree(const tRing* r) {
+		return ringSize(r) - (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+	}
+
+	// ---- producer ----
+
+	// contiguous free space at head
+	static inline uint32_t ringWriteSpan(tRing* r, uint8_t** data) {
+		uint32_t pos = r->head & r->mask;
+		uint32_t len = ringFree(r);
+		if (len > ringSize(r) - pos) len = ringSize(r) - pos;
+		*data = &r->buf[pos];
+		return len;
+	}
+
+	// publish len bytes written into the span
+	static inline void ringCommit(tRing* r, uint32_t len) {
+		__atomic_store_n(&r->head, r->head + len, __ATOMIC_RELEASE);
+	}
+
+	static inline uint32_t ringWrite(tRing* r, const void* data, uint32_t len) {
+		uint32_t free = ringFree(r);
+		uint32_t pos = r->head & r->mask;
+		uint32_t first;
+
+		if (len > free) len = free;
+		first = ringSize(r) - pos;
+		if (first > len) first = len;
+		memcpy(&r->buf[pos], data, first);
+		memcpy(r->buf, (const uint8_t*)data + first, len - first);
+		ringCommit(r, len);
+		return len;
+	}
+
+	// ---- consumer ----
+
+	// contiguous data at tail
+	static inline uint32_t ringSpan(tRing* r, const uint8_t** data) {
+		uint32_t pos = r->tail & r->mask;
+		uint32_t len = ringUsed(r);
+		if (len > ringSize(r) - pos) len = ringSize(r) - pos;
+		*data = &r->buf[pos];
+		return len;
+	}
+
+	// release len bytes
+	static inline void ringSkip(tRing* r, uint32_t len) {
+		__atomic_store_n(&r->tail, r->tail + len, __ATOMIC_RELEASE);
+	}
+
+	// drop everything that is waiting
+	static inline void ringFlush(tRing* r) {
+		__atomic_store_n(&r->tail, __atomic_load_n(&r->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	}
+
+	static inline uint32_t ringRead(tRing* r, void* data, uint32_t len) {
+		uint32_t used = ringUsed(r);
+		uint32_t pos = r->tail & r->mask;
+		uint32_t first;
+
+		if (len > used) len = used;
+		first = ringSize(r) - pos;
+		if (first > len) first = len;
+		memcpy(data, &r->buf[pos], first);
+		memcpy((uint8_t*)data + first, r->buf, len - first);
+		ringSkip(r, len);
+		return len;
+	}
+
+	// read-only ring over a linear buffer, the readers below parse it in place (a received pbuf)
+	static inline void ringView(tRing* r, const void* data, uint32_t len) {
+		r->buf = (uint8_t*)data;
+		r->mask = 0xFFFFFFFFu >> __builtin_clz(len | 1); // size above len, spans never wrap
+		r->head = len;
+		r->tail = 0;
+	}
+
+	// first CR or LF in a span, NULL if none
+	static inline const uint8_t* ringEol(const uint8_t* span, uint32_t len) {
+		const uint8_t* lf = memchr(span, '\n', len);
+		const uint8_t* cr = memchr(span, '\r', lf ? (uint32_t)(lf - span) : len);
+		return cr ? cr : lf;
+	}
+
+	#define RING_LINE_DROP 0xFFFF // *len while a line longer than size - 1 is skipped to its end
+
+	// text up to a line end goes into line, a line that does not fit is dropped whole
+	static inline void ringLineAppend(char* line, uint16_t size, uint16_t* len, const uint8_t* text, uint32_t n) {
+		if (*len == RING_LINE_DROP) return;
+		if (*len + n > (uint32_t)size - 1) {
+			*len = RING_LINE_DROP;
+			return;
+		}
+		memcpy(line + *len, text, n);
+		*len += n;
+	}
+
+	// line end reached: returns its length (zero terminated), -1 for an empty or dropped line
+	static inline int32_t ringLineEnd(char* line, uint16_t* len) {
+		int32_t done = *len;
+
+		*len = 0;
+		if (!done || done == RING_LINE_DROP) return -1;
+		line[done] = '\0';
+		return done;
+	}
+
+	// assemble a CR/LF terminated line, whole spans at a time.
+	// Returns line length once complete (zero terminated, terminator dropped, empty lines skipped),
+	// -1 while incomplete, *len keeps the partial line between calls. Longer lines are dropped.
+	static inline int32_t ringReadLine(tRing* r, char* line, uint16_t size, uint16_t* len) {
+		const uint8_t* span;
+		uint32_t n;
+
+		while ((n = ringSpan(r, &span)) > 0) {
+			const uint8_t* eol = ringEol(span, n);
+			uint32_t part = eol ? (uint32_t)(eol - span) : n;
+			int32_t done;
+
+			ringLineAppend(line, size, len, span, part);
+			ringSkip(r, eol ? part + 1 : part);
+			if (eol && (done = ringLineEnd(line, len)) >= 0) return done;
+		}
+		return -1;
+	}
+
+#endif /* SYS_RING_H_ */
@@ -0,0 +1,291 @@
+/*
+ * rpc.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *      COBS framed binary requests, multiplexed with console lines
+ */
+
+#include "rpc.h"
+
+#ifdef USING_RPC
+
+typedef struct rpcMethod {
+	uint8_t           id;
+	rpcHandler        handler;
+	struct rpcMethod* next;
+} rpcMethod;
+
+static rpcMethod* rpcMethods = NULL;
+static rpcLink* rpcLinks = NULL;
+static rpcLink* rpcServing = NULL;
+
+MODULE(rpc, MOD_RPC, 0, 0, &rpcInit);
+
+#ifdef USING_CONSOLE
+CONSOLE_CMD(rpcstat, rpcStats);
+#endif
+
+static int rpcPing(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size) {
+	memcpy(resp, req, len);
+	return len;
+}
+
+static int rpcInfo(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size) {
+	uint32_t up = uwTick;
+	uint16_t n = strlen(FIRMWARE_VERSION);
+
+	if (n > size - 4) n = size - 4;
+	memcpy(resp, &up, 4);
+	memcpy(resp + 4, FIRMWARE_VERSION, n);
+	return 4 + n;
+}
+
+void rpcInit(uint32_t msg) {
+	rpcRegister(RPC_PING, &rpcPing);
+	rpcRegister(RPC_INFO, &rpcInfo);
+}
+
+void rpcRegister(uint8_t method, rpcHandler handler) {
+	rpcMethod* m = memAlloc(MEM_RPC, sizeof(rpcMethod));
+	if (!m) return;
+
+	m->id = method;
+	m->handler = handler;
+	m->next = rpcMethods;
+	rpcMethods = m;
+}
+
+void rpcLinkAdd(rpcLink* link) {
+	link->next = rpcLinks;
+	rpcLinks = link;
+}
+
+rpcLink* rpcLinkFind(const char* name) {
+	for (rpcLink* link = rpcLinks; link; link = link->next)
+		if (strcmp(link->name, name) == 0) return link;
+	return NULL;
+}
+
+rpcLink* rpcCaller(void) {
+	return rpcServing;
+}
+
+// CRC-16/CCITT-FALSE, nibble table keeps flash use small
+uint16_t rpcCrc(const uint8_t* data, uint16_t len) {
+	static const uint16_t table[16] = {
+		0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+		0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+	};
+	uint16_t crc = 0xFFFF;
+
+	while (len--) {
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (*data >> 4)];
+		crc = (crc << 4) ^ table[(crc >> 12) ^ (*data++ & 0x0F)];
+	}
+	return crc;
+}
+
+uint16_t rpcCobsEncode(const uint8_t* src, uint16_t len, uint8_t* dst) {
+	uint8_t* out = dst + 1;
+	uint8_t* code = dst;
+	uint8_t n = 1;
+
+	while (len--) {
+		uint8_t b = *src++;
+		if (b) {
+			*out++ = b;
+			n++;
+		}
+		if (!b || n == 0xFF) {
+			*code = n;
+			n = 1;
+			code = out;
+			if (!b || len) out++;
+		}
+	}
+	if (code != out) *code = n; // full block at the very end needs no trailing code
+	return out - dst;
+}
+
+uint16_t rpcCobsDecode(const uint8_t* src, uint16_t len, uint8_t* dst) {
+	const uint8_t* end = src + len;
+	uint8_t* out = dst;
+	uint8_t code = 0xFF, block = 0;
+
+	while (src < end) {
+		if (block) {
+			*out++ = *src++;
+		} else {
+			block = *src++;
+			if (!block) break;
+			if (code != 0xFF) *out++ = 0;
+			code = block;
+		}
+		block--;
+	}
+	return out - dst;
+}
+
+// crc and COBS with both delimiters, frame needs 2 spare bytes for the crc
+static uint16_t rpcWire(uint8_t* frame, uint16_t len, uint8_t* wire) {
+	uint16_t crc = rpcCrc(frame, len);
+	uint16_t n;
+
+	frame[len++] = crc >> 8;
+	frame[len++] = crc & 0xFF;
+	wire[0] = 0;
+	n = 1 + rpcCobsEncode(frame, len, wire + 1);
+	wire[n++] = 0;
+	return n;
+}
+
+int rpcPush(rpcLink* link, uint8_t method, uint16_t seq, const uint8_t* payload, uint16_t len) {
+	uint8_t frame[RPC_FRAME_SIZE];
+	uint8_t wire[RPC_WIRE_SIZE];
+
+	if (len > RPC_PAYLOAD_SIZE) return -1;
+	frame[0] = seq & 0xFF;
+	frame[1] = seq >> 8;
+	frame[2] = method;
+	frame[3] = RPC_OK;
+	memcpy(frame + RPC_HEADER_SIZE, payload, len);
+	return link->write(wire, rpcWire(frame, RPC_HEADER_SIZE + len, wire));
+}
+
+static rpcHandler rpcFind(uint8_t method) {
+	for (rpcMethod* m = rpcMethods; m; m = m->next)
+		if (m->id == method) return m->handler;
+	return NULL;
+}
+
+// hand the pending response to the transport, 1 when the link is free again
+static uint8_t rpcFlush(rpcLink* link) {
+	if (!link->txLen) return 1;
+
+	int sent = link->write(link->tx, link->txLen);
+	if (sent == 0) {
+		link->busy++;
+		return 0;
+	}
+	link->txLen = 0;
+	return 1;
+}
+
+// decode, check and run one received frame, response goes to link->tx
+static void rpcFrame(rpcLink* link) {
+	uint8_t frame[RPC_WIRE_SIZE];
+	uint8_t status = RPC_OK;
+	uint16_t len;
+	int out = 0;
+
+	len = rpcCobsDecode(link->rx, link->rxLen, frame);
+	if (len < RPC_HEADER_SIZE + 2 || rpcCrc(frame, len) != 0) {
+		link->crcErrors++;
+		return;
+	}
+	link->requests++;
+	len -= RPC_HEADER_SIZE + 2;
+
+	rpcHandler handler = rpcFind(frame[2]);
+	if (len > RPC_PAYLOAD_SIZE) {
+		status = RPC_TOO_LONG;
+	} else if (!handler) {
+		status = RPC_UNKNOWN;
+		link->unknown++;
+	} else {
+		uint8_t req[RPC_PAYLOAD_SIZE];
+		uint32_t start = usTimerRead();
+
+		// response is built in place of the request
+		memcpy(req, frame + RPC_HEADER_SIZE, len);
+		rpcServing = link;
+		out = handler(req, len, frame + RPC_HEADER_SIZE, RPC_PAYLOAD_SIZE);
+		rpcServing = NULL;
+		if (out < 0 || out > RPC_PAYLOAD_SIZE) {
+			status = RPC_ERROR;
+			out = 0;
+		}
+		uint32_t took = usTimerRead() - start;
+		if (took > link->handlerMaxUs) link->handlerMaxUs = took;
+	}
+
+	frame[3] = status;
+	link->txLen = rpcWire(frame, RPC_HEADER_SIZE + out, link->tx);
+	link->responses++;
+	rpcFlush(link);
+}
+
+int32_t rpcReadLine(rpcLink* link, tRing* r, char* line, uint16_t size, uint16_t* len) {
+	const uint8_t* span;
+	uint32_t n;
+
+	while (rpcFlush(link) && (n = ringSpan(r, &span)) > 0) {
+		const uint8_t* zero = memchr(span, 0, n);
+		uint32_t part = zero ? (uint32_t)(zero - span) : n;
+
+		if (link->inFrame == RPC_RX_DROP) {
+			// rest of an overlong frame, none of it is console text
+			ringSkip(r, zero ? part + 1 : part);
+			if (zero) link->inFrame = RPC_RX_TEXT;
+			continue;
+		}
+		if (link->inFrame) {
+			if (link->rxLen + part > RPC_WIRE_SIZE - 2) {
+				link->overruns++;
+				link->inFrame = RPC_RX_DROP;
+				continue;
+			}
+			memcpy(link->rx + link->rxLen, span, part);
+			link->rxLen += part;
+			ringSkip(r, zero ? part + 1 : part);
+
+			// empty frame: we were out of step, this zero opens the next one
+			if (zero && link->rxLen) {
+				rpcFrame(link);
+				link->inFrame = RPC_RX_TEXT;
+			}
+			continue;
+		}
+
+		const uint8_t* eol = ringEol(span, part);
+		uint32_t text = eol ? (uint32_t)(eol - span) : part;
+		int32_t done;
+
+		ringLineAppend(line, size, len, span, text);
+		if (eol) {
+			ringSkip(r, text + 1);
+			if ((done = ringLineEnd(line, len)) >= 0) return done;
+		} else {
+			ringSkip(r, zero ? part + 1 : part);
+			if (zero) {
+				link->inFrame = RPC_RX_FRAME;
+				link->rxLen = 0;
+			}
+		}
+	}
+	return -1;
+}
+
+int rpcStats(char* args) {
+	rpcMethod* m;
+	uint8_t count = 0;
+
+	for (m = rpcMethods; m; m = m->next) count++;
+	printf("%u methods, payload up to %u bytes\n", count, RPC_PAYLOAD_SIZE);
+	printf("Link      requests responses  crc  overrun unknown  busy  handler max us\n");
+	for (rpcLink* link = rpcLinks; link; link = link->next) {
+		printf(" %-8s %8lu %9lu %4lu %8lu %7lu %5lu %8lu\n", link->name,
+				(unsigned long)link->requests, (unsigned long)link->responses,
+				(unsigned long)link->crcErrors, (unsigned long)link->overruns,
+				(unsigned long)link->unknown, (unsigned long)link->busy,
+				(unsigned long)link->handlerMaxUs);
+		if (args && strcmp(args, "reset") == 0) {
+			link->requests = link->responses = link->crcErrors = link->overruns = 0;
+			link->unknown = link->busy = link->handlerMaxUs = 0;
+		}
+	}
+	return 0;
+}
+
+#endif
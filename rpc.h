@@ -0,0 +1,105 @@
+/*
+ * rpc.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *
+ *	Binary request/response channel next to the text console, on the same link.
+ *
+ *	Frame on the wire: 0x00 COBS(seq:2 method:1 status:1 payload crc:2) 0x00
+ *	COBS removes every zero from the frame, text never contains a zero, so the
+ *	line assembler of a transport tells them apart by the delimiter alone.
+ *	seq comes back in the response untouched, the host can pipeline requests.
+ *	CRC is CRC-16/CCITT-FALSE over header and payload, big endian.
+ *
+ *	1. Define USING_RPC
+ *	2. Register handlers, ids 0..RPC_USER-1 are taken by the framework:
+ *	     rpcRegister(RPC_USER, &readSensors);
+ *	   handler gets the request payload and fills the response, returns its length
+ *	   or negative on error (sent as RPC_ERROR without payload)
+ *	3. Host side: tools/rpc_client.py
+ */
+
+#ifndef SYS_RPC_H_
+#define SYS_RPC_H_
+
+#include "core.h"
+
+#ifdef USING_RPC
+
+	#define RPC_PAYLOAD_SIZE 	192
+	#define RPC_HEADER_SIZE 	4
+	#define RPC_FRAME_SIZE 		(RPC_HEADER_SIZE + RPC_PAYLOAD_SIZE + 2) // decoded, with crc
+	#define RPC_WIRE_SIZE 		(RPC_FRAME_SIZE + RPC_FRAME_SIZE / 254 + 3) // COBS overhead and both delimiters
+
+	// method ids
+	enum {
+		RPC_PING = 0, // echoes the payload
+		RPC_INFO,     // uptime ms (4 bytes LE) and FIRMWARE_VERSION
+		RPC_TM_LIST,  // telemetry variables, see telemetry.h
+		RPC_TM_SUBSCRIBE,
+		RPC_TM_DATA,  // pushed by the device, seq counts frames
+		RPC_USER = 16 // first id free for application handlers
+	};
+
+	// response status
+	enum {
+		RPC_OK = 0,
+		RPC_UNKNOWN,  // no handler for the method
+		RPC_ERROR,    // handler failed
+		RPC_TOO_LONG  // request did not fit RPC_PAYLOAD_SIZE
+	};
+
+	typedef int (*rpcHandler)(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size);
+
+	// whole frame or nothing: returns > 0 sent, 0 busy (retried), < 0 offline (dropped)
+	typedef int (*rpcLinkWrite)(const uint8_t* data, uint16_t len);
+
+	// what the received bytes are, see rpcReadLine
+	enum {
+		RPC_RX_TEXT,  // console lines
+		RPC_RX_FRAME, // after a zero, frame being collected
+		RPC_RX_DROP   // overlong frame, dropped up to its closing zero
+	};
+
+	// rpc state of one transport
+	typedef struct rpcLink {
+		const char*     name;
+		rpcLinkWrite    write;
+		uint8_t         inFrame;
+		uint16_t        rxLen;
+		uint8_t         rx[RPC_WIRE_SIZE]; // encoded frame being received
+		uint16_t        txLen;
+		uint8_t         tx[RPC_WIRE_SIZE]; // encoded response waiting for the transport
+		uint32_t        requests;
+		uint32_t        responses;
+		uint32_t        crcErrors;
+		uint32_t        overruns;  // frames longer than RPC_WIRE_SIZE, dropped
+		uint32_t        unknown;
+		uint32_t        busy;      // passes spent waiting for the transport
+		uint32_t        handlerMaxUs;
+		struct rpcLink* next;
+	} rpcLink;
+
+	void rpcInit(uint32_t);
+	void rpcRegister(uint8_t method, rpcHandler handler);
+	void rpcLinkAdd(rpcLink* link);
+	rpcLink* rpcLinkFind(const char* name);
+	rpcLink* rpcCaller(void); // link of the request being served, inside a handler
+
+	// unsolicited frame (status RPC_OK), link write result: > 0 sent, 0 busy, < 0 offline
+	int rpcPush(rpcLink* link, uint8_t method, uint16_t seq, const uint8_t* payload, uint16_t len);
+
+	// ringReadLine for transports carrying rpc: frames are dispatched on the way,
+	// reading pauses while a response waits for the transport
+	int32_t rpcReadLine(rpcLink* link, tRing* r, char* line, uint16_t size, uint16_t* len);
+
+	uint16_t rpcCrc(const uint8_t* data, uint16_t len);
+	uint16_t rpcCobsEncode(const uint8_t* src, uint16_t len, uint8_t* dst);
+	uint16_t rpcCobsDecode(const uint8_t* src, uint16_t len, uint8_t* dst); // in place allowed
+
+	int rpcStats(char* args);
+
+#endif
+
+#endif /* SYS_RPC_H_ */
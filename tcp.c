@@ -8,8 +8,9 @@
 
 
 
-#ifdef USING_TCP
 #include "tcp.h"
+
+#ifdef USING_TCP
 #include "console.h"
 #include "lwip/netif.h"
 #include "lwip/ip_addr.h"
@@ -29,6 +30,12 @@
  // our TCP control block
  static struct tcp_pcb *hc_pcb;
 
+ // task group of the request loop
+ static unsigned char tcpGroup;
+
+ // ready once DHCP gives us an address, a slow DHCP server gets 15 s
+ MODULE_WAIT(tcp, MOD_TCP, 0, MF_ASYNC, &tcpInit, ST_SEC * 15);
+
  //================================================================
  // callbacks
  //================================================================
@@ -93,7 +100,7 @@
      hc_pcb = tcp_new();
      if (!hc_pcb) {
          printf("hc: tcp_new() failed\n");
-         return;
+         return 1;
      }
 
      // 2) set callbacks
@@ -107,12 +114,26 @@
          tcp_close(hc_pcb);
          hc_pcb = NULL;
      }
+     return 0;
  }
 
 
 
 	void tcpProcess(uint32_t param) {
 		MX_LWIP_Process(); // test only
+#ifdef USING_TCP_CONSOLE
+		tcpConsolePoll();
+#endif
+
+		if (!moduleIsReady(MOD_TCP) && gnetif.ip_addr.addr != 0) {
+			/* Now we have an IP: print it */
+			char ip[20];
+			strcpy(ip, ip4addr_ntoa(&gnetif.ip_addr));
+			printf("Network set - IP: %s\n", ip);
+			moduleReady(MOD_TCP);
+
+			tcpRequest(NULL);
+		}
 	}
 
 	void tcpReqProc(uint32_t par) {
@@ -131,9 +152,14 @@
 	  netif_set_up(&gnetif);
 	  netif_set_link_up(&gnetif);
 	  */
-		if (taskExists(&tcpReqProc)) {
-			taskRemove(&tcpReqProc);
-		} else repeat("TCP_REQ", ST_SEC * 2, &tcpReqProc);
+		// request loop lives in its own group, one call tears it all down
+		if (!tcpGroup && !(tcpGroup = taskGroupCreate("TCP"))) {
+			printf("no free task group\n"); // group 0 could never be cancelled
+			return 1;
+		}
+		if (!taskGroupCancel(tcpGroup))
+			repeatGroup(tcpGroup, "TCP_REQ", ST_SEC * 2, &tcpReqProc);
+		return 0;
 	}
 
 	int tcpCheck(char* args) {
@@ -143,27 +169,293 @@
 		} else {
 			printf("[LWIP] LINK DOWN\n");
 		}
+		return 0;
 	}
 
-	void tcpInit() {
-		consoleRegister("tcpcheck", &tcpCheck);
-		consoleRegister("tcploop", &tcpLoop);
-		consoleRegister("tcprequest", &tcpRequest);
+#ifdef USING_TCP_CONSOLE
+	//================================================================
+	// console sessions
+	//================================================================
+	_Static_assert(TCP_CONSOLE_SESSIONS <= 4, "TCP_CONSOLE_SESSIONS above 4");
+
+	typedef struct tcpSession {
+		struct tcp_pcb* pcb;       // NULL - slot free
+		struct pbuf*    p;         // received chain, parsed in place, freed and acked once parsed
+		struct pbuf*    q;         // segment being parsed
+		tRing           view;      // over q->payload
+		char*           line;      // command queue slot the line is read into, NULL - none claimed
+		uint16_t        lineLen;
+		outputSink*     sink;
+		uint32_t        openedAt;
+		uint32_t        activeAt;
+		uint32_t        rxBytes;
+		uint32_t        txBytes;
+		uint32_t        lines;
+#ifdef USING_RPC
+		rpcLink         rpc;
+#endif
+	} tcpSession;
+
+	static tcpSession tcpSessions[TCP_CONSOLE_SESSIONS];
+	static struct tcp_pcb* tcpListenPcb;
+	static uint32_t tcpAccepted, tcpRejected;
+	static const char* const tcpSessionNames[] = { "tcp0", "tcp1", "tcp2", "tcp3" };
+
+	// output sink, takes what fits the send buffer, tcp_sent makes room again.
+	// The raw API is not reentrant: printf from an interrupt leaves it to outputProcessor
+	static int tcpSessionWrite(tcpSession* s, const uint8_t* data, uint16_t len) {
+		uint16_t room;
+
+		if (!s->pcb) return -1;
+		if (__get_IPSR()) return 0;
+		room = tcp_sndbuf(s->pcb);
+		if (len > room) len = room;
+		if (!len || tcp_write(s->pcb, data, len, TCP_WRITE_FLAG_COPY) != ERR_OK) return 0; // out of segments too
+		tcp_output(s->pcb);
+		s->txBytes += len;
+		return len;
+	}
+
+#ifdef USING_RPC
+	// rpc link, whole frame or nothing
+	static int tcpSessionRpcWrite(tcpSession* s, const uint8_t* data, uint16_t len) {
+		if (!s->pcb) return -1;
+		if (tcp_sndbuf(s->pcb) < len) return 0;
+		return tcpSessionWrite(s, data, len);
+	}
+
+	#define TCP_SESSION_WRITERS(i) \
+		static int tcpSinkWrite##i(const uint8_t* d, uint16_t l) { return tcpSessionWrite(&tcpSessions[i], d, l); } \
+		static int tcpRpcWrite##i(const uint8_t* d, uint16_t l) { return tcpSessionRpcWrite(&tcpSessions[i], d, l); }
+	#define TCP_RPC_WRITE(i) &tcpRpcWrite##i,
+#else
+	#define TCP_SESSION_WRITERS(i) \
+		static int tcpSinkWrite##i(const uint8_t* d, uint16_t l) { return tcpSessionWrite(&tcpSessions[i], d, l); }
+	#define TCP_RPC_WRITE(i)
+#endif
+
+	// sinks and rpc links carry no context, one writer per slot
+	TCP_SESSION_WRITERS(0)
+	TCP_SESSION_WRITERS(1)
+	TCP_SESSION_WRITERS(2)
+	TCP_SESSION_WRITERS(3)
+	static const outputSinkWrite tcpSinkWrites[] = { &tcpSinkWrite0, &tcpSinkWrite1, &tcpSinkWrite2, &tcpSinkWrite3 };
+#ifdef USING_RPC
+	static const rpcLinkWrite tcpRpcWrites[] = { TCP_RPC_WRITE(0) TCP_RPC_WRITE(1) TCP_RPC_WRITE(2) TCP_RPC_WRITE(3) };
+#endif
 
-		while (gnetif.ip_addr.addr == 0)	{
-			MX_LWIP_Process();  // handles input + sys_check_timeouts()
+	static inline int32_t tcpSessionReadLine(tcpSession* s) {
+#ifdef USING_RPC
+		return rpcReadLine(&s->rpc, &s->view, s->line, CMD_BUFFER_SIZE, &s->lineLen);
+#else
+		return ringReadLine(&s->view, s->line, CMD_BUFFER_SIZE, &s->lineLen);
+#endif
+	}
+
+	// lines straight from the pbuf payload into a command queue slot, the only copy. The chain
+	// is acked only once parsed, while the queue is full the receive window closes and holds the
+	// peer off. A line cut between segments keeps its slot until the rest comes
+	static void tcpSessionLines(tcpSession* s) {
+		if (!s->p) return;
+
+		while (s->q) {
+			if (!s->line && !(s->line = cmdClaim())) return;
+			if (tcpSessionReadLine(s) < 0) {
+				if (ringUsed(&s->view)) return; // rpc response waits for the send buffer
+				s->q = s->q->next;
+				if (s->q) ringView(&s->view, s->q->payload, s->q->len);
+				continue;
+			}
+			cmdSubmit(s->line);
+			s->line = NULL;
+			s->lines++;
+		}
+		if (s->line && !s->lineLen) {
+			cmdRelease(s->line); // nothing started, other transports get it
+			s->line = NULL;
+		}
+
+		tcp_recved(s->pcb, s->p->tot_len);
+		pbuf_free(s->p);
+		s->p = NULL;
+	}
+
+	static void tcpSessionRelease(tcpSession* s) {
+		if (s->p) pbuf_free(s->p);
+		if (s->line) cmdRelease(s->line);
+		s->line = NULL;
+		s->lineLen = 0;
+		s->p = s->q = NULL;
+		s->pcb = NULL;
+		outputSinkRemove(s->sink);
+		s->sink = NULL;
+	}
+
+	// returns ERR_ABRT when the pcb had to be aborted, callbacks pass it on to lwIP
+	static err_t tcpSessionClose(tcpSession* s) {
+		struct tcp_pcb* pcb = s->pcb;
+		err_t r = ERR_OK;
+
+		tcpSessionRelease(s);
+		tcp_arg(pcb, NULL);
+		tcp_recv(pcb, NULL);
+		tcp_sent(pcb, NULL);
+		tcp_err(pcb, NULL);
+		if (tcp_close(pcb) != ERR_OK) {
+			tcp_abort(pcb);
+			r = ERR_ABRT;
+		}
+		printf("%s closed\n", tcpSessionNames[s - tcpSessions]);
+		return r;
+	}
+
+	static err_t tcpSessionRecv(void* arg, struct tcp_pcb* pcb, struct pbuf* p, err_t err) {
+		tcpSession* s = arg;
+
+		if (!p) return tcpSessionClose(s); // peer closed
+		if (err != ERR_OK) {
+			pbuf_free(p);
+			return err;
 		}
 
-		/* Now we have an IP: print it */
-		char ip[20];
-		strcpy(ip, ip4addr_ntoa(&gnetif.ip_addr));
-		printf("Network set - IP: %s\n", ip);
+		s->rxBytes += p->tot_len;
+		s->activeAt = uwTick;
+		if (s->p) pbuf_cat(s->p, p); // still parsing, q stays valid
+		else {
+			s->p = s->q = p;
+			ringView(&s->view, p->payload, p->len);
+		}
+		tcpSessionLines(s);
+		return ERR_OK;
+	}
+
+	// acked data left the send buffer
+	static err_t tcpSessionSent(void* arg, struct tcp_pcb* pcb, uint16_t len) {
+		outputFlush();
+		tcpSessionLines(arg); // rpc response may have been waiting
+		return ERR_OK;
+	}
 
+	// pcb is already gone
+	static void tcpSessionError(void* arg, err_t err) {
+		tcpSession* s = arg;
+
+		tcpSessionRelease(s);
+		printf("%s aborted, err %d\n", tcpSessionNames[s - tcpSessions], err);
+	}
+
+	static err_t tcpConsoleAccept(void* arg, struct tcp_pcb* pcb, err_t err) {
+		tcpSession* s = NULL;
+		uint8_t i;
+
+		if (err != ERR_OK || !pcb) return ERR_VAL;
+		for (i = 0; i < TCP_CONSOLE_SESSIONS; i++) {
+			if (!tcpSessions[i].pcb) {
+				s = &tcpSessions[i];
+				break;
+			}
+		}
+		if (s) s->sink = outputSinkAdd(tcpSessionNames[i], tcpSinkWrites[i], OUT_TRUNCATE);
+		if (!s || !s->sink) {
+			tcpRejected++;
+			tcp_abort(pcb);
+			return ERR_ABRT;
+		}
+
+		s->pcb = pcb;
+		s->p = s->q = NULL;
+		s->line = NULL;
+		s->lineLen = 0;
+		s->openedAt = s->activeAt = uwTick;
+		s->rxBytes = s->txBytes = s->lines = 0;
+#ifdef USING_RPC
+		s->rpc.inFrame = RPC_RX_TEXT;
+		s->rpc.txLen = 0;
+#endif
+		tcpAccepted++;
+
+		tcp_arg(pcb, s);
+		tcp_recv(pcb, &tcpSessionRecv);
+		tcp_sent(pcb, &tcpSessionSent);
+		tcp_err(pcb, &tcpSessionError);
+		printf("%s open\n", tcpSessionNames[i]);
+		return ERR_OK;
+	}
+
+	void tcpConsoleInit(void) {
+		struct tcp_pcb* pcb = tcp_new();
+
+#ifdef USING_RPC
+		for (uint8_t i = 0; i < TCP_CONSOLE_SESSIONS; i++) {
+			tcpSessions[i].rpc.name = tcpSessionNames[i];
+			tcpSessions[i].rpc.write = tcpRpcWrites[i];
+			rpcLinkAdd(&tcpSessions[i].rpc);
+		}
+#endif
+		if (!pcb || tcp_bind(pcb, IP_ADDR_ANY, TCP_CONSOLE_PORT) != ERR_OK) {
+			printf("tcp console: can't bind port %u\n", TCP_CONSOLE_PORT);
+			if (pcb) tcp_close(pcb);
+			return;
+		}
+		tcpListenPcb = tcp_listen(pcb);
+		if (!tcpListenPcb) {
+			tcp_close(pcb);
+			return;
+		}
+		tcp_accept(tcpListenPcb, &tcpConsoleAccept);
+	}
+
+	void tcpConsolePoll(void) {
+		for (uint8_t i = 0; i < TCP_CONSOLE_SESSIONS; i++) {
+			tcpSession* s = &tcpSessions[i];
+			if (!s->pcb) continue;
+
+			tcpSessionLines(s);
+			if (uwTick - s->activeAt > TCP_CONSOLE_IDLE) tcpSessionClose(s);
+		}
+	}
+
+	int tcpConsoleStats(char* args) {
+		printf("port %u, %u sessions, accepted %lu, rejected %lu\n", TCP_CONSOLE_PORT, TCP_CONSOLE_SESSIONS,
+				(unsigned long)tcpAccepted, (unsigned long)tcpRejected);
+		for (uint8_t i = 0; i < TCP_CONSOLE_SESSIONS; i++) {
+			tcpSession* s = &tcpSessions[i];
+			if (!s->pcb) continue;
+			printf(" %s up %lus, idle %lus, rx %lu, tx %lu, lines %lu, sndbuf %u%s\n", tcpSessionNames[i],
+					(unsigned long)((uwTick - s->openedAt) / ST_SEC), (unsigned long)((uwTick - s->activeAt) / ST_SEC),
+					(unsigned long)s->rxBytes, (unsigned long)s->txBytes, (unsigned long)s->lines,
+					tcp_sndbuf(s->pcb), s->p ? ", held" : "");
+		}
+		return 0;
+	}
+
+#ifdef USING_CONSOLE
+	CONSOLE_CMD(tcpcon, tcpConsoleStats);
+#endif
+
+	__attribute__((weak)) uint8_t onCommand(uint32_t param) {
+		printf("tcp> %s\n", cmd);
+		return 0;
+	}
+#endif
+
+#ifdef USING_CONSOLE
+	CONSOLE_CMD(tcpcheck, tcpCheck);
+	CONSOLE_CMD(tcploop, tcpLoop);
+	CONSOLE_CMD(tcprequest, tcpRequest);
+#endif
+
+	void tcpInit() {
+		tcpGroup = taskGroupCreate("TCP");
+		if (!tcpGroup) printf("TCP: no free task group\n");
+#ifdef USING_TCP_CONSOLE
+		tcpConsoleInit(); // listening does not need an address yet
+#endif
+
+		// lwIP processing picks up DHCP, module reports ready once address is set
 		tTask* proc = repeat("TCP_PR", ST_MS, &tcpProcess);
 		proc->timeout = 1000 * ST_SS * 30;
 		proc->realtime_fail = ST_SEC;
-
-		tcpRequest(NULL);
 		/*tcpStats(0);
 
 
@@ -16,6 +16,25 @@
 	void tcpInit();
 	void tcpProcess();
 
+#ifdef USING_TCP_CONSOLE
+	// console over raw TCP, `nc <ip> 23`. Lines go to the command queue like USB and UART,
+	// every session is an output sink and sees all console output, a stalled peer gets "~"
+	// where output was cut instead of slowing printf down. With USING_RPC the same
+	// connection carries rpc frames, tools/rpc_client.py tcp:<ip>:23
+	#define TCP_CONSOLE_PORT 		23
+#ifndef TCP_CONSOLE_SESSIONS
+	#define TCP_CONSOLE_SESSIONS 	2   // up to 4, each takes an output sink
+#endif
+	#define TCP_CONSOLE_IDLE 		(ST_MIN * 30) // silent sessions are closed
+
+	void tcpConsoleInit(void);
+	void tcpConsolePoll(void);  // lines the full command queue refused, idle sessions
+	int tcpConsoleStats(char* args);
+
+	extern char* cmd; // line being executed, see cmdQueue
+	__attribute__((weak)) uint8_t onCommand(uint32_t);
+#endif
+
 #endif
 
 
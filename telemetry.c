@@ -0,0 +1,299 @@
+/*
+ * telemetry.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *      Registered variables sampled into packed frames, pushed over rpc
+ */
+
+#include "telemetry.h"
+
+#ifdef USING_TELEMETRY
+
+#define TELEMETRY_LATENCY 	ST_SS * 5 // partial frame is sent after this at slow rates
+
+typedef struct tmSlot {
+	volatile void* addr;
+	uint8_t        size;
+} tmSlot;
+
+typedef struct tmFrame {
+	uint8_t  data[RPC_PAYLOAD_SIZE];
+	uint16_t len;
+} tmFrame;
+
+static tmVar tmVars[TELEMETRY_VAR_LIMIT];
+static uint8_t tmVarCount = 0;
+
+// subscription
+static tmSlot tmSub[TELEMETRY_SUB_LIMIT];
+static uint8_t tmSubCount = 0;
+static uint16_t tmRecord = 0;   // bytes per sample
+static uint8_t tmPerFrame = 0;
+static uint8_t tmGen = 0;       // bumped on every subscribe, host drops frames of the old set
+static uint16_t tmRate = 0;
+static rpcLink* tmLink = NULL;
+static volatile uint8_t tmActive = 0;
+
+// double buffer, sampler fills one while the sender pushes the other
+static tmFrame tmFrames[2];
+static volatile uint8_t tmFill = 0;
+static volatile uint8_t tmReady[2];
+static uint32_t tmFrameTick;
+static uint16_t tmSeq = 0;
+
+// stats
+static uint32_t tmSamples, tmSent, tmOverruns, tmBusy, tmLost, tmSince;
+static unsigned char tmGroup; // sampler and sender, stopped from commands running in the scheduler
+
+MODULE(telemetry, MOD_TELEMETRY, MOD_RPC, 0, &telemetryInit);
+
+#ifdef USING_CONSOLE
+CONSOLE_CMD(tm, telemetryCmd);
+#endif
+
+static int telemetryList(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size);
+static int telemetryRpcSubscribe(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size);
+
+void telemetryInit(uint32_t msg) {
+	tmGroup = taskGroupCreate("TM");
+	if (!tmGroup) printf("TM: no free task group\n");
+	rpcRegister(RPC_TM_LIST, &telemetryList);
+	rpcRegister(RPC_TM_SUBSCRIBE, &telemetryRpcSubscribe);
+}
+
+int telemetryRegister(const char* name, volatile void* addr, uint8_t type) {
+	if (tmVarCount >= TELEMETRY_VAR_LIMIT) return -1;
+
+	tmVars[tmVarCount].name = name;
+	tmVars[tmVarCount].addr = addr;
+	tmVars[tmVarCount].type = type;
+	return tmVarCount++;
+}
+
+static void telemetryClose(void) {
+	tmReady[tmFill] = 1;
+	tmFill ^= 1;
+}
+
+void telemetrySample(void) {
+	tmFrame* f = &tmFrames[tmFill];
+	uint8_t* dst;
+
+	if (!tmActive) return;
+	if (tmReady[tmFill]) {
+		tmOverruns++; // sender is behind, both frames are waiting
+		return;
+	}
+	if (!f->len) {
+		uint32_t t0 = usTimerRead();
+		f->data[0] = tmGen;
+		f->data[1] = 0;
+		memcpy(&f->data[2], &t0, 4);
+		f->len = TELEMETRY_HEADER_SIZE;
+		tmFrameTick = uwTick;
+	}
+
+	// one load per variable, a value changed by an interrupt is never torn
+	dst = &f->data[f->len];
+	for (uint8_t i = 0; i < tmSubCount; i++) {
+		switch (tmSub[i].size) {
+		case 1: *dst = *(volatile uint8_t*)tmSub[i].addr; break;
+		case 2: { uint16_t v = *(volatile uint16_t*)tmSub[i].addr; memcpy(dst, &v, 2); break; }
+		default: { uint32_t v = *(volatile uint32_t*)tmSub[i].addr; memcpy(dst, &v, 4); break; }
+		}
+		dst += tmSub[i].size;
+	}
+	f->len += tmRecord;
+	tmSamples++;
+	if (++f->data[1] == tmPerFrame) telemetryClose();
+}
+
+void telemetrySampler(uint32_t param) {
+	telemetrySample();
+
+	// slow rates: do not hold samples back
+	if (tmFrames[tmFill].len && !tmReady[tmFill] && uwTick - tmFrameTick >= TELEMETRY_LATENCY) telemetryClose();
+}
+
+// pushes full frames, older first
+void telemetrySender(uint32_t param) {
+	uint8_t first = tmFill;
+
+	for (uint8_t n = 0; n < 2; n++) {
+		uint8_t i = first ^ n;
+		if (!tmReady[i]) continue;
+
+		int r = rpcPush(tmLink, RPC_TM_DATA, tmSeq, tmFrames[i].data, tmFrames[i].len);
+		if (r == 0) {
+			tmBusy++; // link busy, retry on next pass
+			return;
+		}
+		if (r < 0) tmLost++;
+		else tmSent++;
+		tmSeq++;
+		tmFrames[i].len = 0;
+		tmReady[i] = 0;
+	}
+}
+
+void telemetryStop(void) {
+	tmActive = 0;
+	// the scheduler may still point at them, cancelled tasks are freed by kernel_process
+	taskGroupCancel(tmGroup);
+}
+
+int telemetrySubscribe(struct rpcLink* link, uint16_t rate, const uint8_t* vars, uint8_t count) {
+	uint16_t record = 0;
+
+	if (!tmGroup || !link || !count || count > TELEMETRY_SUB_LIMIT || rate > ST_SEC) return -1;
+	for (uint8_t i = 0; i < count; i++) {
+		if (vars[i] >= tmVarCount) return -1;
+		record += TM_SIZE(tmVars[vars[i]].type);
+	}
+	if (record > RPC_PAYLOAD_SIZE - TELEMETRY_HEADER_SIZE) return -1;
+
+	telemetryStop();
+	for (uint8_t i = 0; i < count; i++) {
+		tmSub[i].addr = tmVars[vars[i]].addr;
+		tmSub[i].size = TM_SIZE(tmVars[vars[i]].type);
+	}
+	tmSubCount = count;
+	tmRecord = record;
+	tmPerFrame = (RPC_PAYLOAD_SIZE - TELEMETRY_HEADER_SIZE) / record;
+	tmLink = link;
+	tmRate = rate;
+	tmGen++;
+	tmFill = 0;
+	tmFrames[0].len = tmFrames[1].len = 0;
+	tmReady[0] = tmReady[1] = 0;
+	tmSamples = tmSent = tmOverruns = tmBusy = tmLost = 0;
+	tmSince = uwTick;
+
+	tTask* send = repeatGroup(tmGroup, "TM_SEND", TELEMETRY_SEND_RATE, &telemetrySender);
+	send->timeout = 1000 * ST_SS;
+	send->realtime_fail = ST_SEC;
+	if (rate) {
+		tTask* smp = repeatGroup(tmGroup, "TM_SMP", ST_SEC / rate, &telemetrySampler);
+		smp->realtime_fail = ST_SEC;
+	}
+	tmActive = 1;
+	return record;
+}
+
+// req: first index. resp: total, then type:1 len:1 name per variable while they fit
+static int telemetryList(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size) {
+	uint8_t i = len ? req[0] : 0;
+	uint16_t n = 1;
+
+	resp[0] = tmVarCount;
+	for (; i < tmVarCount; i++) {
+		uint8_t l = strlen(tmVars[i].name);
+		if (n + 2 + l > size) break;
+		resp[n++] = tmVars[i].type;
+		resp[n++] = l;
+		memcpy(&resp[n], tmVars[i].name, l);
+		n += l;
+	}
+	return n;
+}
+
+// req: rate:2 then variable indexes, no indexes stops. resp: gen:1 record:2 per frame:1 period us:4
+static int telemetryRpcSubscribe(const uint8_t* req, uint16_t len, uint8_t* resp, uint16_t size) {
+	uint16_t rate;
+	uint32_t period;
+	int record;
+
+	if (len < 2) return -1;
+	if (len == 2) {
+		telemetryStop();
+		return 0;
+	}
+	rate = req[0] | (req[1] << 8);
+	record = telemetrySubscribe(rpcCaller(), rate, req + 2, len - 2);
+	if (record < 0) return -1;
+
+	period = rate ? (ST_SEC / rate) * 1000 : 0; // task runs in whole ms
+	resp[0] = tmGen;
+	resp[1] = record & 0xFF;
+	resp[2] = record >> 8;
+	resp[3] = tmPerFrame;
+	memcpy(&resp[4], &period, 4);
+	return 8;
+}
+
+static int telemetryFind(const char* name) {
+	for (uint8_t i = 0; i < tmVarCount; i++)
+		if (strcmp(tmVars[i].name, name) == 0) return i;
+	return -1;
+}
+
+static void telemetryPrintValue(const tmVar* v) {
+	switch (v->type) {
+	case TM_U8:  printf("%u", *(volatile uint8_t*)v->addr); break;
+	case TM_I8:  printf("%d", *(volatile int8_t*)v->addr); break;
+	case TM_U16: printf("%u", *(volatile uint16_t*)v->addr); break;
+	case TM_I16: printf("%d", *(volatile int16_t*)v->addr); break;
+	case TM_U32: printf("%lu", (unsigned long)*(volatile uint32_t*)v->addr); break;
+	case TM_I32: printf("%ld", (long)*(volatile int32_t*)v->addr); break;
+	case TM_FLOAT: {
+		// no float printf, three decimals
+		float f = *(volatile float*)v->addr;
+		long m = (long)(f * 1000);
+		printf("%s%ld.%03ld", m < 0 ? "-" : "", labs(m) / 1000, labs(m) % 1000);
+		break;
+	}
+	}
+}
+
+// tm                          variables and stream stats
+// tm <link> <Hz> <var> ...    subscribe, Hz 0 - sampled by telemetrySample()
+// tm off
+int telemetryCmd(char* args) {
+	char linkName[12];
+	uint8_t vars[TELEMETRY_SUB_LIMIT];
+	uint8_t count = 0;
+	unsigned int rate;
+	int n;
+
+	if (args && strcmp(args, "off") == 0) {
+		telemetryStop();
+		return 0;
+	}
+	if (args && sscanf(args, "%11s %u%n", linkName, &rate, &n) == 2) {
+		rpcLink* link = rpcLinkFind(linkName);
+		char* name = strtok(args + n, " ");
+
+		for (; name && count < TELEMETRY_SUB_LIMIT; name = strtok(NULL, " ")) {
+			int v = telemetryFind(name);
+			if (v < 0) {
+				printf("no variable %s\n", name);
+				return 0;
+			}
+			vars[count++] = v;
+		}
+		if (!link) printf("no rpc link %s\n", linkName);
+		else if (telemetrySubscribe(link, rate, vars, count) < 0) printf("can't subscribe\n");
+		return 0;
+	}
+
+	for (uint8_t i = 0; i < tmVarCount; i++) {
+		printf(" %2u %-12s ", i, tmVars[i].name);
+		telemetryPrintValue(&tmVars[i]);
+		printf("\n");
+	}
+	if (!tmActive) {
+		printf("not streaming\n");
+		return 0;
+	}
+
+	uint32_t elapsed = uwTick - tmSince;
+	printf("streaming %u vars to %s at %u Hz, %u byte records, %u per frame\n",
+			tmSubCount, tmLink->name, tmRate, tmRecord, tmPerFrame);
+	printf(" samples %lu (%lu/s), frames %lu, overruns %lu, link busy %lu, lost %lu\n",
+			(unsigned long)tmSamples, (unsigned long)(elapsed ? (uint64_t)tmSamples * ST_SEC / elapsed : 0),
+			(unsigned long)tmSent, (unsigned long)tmOverruns, (unsigned long)tmBusy, (unsigned long)tmLost);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * telemetry.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: Ivars Renge
+ *
+ *	Streams registered variables to the host as binary frames, for watching control loops.
+ *
+ *	1. Define USING_TELEMETRY (turns on USING_RPC, frames travel on the rpc channel)
+ *	2. Register variables once:
+ *	     telemetryRegister("speed", &speed, TM_FLOAT);
+ *	3. Host subscribes to a set and a rate (tools/telemetry.py), or from the console:
+ *	     tm usb 1000 speed current duty       // link, Hz (up to 1000), variables
+ *	     tm off
+ *	   Rate 0 samples on every telemetrySample() call instead, e.g. from the control loop interrupt.
+ *
+ *	Frame (RPC_TM_DATA payload): gen:1 count:1 t0_us:4, then count records of the subscribed
+ *	variables packed in subscription order, little endian. Samples are rate apart, rpc seq
+ *	counts frames so the host sees losses. Overhead is 15 bytes per frame, not per sample.
+ *
+ *	Max sample rate for 12 float variables (48 byte records, 3 per frame, 159 bytes on the wire):
+ *	     UART 115200      217 Hz
+ *	     UART 921600     1738 Hz
+ *	     USB CDC FS      ~1000 Hz sampled by the task, more with telemetrySample()
+ *	Fewer variables pack more records per frame, see `tm` for achieved rate and drops.
+ */
+
+#ifndef SYS_TELEMETRY_H_
+#define SYS_TELEMETRY_H_
+
+#include "core.h"
+
+#ifdef USING_TELEMETRY
+
+	#define TELEMETRY_VAR_LIMIT 	32
+	#define TELEMETRY_SUB_LIMIT 	16 // variables in one subscription
+	#define TELEMETRY_HEADER_SIZE 	6
+	#define TELEMETRY_SEND_RATE 	ST_MS
+
+	// variable types, size in low nibble
+	enum {
+		TM_U8    = 0x01,
+		TM_I8    = 0x11,
+		TM_U16   = 0x02,
+		TM_I16   = 0x12,
+		TM_U32   = 0x04,
+		TM_I32   = 0x14,
+		TM_FLOAT = 0x24
+	};
+
+	#define TM_SIZE(type) ((type) & 0x0F)
+
+	struct rpcLink; // rpc.h may come later in core.h
+
+	typedef struct tmVar {
+		const char*    name;
+		volatile void* addr;
+		uint8_t        type;
+	} tmVar;
+
+	void telemetryInit(uint32_t);
+
+	// returns variable index or -1 when the table is full
+	int  telemetryRegister(const char* name, volatile void* addr, uint8_t type);
+
+	// stream vars (indexes) to link, rate in Hz, 0 - on telemetrySample() calls. Returns record size or -1
+	int  telemetrySubscribe(struct rpcLink* link, uint16_t rate, const uint8_t* vars, uint8_t count);
+	void telemetryStop(void);
+
+	// take one sample now, safe from an interrupt
+	void telemetrySample(void);
+
+	void telemetrySampler(uint32_t);
+	void telemetrySender(uint32_t);
+	int telemetryCmd(char* args);
+
+#endif
+
+#endif /* SYS_TELEMETRY_H_ */
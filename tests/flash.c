@@ -0,0 +1,73 @@
+/*
+ * flash.c
+ *
+ *	F3 internal flash model, see flash.h
+ */
+
+#include "main.h"
+#include "host.h"
+#include "flash.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+uint32_t flashPrograms;
+uint32_t* flashErases;
+void (*flashOnProgram)(uint32_t addr);
+void (*flashOnErase)(uint32_t addr);
+
+int flashOpen(const char* file, uint32_t kb) {
+	uint32_t size = kb * 1024;
+	int fd = -1, flags = MAP_FIXED | (file ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS);
+	uint8_t* sys;
+
+	if (file) {
+		fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0 || ftruncate(fd, size)) return 1;
+	}
+	if (mmap((void*)FLASH_BASE, size, PROT_READ | PROT_WRITE, flags, fd, 0) == MAP_FAILED) return 1;
+	if (fd >= 0) close(fd);
+	memset((void*)FLASH_BASE, 0xFF, size);
+
+	// system memory page holding the flash size in KB
+	sys = mmap((void*)(FLASHSIZE_BASE & ~0xFFFu), 4096, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	if (sys == MAP_FAILED) return 1;
+	*(uint16_t*)(uintptr_t)FLASHSIZE_BASE = kb;
+
+	free(flashErases);
+	flashErases = calloc(size / FLASH_PAGE_SIZE, sizeof(uint32_t));
+	flashPrograms = 0;
+	return 0;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) { return HAL_OK; }
+HAL_StatusTypeDef HAL_FLASH_Lock(void) { return HAL_OK; }
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t addr, uint64_t data) {
+	if (flashOnProgram) flashOnProgram(addr);
+	if (type == FLASH_TYPEPROGRAM_HALFWORD) {
+		*(uint16_t*)(uintptr_t)addr &= (uint16_t)data;
+		flashPrograms++;
+		hostAdvance(FLASH_PROGRAM_US);
+	} else {
+		*(uint32_t*)(uintptr_t)addr &= (uint32_t)data;
+		flashPrograms += 2;
+		hostAdvance(2 * FLASH_PROGRAM_US);
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* erase, uint32_t* error) {
+	for (uint32_t p = 0; p < erase->NbPages; p++) {
+		uint32_t addr = erase->PageAddress + p * FLASH_PAGE_SIZE;
+		if (flashOnErase) flashOnErase(addr);
+		memset((void*)(uintptr_t)addr, 0xFF, FLASH_PAGE_SIZE);
+		flashErases[(addr - FLASH_BASE) / FLASH_PAGE_SIZE]++;
+		hostAdvance(FLASH_ERASE_US);
+	}
+	*error = 0xFFFFFFFF;
+	return HAL_OK;
+}
@@ -0,0 +1,25 @@
+/*
+ * flash.h
+ *
+ *	Internal flash for the host tests: mapped at FLASH_BASE with the flash size word at
+ *	FLASHSIZE_BASE, so filesystem.c runs unchanged. The HAL calls program and erase like the
+ *	F3 does (bits only go 1 -> 0, 2 KB pages) and move hostUs by the F3 times.
+ */
+
+#ifndef TESTS_FLASH_H_
+#define TESTS_FLASH_H_
+
+#include <stdint.h>
+
+#define FLASH_PROGRAM_US  52    // per half word, a word is two
+#define FLASH_ERASE_US    20000 // per page
+
+extern uint32_t flashPrograms;            // half words
+extern uint32_t* flashErases;             // per page from FLASH_BASE
+extern void (*flashOnProgram)(uint32_t addr); // before each program, power loss tests
+extern void (*flashOnErase)(uint32_t addr);   // before each page erase
+
+// maps kb of erased flash, backed by file when given (left for a look with xxd), anonymous otherwise
+int flashOpen(const char* file, uint32_t kb);
+
+#endif /* TESTS_FLASH_H_ */
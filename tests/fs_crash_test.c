@@ -0,0 +1,144 @@
+/*
+ * fs_crash_test.c
+ *
+ *	Power loss while the filesystem gc moves and erases: before every flash program the gc
+ *	makes (every 13th of them), a forked child takes the flash as it is at that moment, mounts it twice and checks
+ *	that every file reads back, deleted files stay deleted, no chain runs through a deleted
+ *	chunk and no page lost its erase count. Built twice, with extents and with chains only
+ *	(FS_EXTENTS=0), where files share tails with the copies the gc leaves behind.
+ */
+
+#include "filesystem.c"
+#include "host.h"
+#include "flash.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FLASH_KB    256
+#define NF          600
+#define OPS         8000
+#define SAMPLE_FROM 3000 // volume is full and the gc busy by then
+#define SAMPLE_EVERY 13  // every program would take a minute, a prime stride still lands on each gc step
+
+static int sizes[NF], gens[NF];
+static uint32_t erasedAt[FLASH_KB * 1024 / FLASH_PAGE_SIZE]; // header count before the last erase
+static uint8_t sampling;
+static long programs, samples, badRuns;
+
+static void fill(char* b, int i, int size) {
+	for (int k = 0; k < size; k++) b[k] = (char)(i * 7 + gens[i] * 13 + k);
+}
+
+static int checkFiles(void) {
+	char name[16], a[1024], b[1025];
+	int bad = 0;
+
+	for (int i = 0; i < NF; i++) {
+		const FsChunk* c;
+
+		sprintf(name, "f%d", i);
+		if (!sizes[i]) {
+			if (fsFind(name)) {
+				fprintf(stderr, "  %s deleted but found\n", name);
+				bad++;
+			}
+			continue;
+		}
+		fill(a, i, sizes[i]);
+		if (fsRead(name, b, sizeof(b)) || memcmp(a, b, sizes[i])) {
+			fprintf(stderr, "  %s reads wrong\n", name);
+			bad++;
+			continue;
+		}
+		// a chain goes through live chunks only, a deleted one is erased by the next gc of its page
+		c = (const FsChunk*)(uintptr_t)fsFind(name);
+		if ((c->type & 0x0F) != FS_TYPE_FILE_HEAD) continue;
+		for (; c; c = c->link == FS_INVALID_ADDR ? NULL : (const FsChunk*)(uintptr_t)c->link)
+			if (c->notDeleted != 0xFF) {
+				fprintf(stderr, "  %s runs through a deleted chunk\n", name);
+				bad++;
+				break;
+			}
+	}
+	return bad;
+}
+
+static int checkPages(void) {
+	int bad = 0;
+
+	for (uint32_t p = 0; p < fsPages; p++) {
+		const FsChunk* h = (const FsChunk*)(uintptr_t)FS_PAGE_ADDR(p);
+		uint32_t n;
+
+		memcpy(&n, h->data, 4);
+		if ((h->type & 0x0F) != FS_TYPE_PAGE || n < erasedAt[(FS_PAGE_ADDR(p) - FLASH_BASE) / FLASH_PAGE_SIZE]) {
+			fprintf(stderr, "  page %lu lost its erase count\n", (unsigned long)p);
+			bad++;
+		}
+	}
+	return bad;
+}
+
+// power goes before this program, the child boots from what is on flash
+static void powerLoss(uint32_t addr) {
+	pid_t pid;
+	int status, bad;
+
+	if (!sampling || programs++ % SAMPLE_EVERY) return;
+	samples++;
+	pid = fork();
+	if (!pid) {
+		flashOnProgram = NULL;
+		if (!freopen("/dev/null", "w", stdout)) _exit(2);
+		fsInit();
+		bad = checkFiles() + checkPages();
+		fsInit(); // and once more, mount must not leave anything for the next one
+		bad += checkFiles();
+		_exit(bad ? 1 : 0);
+	}
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "  power loss %ld, before programming %lx\n", samples, (unsigned long)addr);
+		badRuns++;
+	}
+}
+
+static void pageErased(uint32_t addr) {
+	const FsChunk* h = (const FsChunk*)(uintptr_t)addr;
+	if ((h->type & 0x0F) == FS_TYPE_PAGE) memcpy(&erasedAt[(addr - FLASH_BASE) / FLASH_PAGE_SIZE], h->data, 4);
+}
+
+int main(void) {
+	char name[16], data[1024];
+
+	setvbuf(stdout, NULL, _IONBF, 0);
+	if (flashOpen(NULL, FLASH_KB)) return 1; // private, so every child gets its own copy
+	flashOnProgram = &powerLoss;
+	flashOnErase = &pageErased;
+	fsInit();
+	srand(1);
+
+	for (int ops = 0; ops < OPS; ops++) {
+		int i = rand() % NF;
+		sprintf(name, "f%d", i);
+		if (sizes[i] && rand() % 2) {
+			fsDelete(name);
+			sizes[i] = 0;
+		} else {
+			int size = rand() % 4 == 0 ? 200 + rand() % 824 : 1 + rand() % 100;
+			gens[i]++;
+			fill(data, i, size);
+			if (fsWriteBinary(name, data, size)) {
+				sizes[i] = 0;
+				fsDelete(name);
+			} else sizes[i] = size;
+		}
+		// gc writes only, a file write cut short is left for the next mount to drop
+		sampling = ops >= SAMPLE_FROM;
+		for (int k = 0; k < 3; k++) fsMaintain(0);
+		sampling = 0;
+	}
+	printf("  %s: %ld power losses in gc, %ld with bad files after remount\n",
+			FS_EXTENTS ? "extents" : "chains", samples, badRuns);
+	return badRuns != 0;
+}
@@ -0,0 +1,333 @@
+/*
+ * fs_test.c
+ *
+ *	filesystem.c on the F3 flash model (flash.h), 256 KB part, backed by fs_test.bin.
+ *	find:    lookup and mount time vs file count, overwrite and delete found right after remount
+ *	write:   1 KB files and a fill of the volume with 100 byte files, flash and host time per
+ *	         file, space used per payload byte, read MB/s
+ *	churn:   random writes and deletes of 600 files far past the volume size with the gc task
+ *	         running, remounts in the middle of gc, every file checked, no gc slice over FS_GC_SLICE
+ *	upgrade: volume written before page headers, the gc takes it over and collects dead pages
+ *	wear:    static data next to rewritten config until a page reaches WEAR_LIMIT erases,
+ *	         config writes per erase and the erase count spread
+ */
+
+#include "filesystem.c"
+#include "host.h"
+#include "flash.h"
+
+#define FLASH_KB    256
+#define FLASH_FILE  "fs_test.bin"
+#define WEAR_LIMIT  200
+
+static uint32_t nextGc;
+
+// application time between file operations, the gc task runs on its period
+static void appTime(uint32_t us) {
+	hostAdvance(us);
+	while ((int32_t)(hostUs - nextGc) >= 0) {
+		nextGc = hostUs + FS_GC_PERIOD * 1000;
+		fsMaintain(0);
+	}
+}
+
+static int volume(void) {
+	if (flashOpen(FLASH_FILE, FLASH_KB)) {
+		printf("FAIL can not map flash at %x\n", FLASH_BASE);
+		return 1;
+	}
+	hostUs = uwTick = nextGc = 0;
+	fsInit();
+	return 0;
+}
+
+// ---- find ----
+
+static int testFind(void) {
+	static const int counts[] = { 1, 10, 100, 1000 };
+	char name[32], buf[64], expect[64];
+	int have = 0;
+
+	if (volume()) return 1;
+	for (int k = 0; k < 4; k++) {
+		volatile int found = 0;
+		uint64_t t;
+		int reps = 20000 / counts[k] + 50;
+
+		for (; have < counts[k]; have++) {
+			sprintf(name, "cfg%d", have);
+			sprintf(buf, "v%d", have);
+			CHECK(fsWrite(name, buf) == 0);
+		}
+		t = hostNs();
+		fsInit();
+		uint64_t mount = hostNs() - t;
+
+		t = hostNs();
+		for (int r = 0; r < reps; r++) {
+			sprintf(name, "cfg%d", r % have);
+			found += fsFind(name) != 0;
+		}
+		uint64_t hit = (hostNs() - t) / reps;
+		t = hostNs();
+		for (int r = 0; r < reps; r++) found += fsFind("missing") != 0;
+		uint64_t miss = (hostNs() - t) / reps;
+
+		printf("  %4d files: find %5lu ns, miss %5lu ns, mount %6lu us\n", have, (unsigned long)hit,
+				(unsigned long)miss, (unsigned long)(mount / 1000));
+		CHECK(found == reps);
+	}
+
+	CHECK(fsWrite("cfg5", "a longer value spanning two data chunks ok") == 0);
+	CHECK(fsSize("cfg5") == 43);
+	for (int i = 0; i < have; i += 3) {
+		sprintf(name, "cfg%d", i);
+		CHECK(fsDelete(name) == 0);
+	}
+	fsInit();
+	for (int i = 0; i < have; i++) {
+		sprintf(name, "cfg%d", i);
+		if (i % 3 == 0) {
+			CHECK(!fsFind(name));
+			continue;
+		}
+		if (i == 5) strcpy(expect, "a longer value spanning two data chunks ok");
+		else sprintf(expect, "v%d", i);
+		CHECK(fsRead(name, buf, sizeof(buf)) == 0 && strncmp(buf, expect, strlen(expect)) == 0);
+	}
+	return 0;
+}
+
+// ---- write ----
+
+static int testWrite(void) {
+	static char data[1024], back[1025];
+	char name[32];
+	int n = 20, files = 0, bad = 0;
+	uint32_t us;
+	uint64_t t;
+
+	if (volume()) return 1;
+	for (int i = 0; i < (int)sizeof(data); i++) data[i] = 'a' + i % 26;
+
+	us = hostUs;
+	t = hostNs();
+	for (int i = 0; i < n; i++) {
+		sprintf(name, "big%d", i);
+		CHECK(fsWriteBinary(name, data, 1024) == 0);
+	}
+	printf("  1 KB files: %lu ms flash, %lu us host each\n", (unsigned long)((hostUs - us) / n / 1000),
+			(unsigned long)((hostNs() - t) / n / 1000));
+
+	t = hostNs();
+	for (int r = 0; r < 50; r++)
+		for (int i = 0; i < n; i++) {
+			sprintf(name, "big%d", i);
+			CHECK(fsRead(name, back, sizeof(back)) == 0 && memcmp(back, data, 1024) == 0);
+		}
+	printf("  read: %lu MB/s host\n", (unsigned long)(50ull * n * 1024 * 1000 / (hostNs() - t)));
+
+	us = hostUs;
+	t = hostNs();
+	for (;; files++) {
+		sprintf(name, "f%d", files);
+		if (fsWriteBinary(name, data, 100)) break;
+	}
+	CHECK(files > 0);
+	uint32_t payload = n * 1024 + files * 100, space = FS_END_ADDR - FS_START_ADDR;
+	printf("  fill: %d x 100 B files, %lu ms flash, %lu us host each, %lu%% of the volume is payload\n", files,
+			(unsigned long)((hostUs - us) / files / 1000), (unsigned long)((hostNs() - t) / files / 1000),
+			(unsigned long)((uint64_t)payload * 100 / space));
+
+	fsInit();
+	for (int i = 0; i < files; i++) {
+		sprintf(name, "f%d", i);
+		if (fsRead(name, back, sizeof(back)) || memcmp(back, data, 100)) bad++;
+	}
+	CHECK(bad == 0);
+	return 0;
+}
+
+// ---- churn ----
+
+#define NF 600
+static int sizes[NF], gens[NF];
+
+static void fill(char* b, int i, int gen, int size) {
+	for (int k = 0; k < size; k++) b[k] = (char)(i * 7 + gen * 13 + k);
+}
+
+static int checkFiles(void) {
+	char name[16], a[1024], b[1025];
+	int bad = 0;
+
+	for (int i = 0; i < NF; i++) {
+		sprintf(name, "f%d", i);
+		if (!sizes[i]) {
+			bad += fsFind(name) != 0;
+			continue;
+		}
+		fill(a, i, gens[i], sizes[i]);
+		if (fsRead(name, b, sizeof(b)) || memcmp(a, b, sizes[i])) bad++;
+	}
+	return bad;
+}
+
+static int testChurn(void) {
+	char name[16], data[1024];
+	long written = 0, fails = 0;
+	int bad = 0;
+
+	if (volume()) return 1;
+	memset(sizes, 0, sizeof(sizes));
+	srand(1);
+	for (int ops = 1; ops <= 40000; ops++) {
+		int i = rand() % NF;
+		sprintf(name, "f%d", i);
+		if (sizes[i] && rand() % 2) {
+			fsDelete(name);
+			sizes[i] = 0;
+		} else {
+			int size = rand() % 4 == 0 ? 200 + rand() % 824 : 1 + rand() % 100;
+			fill(data, i, ++gens[i], size);
+			if (fsWriteBinary(name, data, size)) {
+				fails++;
+				sizes[i] = 0;
+				fsDelete(name);
+			} else {
+				sizes[i] = size;
+				written += size;
+			}
+		}
+		appTime(2000);
+		if (ops % 4000 == 0) {
+			// reset somewhere in a gc pass
+			for (int k = rand() % 40; k >= 0; k--) fsMaintain(0);
+			fsInit();
+			bad += checkFiles();
+		}
+	}
+	printf("  churn: 40000 ops, %ld KB into a %lu KB volume, %ld failed writes, %d bad\n", written / 1024,
+			(unsigned long)((FS_END_ADDR - FS_START_ADDR) / 1024), fails, bad + checkFiles());
+	fsGcCmd("");
+	CHECK(fails == 0 && bad == 0 && checkFiles() == 0);
+	CHECK(fsGc.sliceMax <= FS_GC_SLICE);
+	return 0;
+}
+
+// ---- upgrade ----
+
+static int testUpgrade(void) {
+	char name[16];
+	int files = 0, v;
+
+	if (volume()) return 1;
+	// old format: one chunk files back to back from the first chunk, every other one deleted
+	for (uint32_t a = FS_START_ADDR; a + 2 * sizeof(FsChunk) <= FS_START_ADDR + 10 * FLASH_PAGE_SIZE;
+			a += 2 * sizeof(FsChunk), files++) {
+		FsChunk* h = (FsChunk*)(uintptr_t)a;
+		FsChunk* d = h + 1;
+		memset(h, 0xFF, 2 * sizeof(FsChunk));
+		h->type = FS_TYPE_FILE_HEAD;
+		h->reserved1 = 4;
+		h->reserved2 = 0;
+		h->link = a + sizeof(FsChunk);
+		sprintf((char*)h->data, "old%d", files);
+		d->type = FS_TYPE_FILE_DATA;
+		memcpy(d->data, &files, 4);
+		if (files % 2 == 0 || files >= 256) h->notDeleted = d->notDeleted = 0; // pages 8, 9 all dead
+	}
+	fsInit();
+	fsGcCmd("run");
+	for (int k = 0; k < 5000; k++) fsMaintain(0);
+	for (int i = 0; i < files; i++) {
+		sprintf(name, "old%d", i);
+		if (i % 2 == 0 || i >= 256) {
+			CHECK(!fsFind(name));
+			continue;
+		}
+		CHECK(fsRead(name, (char*)&v, 4) == 0 && v == i);
+	}
+	for (uint32_t p = 0; p < fsPages; p++) {
+		const FsChunk* h = (const FsChunk*)(uintptr_t)FS_PAGE_ADDR(p);
+		CHECK((h->type & 0x0F) == FS_TYPE_PAGE);
+	}
+	CHECK(fsPageDead[8] == 0 && fsPageDead[9] == 0);
+	printf("  upgrade: %d files without page headers, every page has one, dead pages collected\n", files);
+	return 0;
+}
+
+// ---- wear ----
+
+#define NS 80 // static 1000 byte files, ~40% of the volume
+#define NC 8  // config files rewritten
+
+static int checkWear(void) {
+	char name[16], a[1024], b[1025];
+	int bad = 0;
+
+	for (int i = 0; i < NS; i++) {
+		sprintf(name, "s%d", i);
+		fill(a, i, 0, 1000);
+		if (fsRead(name, b, sizeof(b)) || memcmp(a, b, 1000)) bad++;
+	}
+	for (int i = 0; i < NC; i++) {
+		sprintf(name, "c%d", i);
+		fill(a, 100 + i, gens[i], sizes[i]);
+		if (fsRead(name, b, sizeof(b)) || memcmp(a, b, sizes[i])) bad++;
+	}
+	return bad;
+}
+
+static int testWear(void) {
+	char name[16], data[1024];
+	uint32_t first, pages, min = ~0u, max = 0;
+	uint64_t sum = 0;
+	long writes = 0, fails = 0;
+
+	if (volume()) return 1;
+	first = FS_START_PAGE_INDEX;
+	pages = (FS_END_ADDR - FS_START_ADDR) / FLASH_PAGE_SIZE;
+	memset(sizes, 0, sizeof(sizes));
+	memset(gens, 0, sizeof(gens));
+	srand(1);
+	for (int i = 0; i < NS; i++) {
+		sprintf(name, "s%d", i);
+		fill(data, i, 0, 1000);
+		CHECK(fsWriteBinary(name, data, 1000) == 0);
+	}
+	while (max < WEAR_LIMIT) {
+		int i = rand() % NC, size = 20 + rand() % 180;
+		sprintf(name, "c%d", i);
+		fill(data, 100 + i, ++gens[i], size);
+		if (fsWriteBinary(name, data, size)) {
+			fails++;
+			gens[i]--;
+		} else sizes[i] = size;
+		writes++;
+		appTime(2000);
+		for (uint32_t p = first; p < first + pages; p++)
+			if (flashErases[p] > max) max = flashErases[p];
+	}
+	for (uint32_t p = first; p < first + pages; p++) {
+		if (flashErases[p] < min) min = flashErases[p];
+		sum += flashErases[p];
+	}
+	printf("  wear: first page at %d erases after %ld config writes (%ld per erase), erases min %lu avg %lu max %lu\n",
+			WEAR_LIMIT, writes, writes / WEAR_LIMIT, (unsigned long)min, (unsigned long)(sum / pages),
+			(unsigned long)max);
+	fsWearCmd("");
+	CHECK(fails == 0 && checkWear() == 0);
+	CHECK(min * 10 >= max * 8); // static data moved off cold pages too
+	CHECK(fsGc.sliceMax <= FS_GC_SLICE);
+	fsInit();
+	CHECK(checkWear() == 0);
+	return 0;
+}
+
+int main(void) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	if (testFind() || testWrite() || testChurn() || testUpgrade() || testWear()) return 1;
+	printf("fs ok\n");
+	return 0;
+}
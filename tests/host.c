@@ -0,0 +1,63 @@
+/*
+ * host.c
+ *
+ *	Weak stand-ins for the scheduler, core and HAL calls of the drivers. A test defines its own
+ *	version of any of them to watch or model it, the rest do nothing.
+ */
+
+#include "main.h"
+#include "core.h"
+#include "host.h"
+
+uint32_t hostUs;
+void (*hostIdle)(void);
+uint32_t hostInIrq;
+__attribute__((weak)) char* cmd; // console, line being executed, core.c has the real one
+
+volatile uint32_t uwTick;
+uint32_t SystemCoreClock = 72000000;
+GPIO_TypeDef *GPIOA, *GPIOB, *GPIOC, *GPIOD, *GPIOE;
+UART_HandleTypeDef huart1, huart2, huart3;
+DMA_HandleTypeDef hdma_usart1_tx, hdma_usart1_rx;
+
+void hostAdvance(uint32_t us) {
+	uint32_t ms = hostUs / 1000;
+	hostUs += us;
+	uwTick += hostUs / 1000 - ms;
+}
+
+// scheduler: tasks are not run, the tests call the task functions themselves
+__attribute__((weak)) tTask* taskSchedule(char* name, int after, int type, void (*callback)(uint32_t)) {
+	static tTask task;
+	task.callback = callback;
+	return &task;
+}
+__attribute__((weak)) uint32_t taskExists(void (*callback)(uint32_t)) { return 0; }
+__attribute__((weak)) void kernel_process(int depth) { if (hostIdle) hostIdle(); }
+__attribute__((weak)) uint32_t usTimerRead(void) { return hostUs; }
+__attribute__((weak)) uint8_t cmdQueue(const char* line) { return 1; }
+__attribute__((weak)) void moduleReady(uint32_t id) {}
+__attribute__((weak)) uint32_t moduleIsReady(uint32_t id) { return 1; }
+
+// single core, no interrupts unless the test plays one
+__attribute__((weak)) void __disable_irq(void) {}
+__attribute__((weak)) void __enable_irq(void) {}
+__attribute__((weak)) uint32_t __get_PRIMASK(void) { return 0; }
+__attribute__((weak)) void __set_PRIMASK(uint32_t primask) {}
+__attribute__((weak)) uint32_t __get_IPSR(void) { return hostInIrq; }
+__attribute__((weak)) void __DMB(void) {}
+
+__attribute__((weak)) void HAL_GPIO_Init(GPIO_TypeDef* port, GPIO_InitTypeDef* init) {}
+__attribute__((weak)) void HAL_GPIO_WritePin(GPIO_TypeDef* port, uint16_t pin, int state) {}
+__attribute__((weak)) void HAL_Delay(uint32_t ms) { hostAdvance(ms * 1000); }
+
+__attribute__((weak)) HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef* h, const uint8_t* d, uint16_t n) { return HAL_OK; }
+__attribute__((weak)) HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* h, const uint8_t* d, uint16_t n) { return HAL_OK; }
+__attribute__((weak)) HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef* h, uint8_t* d, uint16_t n) { return HAL_OK; }
+__attribute__((weak)) HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef* h, uint8_t* d, uint16_t n) { return HAL_OK; }
+__attribute__((weak)) HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef* h) { return HAL_OK; }
+
+#ifdef USING_CONSOLE
+__attribute__((weak)) void setTextColor(enum ConsoleColor color) {}
+__attribute__((weak)) void setBackgroundColor(enum ConsoleColor color) {}
+#endif
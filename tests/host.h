@@ -0,0 +1,31 @@
+/*
+ * host.h
+ *
+ *	Framework stand-ins for the host tests, see host.c. Time is simulated: hostUs only moves
+ *	when a test moves it, so rates and latencies come out the same on every machine.
+ */
+
+#ifndef TESTS_HOST_H_
+#define TESTS_HOST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); return 1; } } while (0)
+
+extern uint32_t hostUs;                // simulated microseconds, usTimerRead
+extern void (*hostIdle)(void);        // what runs while a driver parks in kernel_process
+extern uint32_t hostInIrq;            // __get_IPSR, set while a test plays an interrupt
+
+// moves time, uwTick follows every whole millisecond
+void hostAdvance(uint32_t us);
+
+// real time for cost measurements of driver code
+static inline uint64_t hostNs(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+#endif /* TESTS_HOST_H_ */
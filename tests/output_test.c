@@ -0,0 +1,146 @@
+/*
+ * output_test.c
+ *
+ *	output.c under a burst: a writer prints lines far faster than a slow sink (115200 baud) takes
+ *	them, next to a fast sink that takes everything. Per policy of the slow sink checks what it
+ *	gets (all, whole lines, marked cuts, the newest data), that drops are counted and that the fast
+ *	sink is never held back, and prints how long the writer waits per line.
+ */
+
+#include "output.c"
+#include "host.h"
+
+#define SLOW_BPS  11520 // 115200 baud, 8N1
+#define LINES     2000
+#define LINE_US   20    // writer time per line, about 2 MB/s
+
+static char fastOut[1 << 17], slowOut[1 << 17], written[1 << 17];
+static uint32_t fastLen, slowLen, writtenLen, slowTaken;
+
+static int fastWrite(const uint8_t* data, uint16_t len) {
+	memcpy(fastOut + fastLen, data, len);
+	fastLen += len;
+	return len;
+}
+
+// takes what the line rate allowed since the start
+static int slowWrite(const uint8_t* data, uint16_t len) {
+	uint32_t budget = (uint64_t)hostUs * SLOW_BPS / 1000000 - slowTaken;
+
+	if (len > budget) len = budget;
+	memcpy(slowOut + slowLen, data, len);
+	slowLen += len;
+	slowTaken += len;
+	return len;
+}
+
+// the scheduler runs for a while when the writer yields, the retry task included
+static void idle(void) {
+	hostAdvance(100);
+	outputProcessor(0);
+}
+
+// slow sink output made of whole lines and marked cuts only, returns the lines
+static int wholeLines(uint32_t* marks) {
+	int lines = 0;
+	char* q = slowOut;
+	char* end = slowOut + slowLen;
+
+	*marks = 0;
+	while (q < end) {
+		char* nl = memchr(q, '\n', end - q);
+		if (!nl) return -1;
+		if (nl[-1] == '~' && nl - q < 37) (*marks)++; // cut, mid line when the ring lapped it
+		else if (nl - q != 37 || memcmp(q, "line ", 5) || memcmp(nl - 3, "xyz", 3)) return -1;
+		else lines++;
+		q = nl + 1;
+	}
+	return lines;
+}
+
+static const char* const policyNames[] = { "oldest", "block", "newest", "trunc" };
+
+static int testBurst(uint8_t policy) {
+	outputSink* fast;
+	outputSink* slow;
+	uint32_t waitMax = 0, waitSum = 0, marks = 0;
+	char line[64];
+	int lines;
+
+	memset(outputSinks, 0, sizeof(outputSinks));
+	outputHead = 0;
+	hostUs = uwTick = 0;
+	fastLen = slowLen = writtenLen = slowTaken = 0;
+	fast = outputSinkAdd("fast", &fastWrite, OUT_DROP_OLDEST);
+	slow = outputSinkAdd("slow", &slowWrite, policy);
+	slow->limit = 512;
+
+	for (int i = 0; i < LINES; i++) {
+		int n = snprintf(line, sizeof(line), "line %05d abcdefghijklmnopqrstuvwxyz\n", i);
+		uint32_t t = hostUs;
+
+		memcpy(written + writtenLen, line, n + 1);
+		writtenLen += n;
+		outputWrite(line, n);
+		if (hostUs - t > waitMax) waitMax = hostUs - t;
+		waitSum += hostUs - t;
+		hostAdvance(LINE_US);
+		if (i % 50 == 0) outputProcessor(0); // the 1 ms retry task
+		CHECK(fastLen == writtenLen); // never held back by the slow one
+	}
+	while (slow->tail != outputHead) idle();
+
+	lines = wholeLines(&marks);
+	printf("  %-6s slow got %5lu of %lu bytes, %4lu dropped, %3lu cuts, %lu marks; writer wait %lu us/line, max %lu us\n",
+			policyNames[policy], (unsigned long)slowLen, (unsigned long)writtenLen, (unsigned long)slow->dropped,
+			(unsigned long)slow->truncated, (unsigned long)marks, (unsigned long)(waitSum / LINES), (unsigned long)waitMax);
+
+	CHECK(memcmp(fastOut, written, writtenLen) == 0 && fast->dropped == 0);
+	CHECK(slow->bytes + slow->dropped == writtenLen);
+	switch (policy) {
+	case OUT_BLOCK:
+		CHECK(slowLen == writtenLen && memcmp(slowOut, written, writtenLen) == 0);
+		CHECK(waitMax > 0 && waitMax < OUTPUT_BLOCK_TIMEOUT * 1000);
+		break;
+	case OUT_DROP_NEWEST: // marks only where the ring lapped what the sink had taken
+	case OUT_TRUNCATE:
+		CHECK(lines > 0 && slow->dropped > 0 && waitMax == 0);
+		CHECK(policy == OUT_DROP_NEWEST || marks > 0);
+		break;
+	case OUT_DROP_OLDEST: // newest data is what is left, cut anywhere
+		CHECK(slow->dropped > 0 && waitMax == 0);
+		CHECK(memcmp(slowOut + slowLen - 512, written + writtenLen - 512, 512) == 0);
+		break;
+	}
+	return 0;
+}
+
+// a blocking sink written from an interrupt drops instead of waiting
+static int testIrqNoBlock(void) {
+	outputSink* slow;
+	char line[600];
+
+	memset(outputSinks, 0, sizeof(outputSinks));
+	outputHead = 0;
+	hostUs = uwTick = 0;
+	slowLen = slowTaken = 0;
+	slow = outputSinkAdd("slow", &slowWrite, OUT_BLOCK);
+	slow->limit = 512;
+	memset(line, 'x', sizeof(line));
+
+	hostInIrq = 1;
+	for (int i = 0; i < 10; i++) outputWrite(line, sizeof(line));
+	hostInIrq = 0;
+	CHECK(hostUs == 0 && slow->dropped > 0);
+	return 0;
+}
+
+int main(void) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	hostIdle = &idle;
+	for (uint8_t p = OUT_DROP_OLDEST; p <= OUT_TRUNCATE; p++)
+		if (testBurst(p)) return 1;
+	if (testIrqNoBlock()) return 1;
+	printf("output ok\n");
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * ring_test.c
+ *
+ *	Host test of ring.h: random operations against a reference buffer, counters wrapping,
+ *	lines across spans, overlong lines, ringView, two threads. Then bytes/s of the bulk
+ *	copy and line reader against the per byte modulo loop the drivers had before.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "ring.h"
+
+#define CHECK(c) do { if (!(c)) { printf("FAIL %s:%d %s\n", __FILE__, __LINE__, #c); return 1; } } while (0)
+
+RING(rq, 256);
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// random reads and writes of up to more than the ring holds, head and tail start near 2^32
+static int testRandom(void) {
+	static uint8_t ref[1 << 16];
+	uint32_t rh, rt;
+	uint8_t b[300];
+
+	srand(3);
+	rq.head = rq.tail = rh = rt = 0xFFFFFF00u;
+	for (int it = 0; it < 1000000; it++) {
+		uint32_t n = rand() % 300, t, exp;
+		if (rand() & 1) {
+			for (uint32_t i = 0; i < n; i++) b[i] = rand();
+			exp = n < 256 - (rh - rt) ? n : 256 - (rh - rt);
+			t = ringWrite(&rq, b, n);
+			CHECK(t == exp);
+			for (uint32_t i = 0; i < t; i++) ref[(rh + i) & 0xFFFF] = b[i];
+			rh += t;
+		} else {
+			exp = n < rh - rt ? n : rh - rt;
+			t = ringRead(&rq, b, n);
+			CHECK(t == exp);
+			for (uint32_t i = 0; i < t; i++) CHECK(b[i] == ref[(rt + i) & 0xFFFF]);
+			rt += t;
+		}
+		CHECK(ringUsed(&rq) == rh - rt && ringFree(&rq) == 256 - (rh - rt));
+	}
+	return 0;
+}
+
+// the DMA side: spans end at the buffer end, commit and skip publish them
+static int testSpans(void) {
+	static tRing r;
+	static uint8_t buf[16];
+	const uint8_t* in;
+	uint8_t* out;
+	uint32_t n;
+
+	ringInit(&r, buf, sizeof(buf));
+	r.head = r.tail = 12;
+	n = ringWriteSpan(&r, &out);
+	CHECK(n == 4 && out == &buf[12]);
+	memcpy(out, "abcd", 4);
+	ringCommit(&r, 4);
+	n = ringWriteSpan(&r, &out);
+	CHECK(n == 12 && out == buf);
+	memcpy(out, "ef", 2);
+	ringCommit(&r, 2);
+	n = ringSpan(&r, &in);
+	CHECK(n == 4 && memcmp(in, "abcd", 4) == 0);
+	ringSkip(&r, 4);
+	n = ringSpan(&r, &in);
+	CHECK(n == 2 && memcmp(in, "ef", 2) == 0);
+	ringSkip(&r, 2);
+	CHECK(ringUsed(&r) == 0 && ringSpan(&r, &in) == 0);
+	return 0;
+}
+
+// every line of text comes out whole from every start position, so lines cross the wrap
+// and CR LF pairs are split between spans. Empty lines are skipped
+static int testLines(void) {
+	static tRing r;
+	static uint8_t buf[32];
+	const char* text = "help\r\nls\n\nset a 1\rfsgc run\n";
+	const char* want[] = { "help", "ls", "set a 1", "fsgc run" };
+	char line[16];
+	uint16_t len = 0;
+
+	ringInit(&r, buf, sizeof(buf));
+	for (uint32_t start = 0; start < sizeof(buf); start++) {
+		uint32_t got = 0;
+		int32_t n;
+
+		r.head = r.tail = start;
+		for (uint32_t i = 0; i < strlen(text); i += 3) {
+			ringWrite(&r, text + i, strlen(text) - i < 3 ? strlen(text) - i : 3); // a few bytes per interrupt
+			while ((n = ringReadLine(&r, line, sizeof(line), &len)) >= 0) {
+				CHECK(got < 4 && n == (int32_t)strlen(want[got]) && strcmp(line, want[got]) == 0);
+				got++;
+			}
+		}
+		CHECK(got == 4 && len == 0);
+	}
+	return 0;
+}
+
+// a line longer than size - 1 is dropped whole, over several calls, the next one is intact
+static int testOverlong(void) {
+	static tRing r;
+	static uint8_t buf[16];
+	char line[8];
+	uint16_t len = 0;
+
+	ringInit(&r, buf, sizeof(buf));
+	ringWrite(&r, "1234567", 7);
+	CHECK(ringReadLine(&r, line, sizeof(line), &len) == -1 && len == 7);
+	ringWrite(&r, "89", 2);
+	CHECK(ringReadLine(&r, line, sizeof(line), &len) == -1 && len == RING_LINE_DROP);
+	ringWrite(&r, "abcdefghij", 10);
+	CHECK(ringReadLine(&r, line, sizeof(line), &len) == -1 && len == RING_LINE_DROP);
+	ringWrite(&r, "k\nok\n", 5);
+	CHECK(ringReadLine(&r, line, sizeof(line), &len) == 2 && strcmp(line, "ok") == 0);
+
+	// exactly size - 1 still fits
+	ringWrite(&r, "1234567\n", 8);
+	CHECK(ringReadLine(&r, line, sizeof(line), &len) == 7 && strcmp(line, "1234567") == 0);
+	ringWrite(&r, "12345678\nx\n", 11);
+	CHECK(ringReadLine(&r, line, sizeof(line), &len) == 1 && strcmp(line, "x") == 0);
+	CHECK(len == 0 && ringUsed(&r) == 0);
+	return 0;
+}
+
+// a received packet parsed in place, lengths around powers of two
+static int testView(void) {
+	char pkt[64], line[64];
+
+	for (uint32_t n = 1; n <= sizeof(pkt); n++) {
+		tRing v;
+		const uint8_t* span;
+		uint16_t len = 0;
+		int32_t r;
+
+		memset(pkt, 'v', n - 1);
+		pkt[n - 1] = '\n';
+		ringView(&v, pkt, n);
+		CHECK(ringSize(&v) > n && RING_POW2(ringSize(&v)));
+		CHECK(ringSpan(&v, &span) == n && span == (const uint8_t*)pkt);
+		r = ringReadLine(&v, line, sizeof(line), &len);
+		CHECK(n == 1 ? r == -1 : r == (int32_t)n - 1);
+		CHECK(ringUsed(&v) == 0);
+	}
+	return 0;
+}
+
+#define STRESS_BYTES 20000000u
+
+static void* producer(void* arg) {
+	uint8_t b[97];
+	uint32_t sent = 0;
+
+	while (sent < STRESS_BYTES) {
+		uint32_t n = 1 + (sent * 13) % 97, t;
+		if (n > STRESS_BYTES - sent) n = STRESS_BYTES - sent;
+		for (uint32_t i = 0; i < n; i++) b[i] = (uint8_t)(sent + i);
+		t = ringWrite(&rq, b, n);
+		if (!t) sched_yield();
+		sent += t;
+	}
+	return NULL;
+}
+
+// an interrupt and a task stand in for two threads, no locks
+static int testThreads(void) {
+	pthread_t th;
+	uint32_t got = 0, bad = 0;
+	uint8_t b[128];
+	double t0 = now();
+
+	ringFlush(&rq);
+	rq.head = rq.tail = 0;
+	pthread_create(&th, NULL, producer, NULL);
+	while (got < STRESS_BYTES) {
+		uint32_t t = ringRead(&rq, b, 1 + (got * 7) % 127);
+		if (!t) sched_yield();
+		for (uint32_t i = 0; i < t; i++)
+			if (b[i] != (uint8_t)(got + i)) bad++;
+		got += t;
+	}
+	pthread_join(th, NULL);
+	printf("  two threads: %u bytes, %.0f MB/s\n", got, got / (now() - t0) / 1e6);
+	CHECK(bad == 0);
+	return 0;
+}
+
+// 64 byte lines through a 128 byte ring, the old per byte loop against bulk copy and memchr
+static void bench(void) {
+	static volatile uint16_t h, t;
+	static char old[128];
+	static tRing q;
+	static uint8_t qb[128];
+	uint8_t msg[64];
+	char line[80];
+	uint16_t len = 0;
+	uint64_t lines = 0;
+	const int runs = 2000000;
+	double t0;
+
+	memset(msg, 'a', 63);
+	msg[63] = '\n';
+	t0 = now();
+	for (int it = 0; it < runs; it++) {
+		for (int i = 0; i < 64; i++) {
+			uint16_t next = (h + 1) % 128;
+			if (next != t) {
+				old[h] = msg[i];
+				h = next;
+			}
+		}
+		while (t != h) {
+			char c = old[t];
+			t = (t + 1) % 128;
+			if (c == '\n') lines++;
+		}
+	}
+	printf("  per byte %% size: %.0f MB/s\n", runs * 64 / (now() - t0) / 1e6);
+
+	ringInit(&q, qb, sizeof(qb));
+	t0 = now();
+	for (int it = 0; it < runs; it++) {
+		ringWrite(&q, msg, 64);
+		while (ringReadLine(&q, line, sizeof(line), &len) >= 0) lines++;
+	}
+	printf("  ring bulk + memchr lines: %.0f MB/s (%llu lines)\n", runs * 64 / (now() - t0) / 1e6,
+			(unsigned long long)lines);
+}
+
+int main(void) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	if (testRandom() || testSpans() || testLines() || testOverlong() || testView() || testThreads())
+		return 1;
+	bench();
+	printf("ring ok\n");
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * lwip.h
+ *
+ *	Host stand-in for the lwIP raw API and the CubeMX lwip.h, the parts tcp.c uses.
+ *	Functions are provided by the tests.
+ */
+
+#ifndef LWIP_H
+#define LWIP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int8_t err_t;
+#define ERR_OK   0
+#define ERR_MEM  -1
+#define ERR_VAL  -6
+#define ERR_ABRT -13
+#define LWIP_UNUSED_ARG(x) (void)(x)
+
+typedef struct { uint32_t addr; } ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+#define IP4_ADDR(a, b, c, d, e) ((a)->addr = (uint32_t)(b) | (c) << 8 | (d) << 16 | (uint32_t)(e) << 24)
+#define IP_ADDR_ANY ((ip_addr_t*)0)
+char* ip4addr_ntoa(const ip4_addr_t* addr);
+
+struct netif { ip4_addr_t ip_addr, netmask, gw; };
+#define netif_is_link_up(n) 1
+void MX_LWIP_Process(void);
+
+struct pbuf {
+	struct pbuf* next;
+	void*        payload;
+	uint16_t     tot_len; // this and the rest of the chain
+	uint16_t     len;
+};
+uint8_t pbuf_free(struct pbuf* p);
+void pbuf_cat(struct pbuf* head, struct pbuf* tail);
+
+struct tcp_pcb { int state; };
+#define TCP_WRITE_FLAG_COPY 1
+#define TCP_WRITE_FLAG_MORE 2
+struct tcp_pcb* tcp_new(void);
+err_t tcp_bind(struct tcp_pcb* pcb, const ip_addr_t* addr, uint16_t port);
+struct tcp_pcb* tcp_listen(struct tcp_pcb* pcb);
+void tcp_accept(struct tcp_pcb* pcb, err_t (*accept)(void*, struct tcp_pcb*, err_t));
+void tcp_arg(struct tcp_pcb* pcb, void* arg);
+void tcp_err(struct tcp_pcb* pcb, void (*err)(void*, err_t));
+void tcp_recv(struct tcp_pcb* pcb, err_t (*recv)(void*, struct tcp_pcb*, struct pbuf*, err_t));
+void tcp_sent(struct tcp_pcb* pcb, err_t (*sent)(void*, struct tcp_pcb*, uint16_t));
+err_t tcp_connect(struct tcp_pcb* pcb, const ip_addr_t* addr, uint16_t port, err_t (*connected)(void*, struct tcp_pcb*, err_t));
+err_t tcp_write(struct tcp_pcb* pcb, const void* data, uint16_t len, uint8_t flags);
+err_t tcp_output(struct tcp_pcb* pcb);
+err_t tcp_close(struct tcp_pcb* pcb);
+void tcp_abort(struct tcp_pcb* pcb);
+void tcp_recved(struct tcp_pcb* pcb, uint16_t len);
+uint16_t tcp_sndbuf(struct tcp_pcb* pcb);
+
+#endif
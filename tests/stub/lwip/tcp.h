@@ -0,0 +1 @@
+#include "../lwip.h"
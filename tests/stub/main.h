@@ -0,0 +1,115 @@
+/*
+ * main.h
+ *
+ *	Host stand-in for the application main.h and the parts of the STM32 HAL the framework uses.
+ *	Types keep the fields the drivers touch, functions are provided by the tests (host.c).
+ */
+
+#ifndef MAIN_H
+#define MAIN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#define FIRMWARE_VERSION "host test"
+#ifndef STM32F3
+#define STM32F3 1
+#endif
+#define __IO volatile
+
+typedef enum { HAL_OK, HAL_ERROR, HAL_BUSY } HAL_StatusTypeDef;
+
+// gpio
+typedef struct { uint32_t x; } GPIO_TypeDef;
+extern GPIO_TypeDef *GPIOA, *GPIOB, *GPIOC, *GPIOD, *GPIOE;
+typedef struct { uint32_t Pin, Mode, Pull, Speed, Alternate; } GPIO_InitTypeDef;
+#define GPIO_PIN_All 0xFFFF
+#define GPIO_PIN_12 (1 << 12)
+#define GPIO_PIN_SET 1
+#define GPIO_PIN_RESET 0
+#define GPIO_PULLUP 1
+#define GPIO_PULLDOWN 2
+#define GPIO_NOPULL 0
+#define GPIO_MODE_INPUT 0
+#define GPIO_MODE_OUTPUT_PP 1
+#define GPIO_MODE_AF_PP 2
+#define GPIO_SPEED_FREQ_LOW 0
+#define GPIO_SPEED_FREQ_HIGH 3
+#define GPIO_AF14_USB 14
+#define __HAL_RCC_GPIOA_CLK_ENABLE()
+void HAL_GPIO_Init(GPIO_TypeDef*, GPIO_InitTypeDef*);
+void HAL_GPIO_WritePin(GPIO_TypeDef*, uint16_t, int);
+int HAL_GPIO_ReadPin(GPIO_TypeDef*, uint16_t);
+void HAL_Delay(uint32_t);
+
+// uart and dma
+typedef struct { uint32_t ISR, TDR, CR1, CR3, ICR; } USART_TypeDef;
+typedef struct { uint32_t CNDTR; } DMA_Channel_TypeDef;
+typedef struct { DMA_Channel_TypeDef* Instance; uint32_t State, ErrorCode; } DMA_HandleTypeDef;
+typedef struct { uint32_t BaudRate; } UART_InitTypeDef;
+typedef struct {
+	USART_TypeDef* Instance;
+	UART_InitTypeDef Init;
+	uint32_t gState, RxState, ErrorCode;
+	DMA_HandleTypeDef* hdmatx;
+	DMA_HandleTypeDef* hdmarx;
+} UART_HandleTypeDef;
+#define HAL_UART_STATE_READY 0x20
+#define HAL_UART_STATE_BUSY_RX 0x22
+#define HAL_UART_ERROR_ORE 0x08
+#define HAL_UART_ERROR_DMA 0x10
+#define HAL_DMA_ERROR_NONE 0
+#define HAL_DMA_ERROR_TE 1
+#define HAL_DMA_STATE_READY 1
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef*, uint8_t*, uint16_t, uint32_t);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef*, const uint8_t*, uint16_t);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef*, const uint8_t*, uint16_t);
+HAL_StatusTypeDef HAL_UART_Receive_IT(UART_HandleTypeDef*, uint8_t*, uint16_t);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef*, uint8_t*, uint16_t);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef*, uint8_t*, uint16_t);
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_IT(UART_HandleTypeDef*, uint8_t*, uint16_t);
+HAL_StatusTypeDef HAL_UART_AbortTransmit(UART_HandleTypeDef*);
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef*);
+uint32_t HAL_DMA_GetState(DMA_HandleTypeDef*);
+#define __HAL_DMA_GET_COUNTER(h) ((h)->Instance->CNDTR)
+#define __HAL_DMA_DISABLE_IT(h, f)
+#define DMA_IT_HT 4
+extern UART_HandleTypeDef huart1, huart2, huart3;
+extern DMA_HandleTypeDef hdma_usart1_tx, hdma_usart1_rx;
+
+// core
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t);
+uint32_t __get_IPSR(void);
+uint32_t __get_MSP(void);
+void __DMB(void);
+extern volatile uint32_t uwTick;
+extern uint32_t SystemCoreClock;
+typedef struct { uint32_t DEMCR; } CoreDebug_Type;
+extern CoreDebug_Type* CoreDebug;
+typedef struct { uint32_t CYCCNT, CTRL; } DWT_Type;
+extern DWT_Type* DWT;
+#define CoreDebug_DEMCR_TRCENA_Msk 1
+#define DWT_CTRL_CYCCNTENA_Msk 1
+
+// internal flash, F3 2 KB pages. The tests map it at FLASH_BASE, see flash.h
+#define FLASHSIZE_BASE 0x1FFFF7CC
+#define FLASH_BASE 0x08000000
+#define FLASH_PAGE_SIZE 0x800
+typedef struct { uint32_t TypeErase, PageAddress, NbPages, Banks; } FLASH_EraseInitTypeDef;
+#define FLASH_TYPEERASE_PAGES 0
+#define FLASH_BANK_1 1
+#define FLASH_TYPEPROGRAM_HALFWORD 1
+#define FLASH_TYPEPROGRAM_WORD 2
+#define FLASH_FLAG_BSY 1
+#define __HAL_FLASH_GET_FLAG(f) 0
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef*, uint32_t*);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t, uint32_t, uint64_t);
+
+#endif
@@ -0,0 +1 @@
+// host build, everything the framework needs is in main.h
@@ -0,0 +1,25 @@
+// host stand-in for the CubeMX USB device and CDC class headers
+#ifndef USB_DEVICE_H
+#define USB_DEVICE_H
+
+#include <stdint.h>
+
+typedef struct { uint32_t dev_state; void* pClassData; } USBD_HandleTypeDef;
+typedef struct { uint32_t TxState, RxState; } USBD_CDC_HandleTypeDef;
+#define USBD_STATE_CONFIGURED 3
+#define USBD_OK 0
+#define USBD_BUSY 1
+#define USBD_FAIL 3
+#define CDC_DATA_FS_MAX_PACKET_SIZE 64
+
+extern USBD_HandleTypeDef hUsbDeviceFS;
+void MX_USB_DEVICE_Init(void);
+uint8_t USBD_Stop(USBD_HandleTypeDef*);
+uint8_t USBD_Start(USBD_HandleTypeDef*);
+uint8_t USBD_CDC_SetRxBuffer(USBD_HandleTypeDef*, uint8_t*);
+uint8_t USBD_CDC_SetTxBuffer(USBD_HandleTypeDef*, uint8_t*, uint32_t);
+uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef*);
+uint8_t USBD_CDC_TransmitPacket(USBD_HandleTypeDef*);
+uint8_t CDC_Transmit_FS(uint8_t*, uint16_t);
+
+#endif
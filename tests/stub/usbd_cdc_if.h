@@ -0,0 +1 @@
+#include "usb_device.h"
@@ -0,0 +1,220 @@
+/*
+ * tcp_test.c
+ *
+ *	tcp.c console sessions on a model of the lwIP raw API, with the command queue of core.c.
+ *	The peer sends a script of lines cut into pbuf chains at random, segments of 1 to 90 bytes,
+ *	while the scheduler runs the commands in between or not at all for a while. Every line must
+ *	run once, intact and in order, and the whole chain be acked. A line left half sent keeps its
+ *	queue slot without holding up the lines of other transports; closing the session gives it back.
+ *	An overlong rpc frame is dropped whole, none of its bytes reach the line parser.
+ */
+
+#include "core.c"
+#include "output.c"
+#include "rpc.c"
+#define onCommand tcpOnCommand // tcp.c's weak one, the test runs its own
+#include "tcp.c"
+#undef onCommand
+#include "host.h"
+#include <stdlib.h>
+
+CoreDebug_Type* CoreDebug = &(CoreDebug_Type){ 0 };
+DWT_Type* DWT = &(DWT_Type){ 0 };
+struct netif gnetif;
+
+// ---- lwIP model ----
+
+static struct tcp_pcb listenPcb, pcbs[2];
+static err_t (*acceptCb)(void*, struct tcp_pcb*, err_t);
+static err_t (*recvCb)(void*, struct tcp_pcb*, struct pbuf*, err_t);
+static void* args[2];
+static uint32_t acked[2], pbufs;
+
+static int pcbOf(struct tcp_pcb* pcb) { return pcb == &pcbs[1]; }
+
+struct tcp_pcb* tcp_new(void) { return &listenPcb; }
+err_t tcp_bind(struct tcp_pcb* pcb, const ip_addr_t* addr, uint16_t port) { return ERR_OK; }
+struct tcp_pcb* tcp_listen(struct tcp_pcb* pcb) { return pcb; }
+void tcp_accept(struct tcp_pcb* pcb, err_t (*accept)(void*, struct tcp_pcb*, err_t)) { acceptCb = accept; }
+void tcp_arg(struct tcp_pcb* pcb, void* arg) { if (pcb != &listenPcb) args[pcbOf(pcb)] = arg; }
+void tcp_err(struct tcp_pcb* pcb, void (*err)(void*, err_t)) {}
+void tcp_recv(struct tcp_pcb* pcb, err_t (*recv)(void*, struct tcp_pcb*, struct pbuf*, err_t)) { if (recv) recvCb = recv; }
+void tcp_sent(struct tcp_pcb* pcb, err_t (*sent)(void*, struct tcp_pcb*, uint16_t)) {}
+err_t tcp_write(struct tcp_pcb* pcb, const void* data, uint16_t len, uint8_t flags) { return ERR_OK; }
+err_t tcp_output(struct tcp_pcb* pcb) { return ERR_OK; }
+err_t tcp_close(struct tcp_pcb* pcb) { return ERR_OK; }
+err_t tcp_connect(struct tcp_pcb* pcb, const ip_addr_t* addr, uint16_t port,
+		err_t (*connected)(void*, struct tcp_pcb*, err_t)) { return ERR_OK; }
+void tcp_abort(struct tcp_pcb* pcb) {}
+void tcp_recved(struct tcp_pcb* pcb, uint16_t len) { acked[pcbOf(pcb)] += len; }
+uint16_t tcp_sndbuf(struct tcp_pcb* pcb) { return 8192; }
+void MX_LWIP_Process(void) {}
+char* ip4addr_ntoa(const ip4_addr_t* addr) { return "0.0.0.0"; }
+
+uint8_t pbuf_free(struct pbuf* p) {
+	while (p) {
+		struct pbuf* next = p->next;
+		free(p);
+		pbufs--;
+		p = next;
+	}
+	return 1;
+}
+
+void pbuf_cat(struct pbuf* head, struct pbuf* tail) {
+	for (; head->next; head = head->next) head->tot_len += tail->tot_len;
+	head->tot_len += tail->tot_len;
+	head->next = tail;
+}
+
+// one segment of data, its payload right behind it like a PBUF_POOL buffer
+static struct pbuf* segment(const char* data, uint16_t len) {
+	struct pbuf* p = malloc(sizeof(struct pbuf) + len);
+	p->next = NULL;
+	p->payload = p + 1;
+	p->len = p->tot_len = len;
+	memcpy(p->payload, data, len);
+	pbufs++;
+	return p;
+}
+
+// data as a chain of random segments, delivered in one recv
+static void deliver(int session, const char* data, uint32_t len) {
+	struct pbuf* chain = NULL;
+
+	while (len) {
+		uint16_t n = 1 + rand() % 90;
+		if (n > len) n = len;
+		if (chain) pbuf_cat(chain, segment(data, n));
+		else chain = segment(data, n);
+		data += n;
+		len -= n;
+	}
+	recvCb(args[session], &pcbs[session], chain, ERR_OK);
+}
+
+// ---- framework ----
+
+static char ran[1 << 16];
+static uint32_t ranLen, ranLines;
+
+uint8_t onCommand(uint32_t param) {
+	ranLen += sprintf(ran + ranLen, "%s\n", cmd);
+	ranLines++;
+	return 0;
+}
+
+// scheduler runs for a while, the queued commands with it
+static void run(uint32_t ms) {
+	while (ms--) {
+		hostAdvance(1000);
+		kernel_process(0);
+		tcpConsolePoll();
+	}
+}
+
+static uint32_t slotsFree(void) {
+	return __builtin_popcount(cmdFree);
+}
+
+// ---- tests ----
+
+static char script[1 << 16], want[1 << 16];
+
+static int testSplit(void) {
+	uint32_t scriptLen = 0, wantLen = 0, lines = 0, sent = 0, pos = 0;
+
+	for (int i = 0; scriptLen < sizeof(script) - 200; i++) {
+		int n = sprintf(script + scriptLen, "set k%d %.*s%s", i, i % 60,
+				"abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWX", i % 3 ? "\r\n" : "\n");
+		wantLen += sprintf(want + wantLen, "%.*s\n", n - (i % 3 ? 2 : 1), script + scriptLen);
+		scriptLen += n;
+		lines++;
+	}
+	if (acceptCb(NULL, &pcbs[0], ERR_OK) != ERR_OK) return 1;
+	ranLen = ranLines = 0;
+	acked[0] = 0;
+
+	// bursts of 1 to 400 bytes, the commands run only now and then
+	while (pos < scriptLen) {
+		uint32_t n = 1 + rand() % 400;
+		if (n > scriptLen - pos) n = scriptLen - pos;
+		deliver(0, script + pos, n);
+		pos += n;
+		sent += n;
+		if (rand() % 4 == 0) run(1);
+	}
+	run(200);
+
+	printf("  split: %lu lines in %lu bytes, %lu ran, %lu acked, queue full %lu times\n", (unsigned long)lines,
+			(unsigned long)sent, (unsigned long)ranLines, (unsigned long)acked[0], (unsigned long)cmdFull);
+	CHECK(ranLines == lines && ranLen == wantLen && memcmp(ran, want, wantLen) == 0);
+	CHECK(acked[0] == sent && pbufs == 0);
+	CHECK(slotsFree() == CMD_QUEUE_SIZE);
+	return 0;
+}
+
+static int testPartial(void) {
+	static const char head[] = "partial line wai", tail[] = "ts for the rest\r\n";
+
+	ranLen = ranLines = 0;
+	if (acceptCb(NULL, &pcbs[1], ERR_OK) != ERR_OK) return 1;
+
+	// session 1 stops in the middle of a line, its slot stays taken
+	deliver(1, head, sizeof(head) - 1);
+	CHECK(slotsFree() == CMD_QUEUE_SIZE - 1 && acked[1] == sizeof(head) - 1);
+
+	// other transports and session 0 go on meanwhile
+	CHECK(cmdQueue("usb line"));
+	deliver(0, "tcp0 line\n", 10);
+	run(5);
+	CHECK(ranLines == 2 && strcmp(ran, "usb line\ntcp0 line\n") == 0);
+
+	deliver(1, tail, sizeof(tail) - 1);
+	run(5);
+	CHECK(ranLines == 3 && strcmp(ran + 19, "partial line waits for the rest\n") == 0);
+	CHECK(slotsFree() == CMD_QUEUE_SIZE);
+
+	// overlong line is dropped whole, the next one is fine
+	memset(script, 'x', CMD_BUFFER_SIZE + 10);
+	strcpy(script + CMD_BUFFER_SIZE + 10, "\r\nafter\r\n");
+	deliver(1, script, strlen(script));
+	run(5);
+	CHECK(ranLines == 4 && strcmp(ran + ranLen - 6, "after\n") == 0);
+
+	// closed with half a line, the slot comes back
+	deliver(1, "never end", 9);
+	CHECK(slotsFree() == CMD_QUEUE_SIZE - 1);
+	recvCb(args[1], &pcbs[1], NULL, ERR_OK);
+	CHECK(slotsFree() == CMD_QUEUE_SIZE && pbufs == 0);
+	printf("  partial: held line keeps its slot, usb and tcp0 lines run meanwhile, slot back on close\n");
+	return 0;
+}
+
+// frame longer than RPC_WIRE_SIZE: dropped up to its closing zero, none of it runs as a line
+static int testOverrun(void) {
+	rpcLink* link = &tcpSessions[0].rpc;
+	uint32_t len = 1, overruns = link->overruns;
+
+	script[0] = 0;
+	while (len < RPC_WIRE_SIZE * 2) len += sprintf(script + len, "set a 1\n");
+	script[len++] = 0;
+	len += sprintf(script + len, "after frame\n");
+
+	ranLen = ranLines = 0;
+	deliver(0, script, len);
+	run(5);
+	CHECK(link->overruns == overruns + 1 && link->inFrame == RPC_RX_TEXT);
+	CHECK(ranLines == 1 && strcmp(ran, "after frame\n") == 0);
+	printf("  overrun: %lu byte frame dropped whole, console text after it runs\n", (unsigned long)len - 13);
+	return 0;
+}
+
+int main(void) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	srand(1);
+	tcpConsoleInit();
+	if (testSplit() || testPartial() || testOverrun()) return 1;
+	printf("tcp ok\n");
+	return 0;
+}
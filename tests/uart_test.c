@@ -0,0 +1,325 @@
+/*
+ * uart_test.c
+ *
+ *	uart.c against a model of the USART and its DMA channels.
+ *	Transmit: a transfer moves one byte per byte time (10 bits) and raises the HAL callbacks
+ *	at half (DMA) and at the end, like the channel does. Without DMA every byte is a TXE interrupt. Checks the wire carries exactly what was
+ *	written and sent in place, in order. Prints line use, transfers and interrupts per KB and the
+ *	host time of the driver code per byte.
+ *	Receive: circular DMA into the port ring with half, full and idle line events, every line
+ *	must arrive whole, a stalled processor must be reported as an overflow and recovered.
+ *	A DMA error on the transmit channel drops that transfer, later writes go out. A receive error
+ *	restarts the channel at the buffer start without publishing the bytes it skipped.
+ */
+
+#include "uart.c"
+#include "host.h"
+#include <stdlib.h>
+
+// ---- model ----
+
+static struct {
+	UART_HandleTypeDef* huart;
+	const uint8_t* data;
+	uint16_t len, pos;
+	uint8_t dma;
+} tx;
+static uint32_t nsPerByte, nsLeft;
+static uint32_t irqs, starts;
+static uint64_t driverNs;
+static uint8_t wire[1 << 20];
+static uint32_t wired;
+
+static HAL_StatusTypeDef txStart(UART_HandleTypeDef* h, const uint8_t* d, uint16_t n, uint8_t dma) {
+	if (tx.data) return HAL_BUSY;
+	tx.huart = h;
+	tx.data = d;
+	tx.len = n;
+	tx.pos = 0;
+	tx.dma = dma;
+	starts++;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef* h, const uint8_t* d, uint16_t n) {
+	return txStart(h, d, n, 1);
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef* h, const uint8_t* d, uint16_t n) {
+	return txStart(h, d, n, 0);
+}
+
+// one byte on the wire, the callbacks run as the interrupt would
+static void wireByte(void) {
+	uint8_t half, done;
+	uint64_t t;
+
+	nsLeft += nsPerByte;
+	hostAdvance(nsLeft / 1000);
+	nsLeft %= 1000;
+	if (!tx.data) return;
+
+	wire[wired++] = tx.data[tx.pos++];
+	half = tx.dma && tx.len > 1 && tx.pos == tx.len / 2;
+	done = tx.pos == tx.len;
+	if (!tx.dma) irqs++; // TXE refill in the HAL handler
+	if (!half && !done) return;
+
+	hostInIrq = 1;
+	t = hostNs();
+	irqs += tx.dma;
+	if (half) HAL_UART_TxHalfCpltCallback(tx.huart);
+	if (done) {
+		tx.data = NULL;
+		HAL_UART_TxCpltCallback(tx.huart);
+	}
+	driverNs += hostNs() - t;
+	hostInIrq = 0;
+}
+
+// ---- framework ----
+
+static char lines[1 << 18];
+static uint32_t linesLen, lineCount;
+
+outputSink* outputSinkAdd(const char* name, outputSinkWrite write, uint8_t policy) { return NULL; }
+
+static void onLine(uartPort* port, char* line, uint16_t len) {
+	memcpy(lines + linesLen, line, len);
+	linesLen += len;
+	lines[linesLen++] = '|';
+	lineCount++;
+}
+
+UART_HandleTypeDef huartIt;
+UART_PORT(txIt, huartIt, 256, 1024, 0);
+UART_PORT(txDma, huart2, 256, 1024, UART_TX_DMA);
+UART_PORT(rxDma, huart3, 1024, 256, UART_RX_DMA);
+
+static void reset(uartPort* port, uint32_t baud) {
+	port->huart->Init.BaudRate = baud;
+	port->tx_bytes = port->tx_chunks = port->tx_busy_us = port->tx_irq_us = 0;
+	nsPerByte = 10000000000ull / baud; // 8N1, 10 bits per byte
+	wired = irqs = starts = 0;
+	driverNs = 0;
+}
+
+// ---- transmit ----
+
+static uint8_t big[3000];
+static uint32_t bigDone;
+
+static void bigSent(const uint8_t* data) {
+	bigDone++;
+}
+
+// console style writes of what fits, the rest offered again after a while, and buffers sent in place
+static int testTxOrder(uartPort* port) {
+	static uint8_t expect[1 << 20];
+	uint32_t exp = 0, sends = 0;
+	uint8_t msg[200];
+
+	reset(port, 921600);
+	bigDone = 0;
+	srand(1);
+	for (int round = 0; round < 20000 && exp < sizeof(expect) - 2 * sizeof(big); round++) {
+		int r = rand() % 100;
+		if (r < 40) {
+			int n = 1 + rand() % sizeof(msg), off = 0;
+			for (int i = 0; i < n; i++) msg[i] = rand();
+			while (off < n) {
+				int t = uartWrite(port, msg + off, n - off);
+				memcpy(expect + exp, msg + off, t);
+				exp += t;
+				off += t;
+				if (off < n)
+					for (int k = 0; k < 50; k++) wireByte();
+			}
+		} else if (r < 42) {
+			int n = 1 + rand() % sizeof(big);
+			while (uartSend(port, big, n, &bigSent)) wireByte();
+			memcpy(expect + exp, big, n);
+			exp += n;
+			sends++;
+		} else
+			wireByte();
+	}
+	while (port->tx_busy || ringUsed(&port->tx) || port->tx_desc_head != port->tx_desc_tail) wireByte();
+
+	CHECK(wired == exp && memcmp(wire, expect, exp) == 0);
+	CHECK(bigDone == sends);
+	CHECK(port->tx_bytes == exp);
+	return 0;
+}
+
+// 64 KB of 80 byte lines as fast as the ring takes them
+static int testTxBulk(uartPort* port, uint32_t baud) {
+	char line[96];
+	uint32_t total = 0, t0;
+	uint64_t writeNs = 0;
+
+	reset(port, baud);
+	t0 = hostUs;
+	for (int i = 0; total < 65536; i++) {
+		int n = snprintf(line, sizeof(line), "%05d %072d\r\n", i, i), off = 0;
+		while (off < n) {
+			uint64_t t = hostNs();
+			off += uartWrite(port, (const uint8_t*)line + off, n - off);
+			writeNs += hostNs() - t;
+			if (off < n) wireByte();
+		}
+		total += n;
+	}
+	while (port->tx_busy) wireByte();
+	CHECK(wired == total);
+
+	uint32_t us = hostUs - t0, rate = (uint64_t)total * 1000000 / us;
+	printf("  %-3s %6lu baud: %lu B/s of %lu, line %lu%% busy, %lu transfers, %lu irqs/KB, %lu ns/byte driver\n",
+			port->flags & UART_TX_DMA ? "dma" : "irq", (unsigned long)baud, (unsigned long)rate,
+			(unsigned long)(baud / 10), (unsigned long)(rate * 100 / (baud / 10)), (unsigned long)port->tx_chunks,
+			(unsigned long)(irqs * 1024 / total), (unsigned long)((driverNs + writeNs) / total));
+	CHECK(rate * 100 / (baud / 10) >= 95);
+	return 0;
+}
+
+// bus error stops the channel halfway: the transfer is dropped and counted, writing goes on
+static int testTxError(uartPort* port) {
+	static const char lost[] = "lost with the failed transfer", after[] = "written after it";
+	uint32_t n;
+
+	reset(port, 921600);
+	uartWrite(port, (const uint8_t*)lost, sizeof(lost) - 1);
+	for (n = 0; n < 5; n++) wireByte();
+
+	// channel transfer error, HAL ends the transfer and reports it
+	tx.data = NULL;
+	port->huart->hdmatx->ErrorCode = HAL_DMA_ERROR_TE;
+	port->huart->ErrorCode = HAL_UART_ERROR_DMA;
+	HAL_UART_ErrorCallback(port->huart);
+	CHECK(port->tx_errors == 1 && !port->tx_busy && !ringUsed(&port->tx));
+
+	uartWrite(port, (const uint8_t*)after, sizeof(after) - 1);
+	for (int i = 0; i < 1000 && port->tx_busy; i++) wireByte();
+	CHECK(wired == n + sizeof(after) - 1 && memcmp(wire + n, after, sizeof(after) - 1) == 0);
+
+	// buffer sent in place is handed back as well
+	bigDone = 0;
+	uartSend(port, big, 100, &bigSent);
+	wireByte();
+	tx.data = NULL;
+	port->huart->hdmatx->ErrorCode = HAL_DMA_ERROR_TE;
+	HAL_UART_ErrorCallback(port->huart);
+	CHECK(port->tx_errors == 2 && bigDone == 1 && !port->tx_busy);
+	printf("  dma tx error: transfer dropped, writer and buffer given back, next write on the wire\n");
+	return 0;
+}
+
+// ---- receive ----
+
+static uint32_t dmaPos;
+
+// the channel writes the next byte into the circular buffer, half and full events on its own
+static void dmaByte(uartPort* port, char c) {
+	uint32_t size = ringSize(&port->rx);
+
+	port->rx.buf[dmaPos] = c;
+	dmaPos = (dmaPos + 1) % size;
+	if (dmaPos == size / 2) HAL_UARTEx_RxEventCallback(port->huart, dmaPos);
+	if (dmaPos == 0) HAL_UARTEx_RxEventCallback(port->huart, size);
+}
+
+static int testRxLines(uartPort* port) {
+	static char expect[1 << 18];
+	uint32_t exp = 0, sent = 0;
+	char line[100];
+
+	srand(2);
+	linesLen = lineCount = 0;
+	port->rx_bytes = port->rx_irqs = port->rx_overflows = 0;
+	for (int l = 0; l < 3000; l++) {
+		int n = 1 + rand() % 90;
+		for (int i = 0; i < n; i++) line[i] = 'a' + rand() % 26;
+		memcpy(expect + exp, line, n);
+		exp += n;
+		expect[exp++] = '|';
+		for (int i = 0; i < n; i++) dmaByte(port, line[i]);
+		dmaByte(port, '\r');
+		if (rand() % 2) dmaByte(port, '\n');
+		sent += n + 1;
+		if (rand() % 3 == 0) HAL_UARTEx_RxEventCallback(port->huart, dmaPos); // line went idle
+		if (rand() % 3 == 0) uartRxProcessor(0);
+	}
+	HAL_UARTEx_RxEventCallback(port->huart, dmaPos);
+	uartRxProcessor(0);
+
+	printf("  rx dma: %lu lines, %lu bytes, %lu irqs/KB\n", (unsigned long)lineCount,
+			(unsigned long)port->rx_bytes, (unsigned long)(port->rx_irqs * 1024 / port->rx_bytes));
+	CHECK(lineCount == 3000 && linesLen == exp && memcmp(lines, expect, exp) == 0);
+	CHECK(port->rx_overflows == 0);
+	return 0;
+}
+
+// processor stalls while more than the buffer arrives: counted, skipped, the next line is whole
+static int testRxOverflow(uartPort* port) {
+	uint32_t size = ringSize(&port->rx);
+
+	linesLen = lineCount = 0;
+	port->rx_overflows = 0;
+	for (uint32_t i = 0; i < size + size / 4; i++) dmaByte(port, i % 64 ? 'x' : '\n');
+	HAL_UARTEx_RxEventCallback(port->huart, dmaPos);
+	CHECK(port->rx_overflows >= 1);
+	uartRxProcessor(0);
+
+	linesLen = lineCount = 0;
+	for (const char* p = "\nafter\n"; *p; p++) dmaByte(port, *p);
+	HAL_UARTEx_RxEventCallback(port->huart, dmaPos);
+	uartRxProcessor(0);
+	CHECK(lineCount >= 1 && memcmp(lines + linesLen - 6, "after|", 6) == 0);
+	return 0;
+}
+
+// overrun error stops the channel, it starts over at the buffer start: the old bytes between the
+// head and the buffer end are never published, what arrives after the restart is
+static int testRxRestart(uartPort* port) {
+	uint32_t size = ringSize(&port->rx), unread;
+
+	for (const char* p = "\nbefore"; *p; p++) dmaByte(port, *p);
+	HAL_UARTEx_RxEventCallback(port->huart, dmaPos);
+	unread = ringUsed(&port->rx);
+	for (uint32_t i = dmaPos; i < size; i++) port->rx.buf[i] = i % 8 ? 'o' : '\n'; // last lap
+	linesLen = lineCount = 0;
+
+	port->huart->RxState = HAL_UART_STATE_READY;
+	port->huart->ErrorCode = HAL_UART_ERROR_ORE;
+	HAL_UART_ErrorCallback(port->huart);
+	dmaPos = 0;
+	for (const char* p = "after restart\n"; *p; p++) dmaByte(port, *p);
+	HAL_UARTEx_RxEventCallback(port->huart, dmaPos);
+	CHECK(ringUsed(&port->rx) == unread); // a reader before the resync sees only real bytes
+	uartRxProcessor(0);
+
+	CHECK(lineCount == 1 && linesLen == 14 && memcmp(lines, "after restart|", 14) == 0);
+	CHECK(ringUsed(&port->rx) == 0 && !port->rx_resync);
+	printf("  rx dma restart: nothing stale published, the next line whole\n");
+	return 0;
+}
+
+int main(void) {
+	static USART_TypeDef usart[3];
+	static DMA_HandleTypeDef txChannel;
+
+	setvbuf(stdout, NULL, _IONBF, 0);
+	huart2.Instance = &usart[0]; // 1 KB apart like the peripherals, see UART_SLOT
+	huart2.hdmatx = &txChannel;
+	huart3.Instance = (USART_TypeDef*)((uintptr_t)&usart[0] + 0x400);
+	huartIt.Instance = (USART_TypeDef*)((uintptr_t)&usart[0] + 0x800);
+	if (uartOpen(&txIt, NULL) || uartOpen(&txDma, NULL) || uartOpen(&rxDma, &onLine)) return 1;
+
+	if (testTxOrder(&txIt) || testTxOrder(&txDma)) return 1;
+	if (testTxBulk(&txIt, 115200) || testTxBulk(&txIt, 921600)) return 1;
+	if (testTxBulk(&txDma, 115200) || testTxBulk(&txDma, 921600)) return 1;
+	if (testTxError(&txDma)) return 1;
+	if (testRxLines(&rxDma) || testRxOverflow(&rxDma) || testRxRestart(&rxDma)) return 1;
+	printf("uart ok\n");
+	return 0;
+}
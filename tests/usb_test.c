@@ -0,0 +1,201 @@
+/*
+ * usb_test.c
+ *
+ *	usb.c and output.c against a model of the full speed CDC core and a host.
+ *	Upload: the host offers a 64 byte OUT packet every 52 us whenever the endpoint is armed and
+ *	counts a NAK otherwise, lines go through the command queue, each costs a while to run.
+ *	Every line must arrive intact with no overflow, prints KB/s, NAKs and hold-offs.
+ *	Download: IN transfers take 12 us per packet plus a frame of host latency, console lines,
+ *	printf bursts and a bulk dump must arrive intact, prints packets per KB and KB/s.
+ */
+
+#include "output.c"
+#include "usb.c"
+#include "host.h"
+
+USBD_HandleTypeDef hUsbDeviceFS;
+static USBD_CDC_HandleTypeDef cdc;
+
+// ---- model ----
+
+#define OUT_PACKET_US  52  // host OUT packets back to back
+#define IN_PACKET_US   12
+#define IN_LATENCY_US  125 // host polls the IN endpoint next microframe
+
+static uint8_t epBuf[64]; // CDC class OUT buffer
+static uint8_t* rxBuf;
+static uint8_t rxArmed;
+static const char* up;
+static uint32_t upLen, upPos, nextOut, naks;
+
+static uint8_t* txData;
+static uint16_t txLen;
+static uint32_t txDoneAt;
+static char down[1 << 17];
+static uint32_t downLen, inTransfers, inPackets;
+
+void MX_USB_DEVICE_Init(void) {}
+uint8_t USBD_CDC_SetRxBuffer(USBD_HandleTypeDef* h, uint8_t* buf) { rxBuf = buf; return USBD_OK; }
+uint8_t USBD_CDC_ReceivePacket(USBD_HandleTypeDef* h) { rxArmed = 1; return USBD_OK; }
+
+// IN transfer, copied out by the host when it completes
+uint8_t CDC_Transmit_FS(uint8_t* buf, uint16_t len) {
+	if (cdc.TxState) return USBD_BUSY;
+	cdc.TxState = 1;
+	txData = buf;
+	txLen = len;
+	txDoneAt = hostUs + IN_PACKET_US * (len ? (len + 63) / 64 : 1) + IN_LATENCY_US;
+	inTransfers++;
+	inPackets += len ? (len + 63) / 64 : 1;
+	return USBD_OK;
+}
+
+// one microsecond of bus: next OUT packet if armed, completed IN transfer with its interrupt
+static void bus(void) {
+	hostAdvance(1);
+	if (upPos < upLen && (int32_t)(hostUs - nextOut) >= 0) {
+		nextOut = hostUs + OUT_PACKET_US;
+		if (!rxArmed) naks++;
+		else {
+			uint32_t len = upLen - upPos > 64 ? 64 : upLen - upPos;
+			rxArmed = 0;
+			memcpy(rxBuf, up + upPos, len);
+			upPos += len;
+			usbReceiveBuffer(rxBuf, &len); // CDC_Receive_FS
+		}
+	}
+	if (cdc.TxState && (int32_t)(hostUs - txDoneAt) >= 0) {
+		memcpy(down + downLen, txData, txLen);
+		downLen += txLen;
+		cdc.TxState = 0;
+		usbTransmitComplete(); // CDC_TransmitCplt_FS
+	}
+}
+
+// time passes, the 1 ms tasks run on the tick
+static void run(uint32_t us) {
+	while (us--) {
+		bus();
+		if (hostUs % 1000 == 0) {
+			usbProcessor(0);
+			outputProcessor(0);
+		}
+	}
+}
+
+// ---- framework ----
+
+static uint32_t lineUs, lineCount, lineSum;
+
+// command queue takes the line, the command runs while the scheduler is back in kernel_process
+uint8_t cmdQueue(const char* line) {
+	lineCount++;
+	for (const char* c = line; *c; c++) lineSum = lineSum * 31 + *c;
+	return 1;
+}
+
+static void idle(void) {
+	uint32_t us = lineUs;
+	while (us--) bus();
+}
+
+// ---- upload ----
+
+static char upload[1 << 19];
+
+static int testUpload(uint32_t cost) {
+	uint32_t want = 0, lines = 0, t0, heldBefore = usbRxHolds;
+
+	upLen = 0;
+	for (int i = 0; upLen < sizeof(upload) - 100; i++) {
+		int n = sprintf(upload + upLen, "line %06d %.*s\r\n", i, 40 + i % 40,
+				"abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
+		for (int j = 0; j < n - 2; j++) want = want * 31 + upload[upLen + j];
+		upLen += n;
+		lines++;
+	}
+	up = upload;
+	upPos = naks = lineCount = lineSum = 0;
+	lineUs = cost;
+	t0 = hostUs;
+	nextOut = hostUs;
+	while (upPos < upLen || ringUsed(&usbRx)) run(1);
+
+	uint32_t us = hostUs - t0;
+	printf("  upload, %3lu us per line: %lu KB/s, %lu NAKs, held off %lu times, longest %lu ms\n", (unsigned long)cost,
+			(unsigned long)((uint64_t)upLen * 1000 / us), (unsigned long)naks,
+			(unsigned long)(usbRxHolds - heldBefore), (unsigned long)usbRxHoldMaxMs);
+	CHECK(lineCount == lines && lineSum == want);
+	CHECK(!usbRxHeld && rxArmed);
+	return 0;
+}
+
+// ---- download ----
+
+static char written[1 << 17];
+static uint32_t writtenLen;
+
+static void print(const char* line, int len, uint8_t policy) {
+	memcpy(written + writtenLen, line, len);
+	writtenLen += len;
+	outputWritePolicy(line, len, policy);
+}
+
+static int testDownload(void) {
+	char line[64];
+	uint32_t t0;
+
+	lineUs = 10;
+
+	// console lines, 200 per second
+	downLen = writtenLen = inTransfers = inPackets = 0;
+	for (int i = 0; i < 2000; i++) {
+		print(line, sprintf(line, "t=%d v=%d\r\n", i, i * 7), OUT_DEFAULT);
+		run(5000);
+	}
+	run(20000);
+	printf("  console lines: %lu bytes, %lu transfers, %lu packets/KB\n", (unsigned long)writtenLen,
+			(unsigned long)inTransfers, (unsigned long)(inPackets * 1024 / writtenLen));
+	CHECK(downLen == writtenLen && memcmp(down, written, writtenLen) == 0);
+
+	// printf bursts, 10 short writes every ms are packed together
+	downLen = writtenLen = inTransfers = inPackets = 0;
+	for (int i = 0; i < 2000; i++) {
+		print(line, sprintf(line, "x%d,", i), OUT_DEFAULT);
+		if (i % 10 == 9) run(1000);
+	}
+	run(20000);
+	printf("  printf bursts: %lu bytes, %lu transfers, %lu packets/KB\n", (unsigned long)writtenLen,
+			(unsigned long)inTransfers, (unsigned long)(inPackets * 1024 / writtenLen));
+	CHECK(downLen == writtenLen && memcmp(down, written, writtenLen) == 0);
+	CHECK(inTransfers < 2000 / 10 * 2);
+
+	// bulk dump, as fast as the endpoint takes it
+	downLen = writtenLen = inTransfers = inPackets = 0;
+	t0 = hostUs;
+	for (int i = 0; i < 4000; i++) {
+		print(line, sprintf(line, "%05d abcdefghij\r\n", i), OUT_BLOCK);
+		run(1);
+	}
+	while (downLen < writtenLen) run(10);
+	printf("  bulk: %lu bytes, %lu transfers, %lu packets/KB, %lu KB/s\n", (unsigned long)writtenLen,
+			(unsigned long)inTransfers, (unsigned long)(inPackets * 1024 / writtenLen),
+			(unsigned long)((uint64_t)writtenLen * 1000 / (hostUs - t0)));
+	CHECK(downLen == writtenLen && memcmp(down, written, writtenLen) == 0);
+	CHECK(inPackets * 1024 / writtenLen <= 20);
+	return 0;
+}
+
+int main(void) {
+	setvbuf(stdout, NULL, _IONBF, 0);
+	hostIdle = &idle;
+	hUsbDeviceFS.dev_state = USBD_STATE_CONFIGURED;
+	hUsbDeviceFS.pClassData = &cdc;
+	usbInit(0);
+	usbRxArm(epBuf); // MX_USB_DEVICE_Init arms the endpoint
+
+	if (testUpload(10) || testUpload(200)) return 1;
+	if (testDownload()) return 1;
+	printf("usb ok\n");
+	return 0;
+}
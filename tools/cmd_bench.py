@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""
+cmd_bench.py
+
+Pipelined console commands: sends a batch of command lines without waiting for replies,
+then reads the command queue stats (`cmdq`, core.c) to check all of them ran.
+
+    python3 cmd_bench.py /dev/ttyACM0                  (1000 x cmdq)
+    python3 cmd_bench.py /dev/ttyACM0 5000 "get speed"
+    python3 cmd_bench.py tcp:192.168.1.50:23 1000
+
+The rate counts from the first line sent to the final stats reply, transport included,
+"device alone" is what the average run time of the command allows.
+"""
+
+import re
+import sys
+import time
+
+from rpc_client import Link
+
+EXECUTED = re.compile(rb"executed (\d+) ")
+STATS = re.compile(rb"command queue \d+/\d+, peak (\d+), full (\d+)\r?\n executed \d+ .*\r?\n"
+                   rb" wait avg (\d+)us max (\d+)us, run avg (\d+)us max (\d+)us")
+
+
+def run(link, count, command, timeout=30.0):
+    link.write(b"cmdq reset\r\n")
+    time.sleep(0.2)
+    link.read()
+
+    start = time.time()
+    link.write((command + "\r\n").encode() * count + b"cmdq\r\n")
+    text = b""
+    while time.time() - start < timeout:
+        text += link.read()
+        done = [m for m in EXECUTED.finditer(text) if int(m.group(1)) >= count + 1]
+        stats = STATS.search(text, text.rfind(b"command queue", 0, done[0].start())) if done else None
+        if stats:
+            return time.time() - start, int(done[0].group(1)) - 1, stats  # cmdq reset counts too
+    raise TimeoutError("no final cmdq reply, %d bytes of output" % len(text))
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 1
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+    command = sys.argv[3] if len(sys.argv) > 3 else "cmdq"
+
+    secs, ran, stats = run(Link(sys.argv[1]), count, command)
+    peak, full, wait_avg, wait_max, run_avg, run_max = (int(g) for g in stats.groups())
+    print("%d x '%s': %d ran, %.0f cmd/s, device alone %.0f cmd/s" %
+          (count, command, ran, count / secs, 1e6 / max(run_avg, 1)))
+    print("queue peak %d, full %d, wait avg %d us max %d us, run avg %d us max %d us" %
+          (peak, full, wait_avg, wait_max, run_avg, run_max))
+    return 0 if ran == count else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
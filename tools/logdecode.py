@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""
+logdecode.py
+
+Decodes binary LOG() records (log.c, "log binary" mode) using format strings from the firmware ELF.
+
+    python3 logdecode.py firmware.elf capture.bin
+    python3 logdecode.py firmware.elf /dev/ttyACM0      (needs pyserial)
+
+Text between records (regular printf output) is passed through.
+"""
+
+import re
+import struct
+import sys
+
+LOG_SYNC = 0xA5
+LEVELS = ["DBG", "INF", "WRN", "ERR"]
+
+
+def elf_sections(path):
+    """returns list of (name, addr, bytes) of sections with content"""
+    data = open(path, "rb").read()
+    if data[:4] != b"\x7fELF":
+        raise ValueError("not an ELF file")
+    is64 = data[4] == 2
+    if is64:
+        shoff, = struct.unpack_from("<Q", data, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x3A)
+    else:
+        shoff, = struct.unpack_from("<I", data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+
+    headers = []
+    for i in range(shnum):
+        off = shoff + i * shentsize
+        if is64:
+            name, stype, flags, addr, offset, size = struct.unpack_from("<IIQQQQ", data, off)
+        else:
+            name, stype, flags, addr, offset, size = struct.unpack_from("<IIIIII", data, off)
+        headers.append((name, stype, addr, offset, size))
+
+    strtab = headers[shstrndx]
+    sections = []
+    for name, stype, addr, offset, size in headers:
+        if stype == 8:  # NOBITS
+            continue
+        end = data.index(b"\0", strtab[3] + name)
+        sname = data[strtab[3] + name:end].decode()
+        sections.append((sname, addr, data[offset:offset + size]))
+    return sections
+
+
+class Strings:
+    def __init__(self, sections):
+        self.sections = [s for s in sections if s[0] == ".fw_log"] + \
+                        [s for s in sections if s[0] != ".fw_log" and s[1]]
+        self.log = [s for s in sections if s[0] == ".fw_log"]
+
+    def is_format(self, addr):
+        return any(a <= addr < a + len(d) for _, a, d in self.log)
+
+    def get(self, addr):
+        for _, a, d in self.sections:
+            if a <= addr < a + len(d):
+                off = addr - a
+                return d[off:d.index(b"\0", off)].decode(errors="replace")
+        return None
+
+
+SPEC = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([diuxXcspo%])")
+
+
+def format_c(strings, fmt, args):
+    args = list(args)
+
+    def repl(m):
+        flags, _, conv = m.groups()
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv in "di":
+            value = value - (1 << 32) if value & 0x80000000 else value
+            return ("%" + flags + "d") % value
+        if conv == "s":
+            text = strings.get(value)
+            return ("%" + flags + "s") % (text if text is not None else "<0x%08X>" % value)
+        if conv == "p":
+            return "0x%08X" % value
+        if conv == "c":
+            return chr(value & 0xFF)
+        return ("%" + flags + conv) % value
+
+    return SPEC.sub(repl, fmt)
+
+
+def decode(strings, stream, out):
+    buf = b""
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            break
+        buf += chunk
+        while buf:
+            pos = buf.find(bytes([LOG_SYNC]))
+            if pos < 0:
+                out.write(buf.decode(errors="replace"))
+                buf = b""
+                break
+            if pos:
+                out.write(buf[:pos].decode(errors="replace"))
+                buf = buf[pos:]
+            if len(buf) < 10:
+                break
+            argc = buf[1] & 0x0F
+            level = buf[1] >> 4
+            ts, fid = struct.unpack_from("<II", buf, 2)
+            size = 10 + 4 * argc
+            if argc > 6 or not strings.is_format(fid):
+                out.write(chr(buf[0]))  # not a record, plain byte
+                buf = buf[1:]
+                continue
+            if len(buf) < size:
+                break
+            args = struct.unpack_from("<%dI" % argc, buf, 10)
+            name = LEVELS[level] if level < len(LEVELS) else "?"
+            out.write("%lu %s %s\n" % (ts, name, format_c(strings, strings.get(fid), args)))
+            buf = buf[size:]
+        out.flush()
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        return 1
+    strings = Strings(elf_sections(sys.argv[1]))
+    if len(sys.argv) < 3 or sys.argv[2] == "-":
+        stream = sys.stdin.buffer
+    elif sys.argv[2].startswith("/dev/") or sys.argv[2].startswith("COM"):
+        import serial
+        stream = serial.Serial(sys.argv[2], 115200, timeout=None)
+    else:
+        stream = open(sys.argv[2], "rb")
+    decode(strings, stream, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
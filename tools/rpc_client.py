@@ -0,0 +1,260 @@
+#!/usr/bin/env python3
+"""
+rpc_client.py
+
+Host side of the binary RPC channel (rpc.c). Frames share the link with the text console:
+
+    0x00 COBS(seq:2 method:1 status:1 payload crc16:2) 0x00
+
+Console text between frames is passed through to stdout.
+
+    python3 rpc_client.py /dev/ttyACM0 info
+    python3 rpc_client.py /dev/ttyACM0 call 16 0a0b0c      (method id, payload hex)
+    python3 rpc_client.py /dev/ttyACM0 bench 2000 64 8     (requests, payload size, pipelined window)
+    python3 rpc_client.py tcp:192.168.1.50:23 bench
+    python3 rpc_client.py - selftest                       (codec and loopback, no device needed)
+
+Serial ports need pyserial.
+"""
+
+import os
+import socket
+import struct
+import sys
+import time
+
+RPC_PING = 0
+RPC_INFO = 1
+RPC_PAYLOAD_SIZE = 192
+STATUS = ["ok", "unknown method", "handler error", "too long"]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE"""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_at, code = 0, 1
+    for i, b in enumerate(data):
+        if b:
+            out.append(b)
+            code += 1
+        if not b or code == 0xFF:
+            out[code_at] = code
+            code = 1
+            code_at = len(out)
+            if not b or i < len(data) - 1:
+                out.append(0)
+    if code_at < len(out):  # full block at the very end needs no trailing code
+        out[code_at] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0:
+            raise ValueError("zero in COBS data")
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def frame(seq, method, payload, status=0):
+    body = struct.pack("<HBB", seq & 0xFFFF, method, status) + bytes(payload)
+    body += struct.pack(">H", crc16(body))
+    return b"\x00" + cobs_encode(body) + b"\x00"
+
+
+def unframe(encoded):
+    """returns (seq, method, status, payload) or None on a bad frame"""
+    try:
+        body = cobs_decode(encoded)
+    except ValueError:
+        return None
+    if len(body) < 6 or crc16(body) != 0:
+        return None
+    seq, method, status = struct.unpack_from("<HBB", body)
+    return seq, method, status, body[4:-2]
+
+
+class Splitter:
+    """separates frames from console text, same rules as rpcReadLine"""
+
+    def __init__(self, on_text):
+        self.on_text = on_text
+        self.in_frame = False
+        self.buf = bytearray()
+        self.bad = 0
+
+    def feed(self, data):
+        frames = []
+        for b in data:
+            if not self.in_frame:
+                if b == 0:
+                    self.in_frame = True
+                    self.buf.clear()
+                else:
+                    self.on_text(bytes([b]))
+            elif b == 0:
+                if self.buf:  # empty frame: out of step, this zero opens the next one
+                    f = unframe(bytes(self.buf))
+                    if f:
+                        frames.append(f)
+                    else:
+                        self.bad += 1
+                    self.in_frame = False
+            else:
+                self.buf.append(b)
+        return frames
+
+
+class Link:
+    def __init__(self, target):
+        if target.startswith("tcp:"):
+            host, port = target[4:].rsplit(":", 1)
+            self.sock = socket.create_connection((host, int(port)))
+            self.sock.settimeout(0.05)
+            self.read = self._sock_read
+            self.write = self.sock.sendall
+        else:
+            import serial
+            self.ser = serial.Serial(target, 115200, timeout=0.05)
+            self.read = lambda: self.ser.read(self.ser.in_waiting or 1)
+            self.write = self.ser.write
+
+    def _sock_read(self):
+        try:
+            return self.sock.recv(4096)
+        except socket.timeout:
+            return b""
+
+
+class RpcClient:
+    def __init__(self, link, on_text=None):
+        self.link = link
+        self.seq = 0
+        self.splitter = Splitter(on_text or (lambda t: (sys.stdout.write(t.decode(errors="replace")), sys.stdout.flush())))
+        self.done = {}
+
+    def send(self, method, payload=b""):
+        seq = self.seq
+        self.seq = (self.seq + 1) & 0xFFFF
+        self.link.write(frame(seq, method, payload))
+        return seq
+
+    def poll(self):
+        for seq, method, status, payload in self.splitter.feed(self.link.read()):
+            self.done[seq] = (status, payload)
+
+    def wait(self, seq, timeout=1.0):
+        end = time.time() + timeout
+        while seq not in self.done:
+            if time.time() > end:
+                raise TimeoutError("no response to request %d" % seq)
+            self.poll()
+        return self.done.pop(seq)
+
+    def call(self, method, payload=b"", timeout=1.0):
+        return self.wait(self.send(method, payload), timeout)
+
+    def bench(self, count, size, window):
+        """pipelined echo requests, returns (seconds, failures)"""
+        payload = bytes((i * 7 + 1) & 0xFF for i in range(size))
+        pending = []
+        failed = 0
+        start = time.time()
+        sent = 0
+        while sent < count or pending:
+            while sent < count and len(pending) < window:
+                pending.append(self.send(RPC_PING, payload))
+                sent += 1
+            status, echo = self.wait(pending.pop(0))
+            if status != 0 or echo != payload:
+                failed += 1
+        return time.time() - start, failed
+
+
+class Loopback:
+    """in-process device: echoes RPC_PING like rpc.c, interleaves console text"""
+
+    def __init__(self):
+        self.out = bytearray()
+        self.splitter = Splitter(lambda t: None)
+
+    def write(self, data):
+        for seq, method, status, payload in self.splitter.feed(data):
+            self.out += b"text between frames\n"
+            self.out += frame(seq, method, payload if method == RPC_PING else b"", 0 if method == RPC_PING else 1)
+
+    def read(self):
+        data, self.out = bytes(self.out), bytearray()
+        return data
+
+
+def selftest():
+    assert crc16(b"123456789") == 0x29B1
+    for n in (0, 1, 253, 254, 255, 300):
+        for data in (bytes(n), bytes(range(1, 256)) * 2, os.urandom(n)):
+            data = data[:n]
+            enc = cobs_encode(data)
+            assert 0 not in enc and cobs_decode(enc) == data, n
+    # resync after a stray zero and garbage
+    sp = Splitter(lambda t: None)
+    got = sp.feed(b"\x00junk" + frame(5, 0, b"ab") + frame(6, 0, b"\x00\x00"))
+    assert [g[0] for g in got] == [6], got
+
+    text = []
+    client = RpcClient(Loopback(), lambda t: text.append(t))
+    assert client.call(RPC_INFO)[0] == 1
+    for size in (0, 16, 64, RPC_PAYLOAD_SIZE):
+        secs, failed = client.bench(2000, size, 8)
+        assert failed == 0
+        print("loopback %3d byte payload: %6.0f req/s %8.0f B/s" % (size, 2000 / secs, 2000 * size / secs))
+    assert b"".join(text).count(b"\n") > 0
+    print("selftest ok")
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 1
+    target, action, args = sys.argv[1], sys.argv[2], sys.argv[3:]
+    if action == "selftest":
+        selftest()
+        return 0
+
+    client = RpcClient(Link(target))
+    if action == "info":
+        status, payload = client.call(RPC_INFO)
+        up, = struct.unpack_from("<I", payload)
+        print("%s, up %.1f s" % (payload[4:].decode(errors="replace"), up / 1000))
+    elif action == "call":
+        status, payload = client.call(int(args[0], 0), bytes.fromhex(args[1]) if len(args) > 1 else b"")
+        print(STATUS[status] if status < len(STATUS) else status, payload.hex())
+    elif action == "bench":
+        count = int(args[0]) if args else 1000
+        size = int(args[1]) if len(args) > 1 else 64
+        window = int(args[2]) if len(args) > 2 else 8
+        secs, failed = client.bench(count, size, window)
+        print("%d requests, %d byte payload, window %d: %.0f req/s, %.0f payload B/s each way, %d failed" %
+              (count, size, window, count / secs, count * size / secs, failed))
+    else:
+        print(__doc__)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
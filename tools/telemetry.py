@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""
+telemetry.py
+
+Subscribes to registered firmware variables (telemetry.c) and prints or CSVs the stream.
+
+    python3 telemetry.py /dev/ttyACM0 list
+    python3 telemetry.py /dev/ttyACM0 stream 1000 speed current duty
+    python3 telemetry.py /dev/ttyACM0 stream 1000 speed current --csv run.csv --seconds 10
+    python3 telemetry.py /dev/ttyACM0 stop
+
+Rate 0 streams whatever the firmware samples with telemetrySample(). Sample times come from
+the frame timestamp (device microseconds) plus the subscribed period. Lost frames are
+counted from gaps in the frame sequence.
+"""
+
+import struct
+import sys
+import time
+
+from rpc_client import Link, RpcClient
+
+RPC_TM_LIST = 2
+RPC_TM_SUBSCRIBE = 3
+RPC_TM_DATA = 4
+
+TYPES = {0x01: "<B", 0x11: "<b", 0x02: "<H", 0x12: "<h", 0x04: "<I", 0x14: "<i", 0x24: "<f"}
+
+
+def list_vars(client):
+    """returns [(name, type)] in index order"""
+    out = []
+    while True:
+        status, payload = client.call(RPC_TM_LIST, bytes([len(out)]))
+        if status:
+            raise RuntimeError("list failed, status %d" % status)
+        total, i = payload[0], 1
+        while i < len(payload):
+            vtype, n = payload[i], payload[i + 1]
+            out.append((payload[i + 2:i + 2 + n].decode(), vtype))
+            i += 2 + n
+        if len(out) >= total or i == 1:
+            return out
+
+
+class Decoder:
+    """turns RPC_TM_DATA frames into (time_us, values) rows"""
+
+    def __init__(self, types, gen, period_us):
+        self.fmt = "<" + "".join(TYPES[t][1] for t in types)
+        self.size = struct.calcsize(self.fmt)
+        self.gen = gen
+        self.period = period_us
+        self.seq = None
+        self.lost = 0
+        self.frames = 0
+        self.samples = 0
+
+    def frame(self, seq, payload):
+        if payload[0] != self.gen:
+            return []  # previous subscription still in flight
+        if self.seq is not None:
+            self.lost += (seq - self.seq - 1) & 0xFFFF
+        self.seq = seq
+        self.frames += 1
+        count, t0 = payload[1], struct.unpack_from("<I", payload, 2)[0]
+        rows = []
+        for k in range(count):
+            values = struct.unpack_from(self.fmt, payload, 6 + k * self.size)
+            rows.append((t0 + k * self.period, values))
+        self.samples += count
+        return rows
+
+
+def subscribe(client, rate, indexes):
+    status, payload = client.call(RPC_TM_SUBSCRIBE, struct.pack("<H", rate) + bytes(indexes))
+    if status:
+        raise RuntimeError("subscribe failed, status %d" % status)
+    gen, record, per_frame, period = struct.unpack("<BHBI", payload)
+    return gen, record, per_frame, period
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        return 1
+    args = sys.argv[3:]
+    csv_path, seconds = None, None
+    if "--csv" in args:
+        i = args.index("--csv")
+        csv_path = args[i + 1]
+        del args[i:i + 2]
+    if "--seconds" in args:
+        i = args.index("--seconds")
+        seconds = float(args[i + 1])
+        del args[i:i + 2]
+
+    frames = []
+    client = RpcClient(Link(sys.argv[1]))
+    action = sys.argv[2]
+
+    if action == "list":
+        for i, (name, vtype) in enumerate(list_vars(client)):
+            print("%2d %-16s %s" % (i, name, TYPES[vtype][1]))
+        return 0
+    if action == "stop":
+        client.call(RPC_TM_SUBSCRIBE, struct.pack("<H", 0))
+        return 0
+    if action != "stream" or len(args) < 2:
+        print(__doc__)
+        return 1
+
+    rate, names = int(args[0]), args[1:]
+    known = list_vars(client)
+    index = {name: i for i, (name, _) in enumerate(known)}
+    missing = [n for n in names if n not in index]
+    if missing:
+        print("unknown variables: %s" % " ".join(missing))
+        return 1
+
+    # data frames are pushed, catch them next to responses
+    feed = client.splitter.feed
+
+    def splitter_feed(data):
+        got = feed(data)
+        frames.extend(f for f in got if f[1] == RPC_TM_DATA)
+        return [f for f in got if f[1] != RPC_TM_DATA]
+    client.splitter.feed = splitter_feed
+
+    gen, record, per_frame, period = subscribe(client, rate, [index[n] for n in names])
+    dec = Decoder([known[index[n]][1] for n in names], gen, period)
+    out = open(csv_path, "w") if csv_path else sys.stdout
+    out.write("t_us," + ",".join(names) + "\n")
+    print("%d byte records, %d per frame, period %d us" % (record, per_frame, period), file=sys.stderr)
+
+    start = time.time()
+    try:
+        while seconds is None or time.time() - start < seconds:
+            client.poll()
+            while frames:
+                seq, _, _, payload = frames.pop(0)
+                for t, values in dec.frame(seq, payload):
+                    out.write("%d,%s\n" % (t, ",".join("%g" % v for v in values)))
+    except KeyboardInterrupt:
+        pass
+    client.call(RPC_TM_SUBSCRIBE, struct.pack("<H", 0))
+    secs = time.time() - start
+    print("%d samples in %.1f s (%.0f/s), %d frames, %d lost" %
+          (dec.samples, secs, dec.samples / secs, dec.frames, dec.lost), file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
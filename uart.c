@@ -8,161 +8,332 @@
 
 #ifdef USING_UART
 
+#ifdef USING_UART_DMA
+	#define UART_CONSOLE_TX UART_TX_DMA
+#else
+	#define UART_CONSOLE_TX 0
+#endif
+#ifdef USING_UART_RX_DMA
+	#define UART_CONSOLE_RX UART_RX_DMA
+#else
+	#define UART_CONSOLE_RX 0
+#endif
 
-// ring buffer state
-volatile uint16_t ring_head = 0;
-volatile uint16_t ring_tail = 0;
-char            uart_ring_buf[UART_RING_BUFFER_SIZE];
+// console port, e.g. huart1
+UART_PORT(uartConsole, USING_UART, UART_RING_BUFFER_SIZE, TX_DMA_BUFFER_SIZE, UART_CONSOLE_TX | UART_CONSOLE_RX);
 
-char             cmd[UART_CMD_BUFFER_SIZE];
-volatile uint8_t cmdLoaded = 0;
-char uartLoaded = 0;
+static uartPort* uartSlots[UART_PORT_SLOTS]; // HAL callback dispatch, see UART_SLOT
+static uartPort* uartPorts = NULL;           // open ports, for processor and stats
 
-// simple one-byte rx
-static uint8_t uart_rx_byte;
+MODULE(uart, MOD_UART, 0, 0, &uartInit);
 
+#ifdef USING_CONSOLE
+CONSOLE_CMD(uartstat, uartStats);
+#endif
 
-extern UART_HandleTypeDef  USING_UART;  // e.g. huart1
-extern DMA_HandleTypeDef   USING_UART_DMA;    // e.g. hdma_usart1_tx
+static int uartSinkWrite(const uint8_t* data, uint16_t len);
 
-// transmit buffer
-static uint16_t tx_dma_len = 0;
-static uint8_t tx_buf[TX_DMA_BUFFER_SIZE];
-static volatile uint16_t tx_head = 0;
-static volatile uint16_t tx_tail = 0;
+#ifdef USING_RPC
+static int uartRpcWrite(const uint8_t* data, uint16_t len);
+static rpcLink uartRpc = { .name = "uart", .write = &uartRpcWrite };
+#endif
 
-// Kick off DMA from buffer tail to head
-#ifndef USING_UART_DMA
-void uartTxProcessor(uint32_t param) {
-	char queue[1];
-	  // empty if head == tail
-	    if (tx_head == tx_tail) {
-	        return;
-	    }
-
-	    __disable_irq();               // protect concurrent access
-	    queue[0] = tx_buf[tx_tail];
-	    HAL_UART_Transmit(&USING_UART, queue, 1, 100);
-	    tx_tail = (tx_tail + 1) % TX_DMA_BUFFER_SIZE;
-	    __enable_irq();
-	    kernel_process(1);
-	    return;
+static inline uartPort* uartPortOf(UART_HandleTypeDef *huart) {
+	uartPort* port = uartSlots[UART_SLOT(huart)];
+	return (port && port->huart == huart) ? port : NULL;
 }
+
+static HAL_StatusTypeDef uartTxBegin(uartPort* port, const uint8_t* data, uint16_t len) {
+	if (port->flags & UART_TX_DMA) return HAL_UART_Transmit_DMA(port->huart, data, len);
+	return HAL_UART_Transmit_IT(port->huart, data, len);
+}
+
+// start next transfer, caller must own tx_busy
+static void uartTxNext(uartPort* port) {
+    uint8_t queued = port->tx_desc_tail != port->tx_desc_head;
+    uartTxDesc* desc = &port->tx_desc[port->tx_desc_tail % UART_TX_DESC_LIMIT];
+    const uint8_t* span;
+    uint32_t len = ringSpan(&port->tx, &span);
+
+    port->tx_released = 0;
+    port->tx_current = NULL;
+
+    if (queued && desc->mark == port->tx.tail) {
+    	// ring caught up with the queued buffer, send it in place
+    	port->tx_current = desc;
+    	span = desc->data;
+    	len = desc->len;
+    } else {
+    	// keep ring data behind the buffer queued before it
+    	if (queued && len > desc->mark - port->tx.tail) len = desc->mark - port->tx.tail;
+    	if (!len) {
+    		port->tx_busy_us += usTimerRead() - port->tx_burst_us;
+    		port->tx_busy = 0; // ISR can not be interrupted by the writer, no data is missed
+    		return;
+    	}
+    	// contiguous part, wrapped rest follows from the completion callback
+    	if (len > 0xFFFF) len = 0xFFFF;
+    }
+    port->tx_len = len;
+
+    if (uartTxBegin(port, span, port->tx_len) != HAL_OK) {
+#ifdef USING_LOG
+    	LOG(LOG_ERROR, MOD_UART, "uart tx start failed");
 #endif
+    	port->tx_busy = 0; // retried on next write
+    }
+}
 
-void uartStartTx(void) {
-#ifdef USING_UART_DMA
-    // 1) only start if DMA is idle and there's data
-    if (HAL_DMA_GetState(&USING_UART_DMA) != HAL_DMA_STATE_READY) return;
-    if (USING_UART.gState != HAL_UART_STATE_READY) return;
+void uartStartTx(uartPort* port) {
+	if (uartPortOf(port->huart) != port) return; // not open yet, data waits in the ring
 
-    if (tx_head == tx_tail) return;
+    // idle -> busy, only one side may start a transfer
+    if (__atomic_exchange_n(&port->tx_busy, 1, __ATOMIC_ACQUIRE)) return;
+    port->tx_burst_us = usTimerRead();
+    uartTxNext(port);
+}
 
-    // 2) calculate contiguous chunk
-    uint16_t len = (tx_head > tx_tail) ? (tx_head - tx_tail) : (TX_DMA_BUFFER_SIZE - tx_tail);
+// copies what fits, the TX interrupt is the only consumer so no irq masking
+int uartWrite(uartPort* port, const uint8_t* data, uint16_t len) {
+	uint32_t taken = ringWrite(&port->tx, data, len);
 
-    // 3) remember length and kick off DMA
-    tx_dma_len = len;
-//    HAL_UART_StateTypeDef prev = huart3.gState;
-    //HAL_StatusTypeDef  ret  =
-    if (!HAL_UART_Transmit_DMA(&USING_UART, &tx_buf[tx_tail], len) == HAL_OK) {
-    	printf("DMA Failed\n");
-    }
+	uartStartTx(port);
+	return taken;
+}
 
+// queue a buffer for sending without copy, it must stay untouched until done(data) is called
+int uartSend(uartPort* port, const uint8_t* data, uint16_t len, uartTxDone done) {
+	if (!len) return 0;
+	if ((uint8_t)(port->tx_desc_head - port->tx_desc_tail) >= UART_TX_DESC_LIMIT) return UART_OVERFLOW;
 
-#endif
+	uartTxDesc* desc = &port->tx_desc[port->tx_desc_head % UART_TX_DESC_LIMIT];
+	desc->data = data;
+	desc->len = len;
+	desc->done = done;
+	desc->mark = port->tx.head;
+	__atomic_store_n(&port->tx_desc_head, port->tx_desc_head + 1, __ATOMIC_RELEASE);
+
+	uartStartTx(port);
+	return 0;
 }
 
-// DMA transmit complete callback
-#ifdef USING_UART_DMA
+// DMA: first half is on the wire, give it back to the writer while the second half goes out
+void HAL_UART_TxHalfCpltCallback(UART_HandleTypeDef *huart) {
+    uartPort* port = uartPortOf(huart);
+    if (!port || port->tx_current) return;
+    uint32_t startedAt = usTimerRead();
 
-void HAL_UART_TxHalfCpltCallback(UART_HandleTypeDef *huart) { //HAL_UART_TxCpltCallback
-    if (huart != &USING_UART) return;
+    port->tx_released = port->tx_len / 2;
+    ringSkip(&port->tx, port->tx_released);
+    port->tx_irq_us += usTimerRead() - startedAt;
+}
 
-    // 4) advance tail by exactly what we sent
-    tx_tail = (tx_tail + tx_dma_len) % TX_DMA_BUFFER_SIZE;
+// transfer in flight is over, its ring bytes or buffer go back to the writer
+static void uartTxRelease(uartPort* port) {
+    if (port->tx_current) {
+    	uartTxDesc* desc = port->tx_current;
+    	port->tx_desc_tail++;
+    	if (desc->done) desc->done(desc->data);
+    } else {
+    	ringSkip(&port->tx, port->tx_len - port->tx_released);
+    }
+}
 
-    // 5) start next chunk, if any
-    uartStartTx();
+// whole transfer done (TC), account the rest and chain the next one
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    uartPort* port = uartPortOf(huart);
+    if (!port) return;
+    uint32_t startedAt = usTimerRead();
+
+    uartTxRelease(port);
+    port->tx_bytes += port->tx_len;
+    port->tx_chunks++;
+    uartTxNext(port);
+    port->tx_irq_us += usTimerRead() - startedAt;
+}
+
+// where the DMA writes next, unpublished bytes after a restart included
+static inline uint32_t uartRxDmaAt(uartPort* port) {
+	return port->rx_resync == UART_RX_RESTART ? port->rx_restart + port->rx_held : port->rx.head;
+}
+
+static void uartRxStart(uartPort* port) {
+	if (port->flags & UART_RX_DMA) {
+		uint32_t at = uartRxDmaAt(port);
+
+	    // DMA restarts at the beginning of the buffer, the head stays until the consumer is there
+		port->rx_restart = at + ((ringSize(&port->rx) - (at & port->rx.mask)) & port->rx.mask);
+		port->rx_held = 0;
+		port->rx_resync = UART_RX_RESTART;
+	    HAL_UARTEx_ReceiveToIdle_DMA(port->huart, port->rx.buf, ringSize(&port->rx));
+	} else {
+		HAL_UART_Receive_IT(port->huart, &port->rx_byte, 1);
+	}
 }
-#endif
 
-// in stm32xx_it.c
+// one byte interrupt reception
 void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart) {
-  if (huart == &USING_UART) {
-    uartReceiveBuffer(&uart_rx_byte, 1);
-    HAL_UART_Receive_IT(&USING_UART, &uart_rx_byte, 1);
-  }
+	uartPort* port = uartPortOf(huart);
+	if (!port) return;
+
+	port->rx_irqs++;
+	uartReceiveBuffer(port, &port->rx_byte, 1);
+	HAL_UART_Receive_IT(huart, &port->rx_byte, 1);
+}
+
+// circular DMA: half, full and idle line events, pos is the DMA write index (buffer size on full)
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t pos) {
+    uartPort* port = uartPortOf(huart);
+    if (!port) return;
+
+    uint32_t fresh = (pos - uartRxDmaAt(port)) & port->rx.mask;
+    uint32_t unread = ringUsed(&port->rx);
+
+    port->rx_irqs++;
+    port->rx_bytes += fresh;
+    if (port->rx_resync == UART_RX_RESTART) {
+    	// after a restart, held back until the consumer has moved to the restart point
+    	port->rx_held += fresh;
+    	if (port->rx_held >= ringSize(&port->rx)) {
+    		port->rx_overflows++;
+    		port->rx_restart += port->rx_held;
+    		port->rx_held = 0;
+    		onUartError(UART_OVERFLOW);
+    	}
+    	return;
+    }
+    ringCommit(&port->rx, fresh);
+    if (unread + fresh >= ringSize(&port->rx)) {
+    	// DMA wrote over data the processor has not read yet
+    	port->rx_overflows++;
+    	port->rx_restart = port->rx.head;
+    	port->rx_resync = UART_RX_LOST;
+    	onUartError(UART_OVERFLOW);
+    }
+}
+
+// overrun, framing or noise stops the reception, a DMA error the transfer of its channel
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    uartPort* port = uartPortOf(huart);
+    if (!port) return;
+    onUartError(huart->ErrorCode);
+
+    // transmit channel failed, HAL has ended the transfer: drop it, a retry would fail the same
+    if (port->tx_busy && huart->hdmatx && huart->hdmatx->ErrorCode != HAL_DMA_ERROR_NONE) {
+    	huart->hdmatx->ErrorCode = HAL_DMA_ERROR_NONE; // handled, not seen again on the next RX error
+    	uartTxRelease(port);
+    	port->tx_errors++;
+    	uartTxNext(port);
+    }
+    // noise and framing alone keep the reception going
+    if (huart->RxState == HAL_UART_STATE_READY) uartRxStart(port);
 }
 
+int uartOpen(uartPort* port, uartLineHandler onLine) {
+	uint32_t slot = UART_SLOT(port->huart);
+	if (uartSlots[slot] == port) return 0;
+	if (uartSlots[slot]) return UART_OVERFLOW; // instance already taken
+
+	port->onLine = onLine;
+	ringFlush(&port->rx);
+	port->line_len = 0;
+	port->line_ready = 0;
+	port->next = uartPorts;
+	uartPorts = port;
+	uartSlots[slot] = port;
+	uartRxStart(port);
+
+	if (!taskExists(&uartRxProcessor)) {
+	    tTask* proc = repeat("UART_R_PR", UART_RXPROC_SPEED, &uartRxProcessor);
+	    proc->timeout = 1000 * ST_SS * 30;
+	    proc->runAt+= ST_S10; // start after S10
+	    proc->realtime_fail = ST_SEC * 10;
+	}
+
+	uartStartTx(port); // anything written before open
+	return 0;
+}
+
+void uartClose(uartPort* port) {
+	uartPort** link = &uartPorts;
+	while (*link && *link != port) link = &(*link)->next;
+	if (!*link) return;
 
+	HAL_UART_AbortReceive(port->huart);
+	*link = port->next;
+	uartSlots[UART_SLOT(port->huart)] = NULL;
+}
 
 // init UART “console”
 void uartInit(uint32_t msg) {
-    // prime the RX interrupt (should already be set once in MX_..._Init)
-    HAL_UART_Receive_IT(&USING_UART, &uart_rx_byte, 1);
-    // spawn the processor task
-
-    tTask* proc = repeat("UART_R_PR", UART_RXPROC_SPEED, &uartRxProcessor);
-    proc->timeout = 1000 * ST_SS * 30;
-    proc->runAt+= ST_S10; // start after S10
-    proc->realtime_fail = ST_SEC * 10;
+#ifdef USING_RPC
+    uartConsole.rpc = &uartRpc;
+    rpcLinkAdd(&uartRpc);
+#endif
+    // prime the RX interrupt or circular DMA and spawn the processor task
+    uartOpen(&uartConsole, NULL);
 
+    // transmit is interrupt or DMA driven, no task needed
+    outputSinkAdd("uart", &uartSinkWrite, OUT_BLOCK);
 #ifndef USING_UART_DMA
-    proc = repeat("UART_T_PR", UART_TXPROC_SPEED, &uartTxProcessor);
-    proc->timeout = 1000 * ST_SS;
-    proc->realtime_fail = ST_SEC;
-    uartLoaded = 1;
     printf("uart loaded\n");
 #else
-    //USING_UART_DMA.XferHalfCpltCallback = &HAL_UART_TxCpltCallback;
-    //USING_UART_DMA.XferCpltCallback = &HAL_UART_TxCpltCallback;
-    uartLoaded = 1;
     printf("uart DMA loaded\n");
 #endif
 }
 
 // push incoming data into ring buffer
-void uartReceiveBuffer(uint8_t* data, uint16_t len) {
-    for (uint16_t i = 0; i < len; i++) {
-        uint16_t next = (ring_head + 1) % UART_RING_BUFFER_SIZE;
-        if (next != ring_tail) {
-            uart_ring_buf[ring_head] = data[i];
-            ring_head = next;
-        } else {
-            onUartError(UART_OVERFLOW);
-        }
+void uartReceiveBuffer(uartPort* port, uint8_t* data, uint16_t len) {
+    uint32_t taken = ringWrite(&port->rx, data, len);
+
+    port->rx_bytes += taken;
+    if (taken < len) {
+        port->rx_overflows++;
+        onUartError(UART_OVERFLOW);
     }
 }
 
-// parse CR/LF-terminated commands, exec them
-void uartRxProcessor(uint32_t param) {
-    static char local[UART_CMD_BUFFER_SIZE];
-    static uint16_t idx = 0;
-    char name[TASK_NAME_LENGTH+1];
-
-    while (ring_tail != ring_head) {
-        char c = uart_ring_buf[ring_tail];
-        ring_tail = (ring_tail + 1) % UART_RING_BUFFER_SIZE;
-
-        if (c == '\r' || c == '\n') {
-            if (idx > 0) {
-                local[idx] = '\0';
-                strncpy(cmd, local, UART_CMD_BUFFER_SIZE);
-                strncpy(name, cmd, TASK_NAME_LENGTH);
-                exec(name, &onCommand);
-                idx = 0;
-            }
-        } else if (idx < UART_CMD_BUFFER_SIZE - 1) {
-            local[idx++] = c;
-        } else {
-            // overflow, reset
-            idx = 0;
-        }
+static inline int32_t uartReadLine(uartPort* port) {
+#ifdef USING_RPC
+	if (port->rpc) return rpcReadLine(port->rpc, &port->rx, port->line, UART_LINE_SIZE, &port->line_len);
+#endif
+	return ringReadLine(&port->rx, port->line, UART_LINE_SIZE, &port->line_len);
+}
+
+// parse CR/LF-terminated lines of one port, whole spans at a time
+static void uartPortLines(uartPort* port, uint32_t param) {
+    int32_t len = 0; // a console line offered again is read from port->line
+
+    if (port->rx_resync) {
+    	uint32_t primask = __get_PRIMASK();
+    	__disable_irq();
+    	if (port->rx_resync == UART_RX_RESTART) {
+    		// publish what came after the restart, drop everything before it
+    		ringCommit(&port->rx, port->rx_restart + port->rx_held - port->rx.head);
+    		ringSkip(&port->rx, port->rx_restart - port->rx.tail);
+    	} else if ((int32_t)(port->rx_restart - port->rx.tail) > 0) {
+    		ringSkip(&port->rx, port->rx_restart - port->rx.tail);
+    	}
+    	port->rx_resync = 0;
+    	__set_PRIMASK(primask);
+    	port->line_len = 0;
+    }
+
+    while (port->line_ready || (len = uartReadLine(port)) >= 0) {
+    	if (port->onLine) port->onLine(port, port->line, len);
+    	else if (!cmdQueue(port->line)) {
+    		port->line_ready = 1; // console lines queue as commands, full - offered again next pass
+    		return;
+    	}
+    	port->line_ready = 0;
         kernel_process(param);
     }
 }
 
+void uartRxProcessor(uint32_t param) {
+	for (uartPort* port = uartPorts; port; port = port->next) uartPortLines(port, param);
+}
+
 __attribute__((weak)) uint8_t onCommand(uint32_t param) {
 	//setTextColor(YELLOW);
     printf("uart> %s\n", cmd);
@@ -171,31 +342,55 @@ __attribute__((weak)) uint8_t onCommand(uint32_t param) {
 }
 
 __attribute__((weak)) void onUartError(uint32_t flag) {
+#ifdef USING_LOG
+	LOG(LOG_ERROR, MOD_UART, "uart error %lu", flag); // called from UART interrupt
+	return;
+#endif
 	//setTextColor(RED);
     printf("Uart Error %u\n", flag);
 //	setTextColor(DEFAULT_COLOR);
 }
 
 
-int _write(int file, char *data, int len) {
-	uint16_t i;
-	__disable_irq(); // protect head/tail
-	for (i = 0; i < len; i++) {
-	  uint16_t next = (tx_head + 1) % TX_DMA_BUFFER_SIZE;
-	  if (next == tx_tail) {
-		  __enable_irq();
-		  uartStartTx();
-		  return UART_OVERFLOW;
-	  }
-	  tx_buf[tx_head] = data[i];
-	  tx_head = next;
-	}
-	__enable_irq();
+// output sink: takes what fits into console tx_buf, output layer keeps the rest
+static int uartSinkWrite(const uint8_t* data, uint16_t len) {
+	return uartWrite(&uartConsole, data, len);
+}
 
-	if (uartLoaded) uartStartTx();
-	return len;
+#ifdef USING_RPC
+// rpc response goes in whole, between output chunks
+static int uartRpcWrite(const uint8_t* data, uint16_t len) {
+	if (ringFree(&uartConsole.tx) < len) return 0;
+	return uartWrite(&uartConsole, data, len);
 }
+#endif
 
+// achieved transmit rate vs what the baud rate allows (8N1 = 10 bits per byte)
+int uartStats(char* args) {
+	for (uartPort* port = uartPorts; port; port = port->next) {
+		uint32_t baud = port->huart->Init.BaudRate;
+		uint32_t line = baud / 10;
+		uint32_t rate = port->tx_busy_us ? (uint32_t)((uint64_t)port->tx_bytes * 1000000 / port->tx_busy_us) : 0;
+
+		printf("%s (%lu baud%s%s)\n", port->name, baud,
+				port->flags & UART_TX_DMA ? ", tx DMA" : "", port->flags & UART_RX_DMA ? ", rx DMA" : "");
+		printf(" tx: %lu bytes in %lu transfers, %lu dropped on error, busy %lu ms, %u queued buffers\n",
+				port->tx_bytes, port->tx_chunks, port->tx_errors, port->tx_busy_us / 1000,
+				(uint8_t)(port->tx_desc_head - port->tx_desc_tail));
+		printf(" tx: %lu B/s while sending, line max %lu B/s, %lu%%\n",
+				rate, line, line ? rate * 100 / line : 0);
+		printf(" tx: interrupts %lu us, %lu ns per byte\n", port->tx_irq_us,
+				port->tx_bytes ? (uint32_t)((uint64_t)port->tx_irq_us * 1000 / port->tx_bytes) : 0);
+		printf(" rx: %lu bytes, %lu interrupts, %lu per KB, %lu overflows\n", port->rx_bytes, port->rx_irqs,
+				port->rx_bytes ? (uint32_t)((uint64_t)port->rx_irqs * 1024 / port->rx_bytes) : 0, port->rx_overflows);
+
+		if (args && strcmp(args, "reset") == 0) {
+			port->tx_bytes = port->tx_chunks = port->tx_errors = port->tx_busy_us = port->tx_irq_us = 0;
+			port->rx_bytes = port->rx_irqs = port->rx_overflows = 0;
+		}
+	}
+	return 0;
+}
 
 
 
@@ -10,17 +10,24 @@
  *         #define USING_UART huart1*
  *    2. Include this file:
  *         #include "uart.h"
- *    3. In your MX_USARTx_UART_Init (or right after), start RX-IT:
- *         HAL_UART_Receive_IT(&USING_UART, &uart_rx_byte, 1);
- *    4. In your stm32xx_it.c, in HAL_UART_RxCpltCallback:
- *         #ifdef USING_UART
- *             uartReceiveBuffer(&uart_rx_byte, 1);
- *             HAL_UART_Receive_IT(&USING_UART, &uart_rx_byte, 1);
- *         #endif
+ *    3. The driver owns HAL_UART_RxCpltCallback, HAL_UART_TxCpltCallback and friends,
+ *       do not define them in stm32xx_it.c / main.c
+ *
+ *    Without DMA transmit runs on TXE/TC interrupts, enable the USART global interrupt in CubeMX.
+ *    Both keep the line full at 115200 and 921600 (11.5 / 92 KB/s, tests/uart_test), interrupts cost
+ *    one per byte, DMA about 3 per KB.
  *
  *    20.07.2025
  *    USING_UART_DMA hdma_usart2_tx will allow faster output
  *    In this case - make sure __HAL_RCC_DMA1_CLK_ENABLE(); is called before UART initialization, spend a hell lot of effort to figure this out
+ *
+ *    USING_UART_RX_DMA hdma_usart2_rx receives by circular DMA (set the RX channel to circular in CubeMX)
+ *    instead of one interrupt per byte. Half, full and IDLE line events publish the write index.
+ *
+ *    More ports (sensor bus, modem...) run from the same driver, each with its own buffers:
+ *         UART_PORT(modem, huart2, 512, 512, UART_RX_DMA);
+ *         uartOpen(&modem, &onModemLine);   // lines are passed to onModemLine, not the console
+ *         uartWrite(&modem, "AT\r", 3);
  */
 
 #ifndef SYS_UART_H_
@@ -34,37 +41,131 @@
 
 #define UART_OVERFLOW           1    // ring-buffer overflow
 #define UART_RXPROC_SPEED       ST_MS
-#define UART_TXPROC_SPEED    	ST_MS
-#define UART_CMD_BUFFER_SIZE    128
+#define UART_CMD_BUFFER_SIZE    CMD_BUFFER_SIZE
+#ifndef UART_RING_BUFFER_SIZE
+#ifdef USING_UART_RX_DMA
+#define UART_RING_BUFFER_SIZE   1024 // circular DMA target, holds ~90ms at 115200
+#else
 #define UART_RING_BUFFER_SIZE   128
+#endif
+#endif
 #define TX_DMA_BUFFER_SIZE   1024
+#define UART_TX_DESC_LIMIT   4    // zero copy buffers waiting for transmit
+#define UART_PORT_SLOTS      32   // dispatch table, see UART_SLOT
+#define UART_LINE_SIZE       UART_CMD_BUFFER_SIZE
 
+// port flags
+#define UART_TX_DMA          1
+#define UART_RX_DMA          2    // circular, channel must be circular in CubeMX
 
-#define USE_HAL_UART_REGISTER_CALLBACKS 1
+// rx_resync
+#define UART_RX_LOST         1    // DMA wrote over unread data
+#define UART_RX_RESTART      2    // DMA started over at the buffer start, the bytes up to there were never written
 
-extern volatile uint16_t   ring_head;
-extern volatile uint16_t   ring_tail;
-extern char                uart_ring_buf[UART_RING_BUFFER_SIZE];
+// O(1) lookup from HAL handle, peripheral base addresses are 1KB apart and unique in these bits
+#define UART_SLOT(h)         ((((uint32_t)(h)->Instance) >> 10) & (UART_PORT_SLOTS - 1))
 
-extern char                cmd[UART_CMD_BUFFER_SIZE];
+#define USE_HAL_UART_REGISTER_CALLBACKS 1
+
+extern char*               cmd; // line being executed, see cmdQueue
 extern volatile uint8_t    cmdLoaded;
 
+typedef struct uartPort uartPort;
+
+// complete CR/LF terminated line received on a port, called from the processor task
+typedef void (*uartLineHandler)(uartPort* port, char* line, uint16_t len);
+// zero copy buffer is sent, called from the interrupt
+typedef void (*uartTxDone)(const uint8_t* data);
+
+typedef struct {
+	const uint8_t* data;
+	uint16_t       len;
+	uint32_t       mark; // tx.head when queued
+	uartTxDone     done;
+} uartTxDesc;
+
+struct uartPort {
+	const char*         name;
+	UART_HandleTypeDef* huart;
+	uint8_t             flags;
+	uartLineHandler     onLine; // NULL - console commands
+	uartPort*           next;
+
+	// receive ring, with UART_RX_DMA the circular DMA target
+	tRing               rx;
+	volatile uint8_t    rx_resync; // UART_RX_LOST or UART_RX_RESTART, consumer skips to rx_restart
+	volatile uint32_t   rx_restart;
+	volatile uint32_t   rx_held;   // received since a DMA restart, published once the consumer moved there
+	uint8_t             rx_byte;   // one byte interrupt reception
+	char                line[UART_LINE_SIZE];
+	uint16_t            line_len;
+	uint8_t             line_ready; // line waits for room in the command queue
+#ifdef USING_RPC
+	struct rpcLink*     rpc;       // binary frames next to the lines, console port only
+#endif
+
+	// transmit ring, filled by uartWrite, released by the TX interrupt
+	tRing               tx;
+	uartTxDesc          tx_desc[UART_TX_DESC_LIMIT]; // zero copy queue
+	volatile uint8_t    tx_desc_head; // free running
+	volatile uint8_t    tx_desc_tail;
+	volatile uint8_t    tx_busy;      // owned by whoever started the transfer in flight
+	uint16_t            tx_len;
+	uint16_t            tx_released;  // ring bytes already given back on half transfer
+	uartTxDesc*         tx_current;   // zero copy buffer in flight
+
+	// stats, see uartstat
+	uint32_t            tx_bytes;
+	uint32_t            tx_chunks;
+	uint32_t            tx_errors;    // transfers dropped on a DMA error
+	uint32_t            tx_busy_us;
+	uint32_t            tx_burst_us;
+	uint32_t            tx_irq_us;
+	uint32_t            rx_bytes;
+	uint32_t            rx_irqs;
+	uint32_t            rx_overflows;
+};
+
+// static port with its buffers (power of two sizes), open it with uartOpen
+#define UART_PORT(n, h, rxSize, txSize, f) \
+	extern UART_HandleTypeDef h; \
+	_Static_assert(RING_POW2(rxSize) && RING_POW2(txSize), "uart buffers must be a power of two"); \
+	static uint8_t __uart_rx_##n[rxSize]; \
+	static uint8_t __uart_tx_##n[txSize]; \
+	uartPort n = { .name = #n, .huart = &h, .flags = f, \
+		.rx = { __uart_rx_##n, (rxSize) - 1 }, .tx = { __uart_tx_##n, (txSize) - 1 } }
+
 // call once in main() after MX_USARTx_UART_Init()
 void    uartInit(uint32_t msg);
 
-// spawnable task that parses CR/LF-terminated commands
+// start reception on a port, lines go to onLine (NULL - console commands)
+int     uartOpen(uartPort* port, uartLineHandler onLine);
+void    uartClose(uartPort* port);
+
+// spawnable task that parses CR/LF-terminated lines of all ports
 void    uartRxProcessor(uint32_t param);
-void    uartTxProcessor(uint32_t param);
 
-// called from IRQ callback to push incoming bytes
-void    uartReceiveBuffer(uint8_t* data, uint16_t len);
+// copies what fits into the transmit ring, returns bytes taken
+int     uartWrite(uartPort* port, const uint8_t* data, uint16_t len);
+
+// transmit is started by writes and chained in HAL_UART_TxCpltCallback
+// with DMA the first half of each transfer is released on HAL_UART_TxHalfCpltCallback
+void    uartStartTx(uartPort* port);
+
+// send a large buffer in place (no copy), in order with ring data. done runs from the interrupt
+int     uartSend(uartPort* port, const uint8_t* data, uint16_t len, uartTxDone done);
+
+// push incoming bytes from outside the driver
+void    uartReceiveBuffer(uartPort* port, uint8_t* data, uint16_t len);
+
+int    uartStats(char* args);
+
+// console port on USING_UART
+extern uartPort uartConsole;
 
 __attribute__((weak)) uint8_t onCommand(uint32_t param);
 __attribute__((weak)) void    onUartError(uint32_t flag);
 
-// can we send? (non-blocking check)
-int     uartCanWrite(void);
-
 #endif /* USING_UART */
 
 #endif /* SYS_UART_H_ */
@@ -15,12 +15,47 @@
 extern USBD_HandleTypeDef hUsbDeviceFS;
 int usbProcessorSpeed = USB_PROCESSOR_SPEED;
 
-volatile uint16_t ring_head;
-volatile uint16_t ring_tail;
-char usb_ring_buf[USB_RING_BUFFER_SIZE];
+RING(usbRx, USB_RING_BUFFER_SIZE); // filled from the USB interrupt
+_Static_assert(USB_RING_BUFFER_SIZE >= 2 * USB_RX_PACKET_SIZE, "USB_RING_BUFFER_SIZE below two packets");
+static uint8_t* volatile usbRxHeld = NULL; // OUT buffer not re-armed yet, host is NAKed meanwhile
+static uint32_t usbRxHeldAt;
+static uint32_t usbRxBytes, usbRxPackets, usbRxHolds, usbRxHoldMaxMs;
+static char usbLine[USB_CMD_BUFFER_SIZE];
+static uint16_t usbLineLen = 0;
+static uint8_t usbLineReady = 0; // usbLine is complete, waiting for room in the command queue
+
+static uint32_t usbStartedAt;
+
+RING(usbTx, USB_TX_RING_SIZE); // packed output, CDC sends straight from it
+static volatile uint8_t usbTxBusy = 0;      // owned by whoever started the transfer in flight
+static volatile uint16_t usbTxInflight = 0; // ring bytes + 1 handed to CDC, 1 - zero length packet
+static volatile uint8_t usbTxFlushReq = 0;
+#if USB_TX_ZLP
+static uint8_t usbTxZlpDue = 0;             // last transfer ended on a packet boundary
+#endif
+static uint32_t usbTxSince;                 // oldest unsent byte arrived at
+static uint32_t usbTxStartedUs;
+
+// stats, see usbstat
+static uint32_t usbTxBytes, usbTxTransfers, usbTxPackets, usbTxZlps, usbTxBusyUs;
+static uint32_t usbTxOnFull, usbTxOnTimer, usbTxOnFlush, usbTxRefused, usbTxPeak;
+static uint32_t usbTxRateBytes, usbTxRateTick; // for throughput between stats calls
+
+static int usbSinkWrite(const uint8_t* data, uint16_t len);
 
-char cmd[USB_CMD_BUFFER_SIZE];
-volatile uint8_t cmdLoaded;
+#ifdef USING_CONSOLE
+CONSOLE_CMD(usbstat, usbStats);
+#endif
+
+#ifdef USING_RPC
+// rpc frame goes into the ring whole and is sent right away
+_Static_assert(RPC_WIRE_SIZE <= USB_TX_RING_SIZE, "rpc frame must fit USB_TX_RING_SIZE");
+static int usbRpcWrite(const uint8_t* data, uint16_t len);
+static rpcLink usbRpc = { .name = "usb", .write = &usbRpcWrite };
+#endif
+
+// ready once host configures the port or USB_READY_TIMEOUT passes
+MODULE(usb, MOD_USB, 0, MF_ASYNC, &usbInit);
 
 // init usb CDC
 void usbInit(uint32_t msg) {
@@ -29,55 +64,89 @@ void usbInit(uint32_t msg) {
 	tTask* proc = repeat("USB_PROC",usbProcessorSpeed, &usbProcessor);
 	proc->timeout = 1000 * ST_SS * 30;
 	proc->realtime_fail = ST_SEC;
+	usbStartedAt = uwTick;
+	usbTxRateTick = uwTick;
+	outputSinkAdd("usb", &usbSinkWrite, OUT_BLOCK);
+#ifdef USING_RPC
+	rpcLinkAdd(&usbRpc);
+#endif
 
 	printf("usb loaded\n");
 }
 
+static void usbRxArm(uint8_t* buf) {
+	USBD_CDC_SetRxBuffer(&hUsbDeviceFS, buf);
+	USBD_CDC_ReceivePacket(&hUsbDeviceFS);
+}
+
 // add as first line in CDC_Receive_FS in usbd_cdc_if.c
 void usbReceiveBuffer(uint8_t* Buf, uint32_t *Len) {
-    for (uint32_t i = 0; i < *Len; i++) {
-        uint16_t next_head = (ring_head + 1) % USB_RING_BUFFER_SIZE;
-
-        // Check for overflow
-        if (next_head != ring_tail) {
-            usb_ring_buf[ring_head] = Buf[i];
-            ring_head = next_head;
-        } else onUsbError(USB_OVERFLOW);
+    usbRxBytes += *Len;
+    usbRxPackets++;
+    // only with a CDC_Receive_FS that re-arms on its own
+    if (ringWrite(&usbRx, Buf, *Len) < *Len) onUsbError(USB_OVERFLOW);
+
+    // flow control: next packet must fit, otherwise the processor re-arms once lines are taken
+    if (ringFree(&usbRx) >= USB_RX_PACKET_SIZE) {
+    	usbRxArm(Buf);
+    } else {
+    	usbRxHolds++;
+    	usbRxHeldAt = uwTick;
+    	usbRxHeld = Buf;
     }
 }
 
+// endpoint is not armed while held, so the interrupt can't race us here
+static void usbRxResume(void) {
+	uint8_t* buf = usbRxHeld;
+
+	if (!buf || ringFree(&usbRx) < USB_RX_PACKET_SIZE) return;
+	if (uwTick - usbRxHeldAt > usbRxHoldMaxMs) usbRxHoldMaxMs = uwTick - usbRxHeldAt;
+	usbRxHeld = NULL;
+	usbRxArm(buf);
+}
+
+static void usbTxKick(void);
+
+static inline int32_t usbReadLine(void) {
+#ifdef USING_RPC
+	return rpcReadLine(&usbRpc, &usbRx, usbLine, USB_CMD_BUFFER_SIZE, &usbLineLen);
+#else
+	return ringReadLine(&usbRx, usbLine, USB_CMD_BUFFER_SIZE, &usbLineLen);
+#endif
+}
+
 void usbProcessor(uint32_t param) {
-    static char local_cmd_buf[USB_CMD_BUFFER_SIZE];
-    static uint16_t cmd_index = 0;
-    char name[TASK_NAME_LENGTH+1];
-
-    while (ring_tail != ring_head) {
-        char c = usb_ring_buf[ring_tail];
-        ring_tail = (ring_tail + 1) % USB_RING_BUFFER_SIZE;
-
-        if (c == '\r' || c == '\n') {
-            if (cmd_index > 0) {
-                local_cmd_buf[cmd_index] = '\0';
-                strncpy(cmd, local_cmd_buf, USB_CMD_BUFFER_SIZE);
-                strncpy(name, cmd, TASK_NAME_LENGTH);
-                exec(name, &onCommand);
-                cmd_index = 0;
-            }
-        } else if (cmd_index < USB_CMD_BUFFER_SIZE - 1) {
-            local_cmd_buf[cmd_index++] = c;
-        } else {
-            cmd_index = 0;  // overflow reset
-        }
-        // allow realtime
+    USBD_CDC_HandleTypeDef* hcdc = (USBD_CDC_HandleTypeDef*)hUsbDeviceFS.pClassData;
+
+    if (!moduleIsReady(MOD_USB) && (usbCanWrite() || uwTick - usbStartedAt > USB_READY_TIMEOUT))
+    	moduleReady(MOD_USB);
+
+    // transmit complete without the CDC_TransmitCplt_FS hook, or the host went away mid transfer
+    if (usbTxInflight && (!usbCanWrite() || (hcdc && hcdc->TxState == 0))) usbTransmitComplete();
+    usbTxKick(); // timed flush
+
+    while (usbLineReady || usbReadLine() >= 0) {
+        // queue full: the line waits here, the ring fills and holds the host off
+        usbLineReady = !cmdQueue(usbLine);
+        if (usbLineReady) break;
+        usbRxResume();
+        // allow realtime, once per line
         kernel_process(param); // provide depth to avoid too many unfinished tasks
     }
+    usbRxResume();
 }
 
 __attribute__((weak))  uint8_t onCommand(uint32_t param) {
 	printf("\x1b[33musb> %s\x1b[0m\n", cmd);
+	return 0;
 }
 
 __attribute__((weak))  void onUsbError(uint32_t flag) {
+#ifdef USING_LOG
+	LOG(LOG_ERROR, MOD_USB, "usb error %lu", flag); // called from USB interrupt
+	return;
+#endif
 	printf("\x1b[31mUsb Error %i\x1b[0m\n", flag);
 }
 
@@ -133,17 +202,142 @@ int usbCanWrite() {
 
 uint8_t CDC_Transmit_FS(uint8_t* Buf, uint16_t Len);
 
-// implementation of console write for printf(...). Not included in console for debug purposes, even if you do not need a console, printf works.
-int _write(int file, char *data, int len)
-{
+// start the next transfer when a full packet is waiting, the oldest byte waited long enough
+// or a flush was asked for. Runs from the task and from the transmit complete interrupt.
+static void usbTxKick(void) {
+	const uint8_t* span;
+	uint32_t len, used;
+
+	if (__atomic_exchange_n(&usbTxBusy, 1, __ATOMIC_ACQUIRE)) return;
+
+	used = ringUsed(&usbTx);
+	len = ringSpan(&usbTx, &span);
+	if (!len) {
+		usbTxFlushReq = 0;
+#if USB_TX_ZLP
+		// burst ended on a packet boundary, host needs a short packet to see the end
+		if (usbTxZlpDue && usbCanWrite()) {
+			usbTxZlpDue = 0;
+			usbTxInflight = 1;
+			if (CDC_Transmit_FS((uint8_t*)span, 0) == USBD_OK) {
+				usbTxZlps++;
+				usbTxPackets++;
+				return;
+			}
+			usbTxInflight = 0;
+		}
+#endif
+		__atomic_store_n(&usbTxBusy, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (used >= USB_TX_PACKET_SIZE) {
+		// whole packets only, the tail waits for more output
+		if (len > USB_TX_MAX_TRANSFER) len = USB_TX_MAX_TRANSFER;
+		if (len >= USB_TX_PACKET_SIZE) len -= len % USB_TX_PACKET_SIZE;
+		usbTxOnFull++;
+	} else if (usbTxFlushReq) {
+		usbTxOnFlush++;
+	} else if (uwTick - usbTxSince >= USB_TX_FLUSH_DELAY) {
+		usbTxOnTimer++;
+	} else {
+		__atomic_store_n(&usbTxBusy, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	usbTxInflight = len + 1;
+	usbTxStartedUs = usTimerRead();
+	if (CDC_Transmit_FS((uint8_t*)span, len) != USBD_OK) {
+		usbTxInflight = 0;
+		__atomic_store_n(&usbTxBusy, 0, __ATOMIC_RELEASE);
+		return;
+	}
+	usbTxBytes += len;
+	usbTxTransfers++;
+	usbTxPackets += (len + USB_TX_PACKET_SIZE - 1) / USB_TX_PACKET_SIZE;
+#if USB_TX_ZLP
+	usbTxZlpDue = len % USB_TX_PACKET_SIZE == 0;
+#else
+	// the CDC class follows a transfer of whole packets with a zero length packet itself
+	if (len % USB_TX_PACKET_SIZE == 0) {
+		usbTxZlps++;
+		usbTxPackets++;
+	}
+#endif
+}
+
+void usbTransmitComplete(void) {
+	uint16_t done = __atomic_exchange_n(&usbTxInflight, 0, __ATOMIC_ACQ_REL);
+
+	if (!done) return; // already handled by the other side
+	usbTxBusyUs += usTimerRead() - usbTxStartedUs;
+	if (usbCanWrite()) ringSkip(&usbTx, done - 1);
+	else ringFlush(&usbTx); // host is gone, nobody reads the rest
+	__atomic_store_n(&usbTxBusy, 0, __ATOMIC_RELEASE);
+	usbTxKick();
+}
+
+void usbFlush(void) {
+	usbTxFlushReq = 1;
+	usbTxKick();
+}
+
+// output sink: copies what fits into the packing ring
+static int usbSinkWrite(const uint8_t* data, uint16_t len) {
+	uint32_t taken;
+
     if (!usbCanWrite()) {
-        return 0;  // USB not ready
+        return -1;  // USB not ready, discard
     }
+    // nothing waiting apart from the transfer in flight, timer starts now
+    if (ringUsed(&usbTx) <= (uint32_t)(usbTxInflight ? usbTxInflight - 1 : 0)) usbTxSince = uwTick;
+    taken = ringWrite(&usbTx, data, len);
+    if (taken < len) usbTxRefused++;
+    if (ringUsed(&usbTx) > usbTxPeak) usbTxPeak = ringUsed(&usbTx);
+    usbTxKick();
+    return taken;
+}
+
+#ifdef USING_RPC
+// whole frame or nothing, responses do not wait for the flush timer
+static int usbRpcWrite(const uint8_t* data, uint16_t len) {
+	if (!usbCanWrite()) return -1;
+	if (ringFree(&usbTx) < len) return 0;
+	usbSinkWrite(data, len);
+	usbFlush();
+	return len;
+}
+#endif
 
-	while (CDC_Transmit_FS((uint8_t*)data, len) == USBD_BUSY) {
-		kernel_process(1); // TODO! depth required
+// packets per KB and throughput since the last call, receive flow control
+int usbStats(char* args) {
+	uint32_t elapsed = uwTick - usbTxRateTick;
+
+	printf("usb tx: %lu bytes, %lu transfers, %lu packets (%lu zero length)\n",
+			(unsigned long)usbTxBytes, (unsigned long)usbTxTransfers,
+			(unsigned long)usbTxPackets, (unsigned long)usbTxZlps);
+	printf(" %lu packets per KB, %lu bytes per packet\n",
+			(unsigned long)(usbTxBytes ? (uint64_t)usbTxPackets * 1024 / usbTxBytes : 0),
+			(unsigned long)(usbTxPackets ? usbTxBytes / usbTxPackets : 0));
+	printf(" %lu B/s, %lu B/s while sending\n",
+			(unsigned long)(elapsed ? (uint64_t)(usbTxBytes - usbTxRateBytes) * ST_SEC / elapsed : 0),
+			(unsigned long)(usbTxBusyUs ? (uint64_t)usbTxBytes * 1000000 / usbTxBusyUs : 0));
+	printf(" sent on full packet %lu, timer %lu, flush %lu\n",
+			(unsigned long)usbTxOnFull, (unsigned long)usbTxOnTimer, (unsigned long)usbTxOnFlush);
+	printf(" ring %lu/%u bytes, peak %lu, full %lu times\n",
+			(unsigned long)ringUsed(&usbTx), USB_TX_RING_SIZE, (unsigned long)usbTxPeak, (unsigned long)usbTxRefused);
+	printf("usb rx: %lu bytes, %lu packets, ring %lu/%u, host held off %lu times (longest %lu ms)%s\n",
+			(unsigned long)usbRxBytes, (unsigned long)usbRxPackets, (unsigned long)ringUsed(&usbRx),
+			USB_RING_BUFFER_SIZE, (unsigned long)usbRxHolds, (unsigned long)usbRxHoldMaxMs, usbRxHeld ? ", held now" : "");
+
+	if (args && strcmp(args, "reset") == 0) {
+		usbTxBytes = usbTxTransfers = usbTxPackets = usbTxZlps = usbTxBusyUs = 0;
+		usbTxOnFull = usbTxOnTimer = usbTxOnFlush = usbTxRefused = usbTxPeak = 0;
+		usbRxBytes = usbRxPackets = usbRxHolds = usbRxHoldMaxMs = 0;
 	}
-    return len;
+	usbTxRateBytes = usbTxBytes;
+	usbTxRateTick = uwTick;
+	return 0;
 }
 
 
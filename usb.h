@@ -8,11 +8,20 @@
  *
  *      1. Implement CDC on ioc file
  *      2. Define USING_USB
- *      3. Add usbReceiveBuffer as first line in CDC_Receive_FS in usbd_cdc_if.c
+ *      3. Add usbReceiveBuffer as first line in CDC_Receive_FS in usbd_cdc_if.c, it re-arms
+ *         the OUT endpoint itself once the ring has room (host is NAKed meanwhile, nothing is lost)
  *      #ifdef USING_USB
   	  	  	  usbReceiveBuffer(Buf, Len);
+  	  	  	  return (USBD_OK);
+		#endif
+ *      4. Add usbTransmitComplete to CDC_TransmitCplt_FS in usbd_cdc_if.c (without it the
+ *         processor task notices finished transfers, up to 1ms later)
+ *      #ifdef USING_USB
+  	  	  	  usbTransmitComplete();
 		#endif
  *
+ *      Output is packed into full 64 byte packets, the rest goes out once it waited
+ *      USB_TX_FLUSH_DELAY or on usbFlush(). See usbstat for packets per KB.
  */
 
 #ifndef SYS_USB_H_
@@ -32,21 +41,35 @@
 	#define USB_OVERFLOW 1 // ring buffer too small
 
 	#define	USB_PROCESSOR_SPEED ST_MS
-
-	#define USB_CMD_BUFFER_SIZE 128
-	#define USB_RING_BUFFER_SIZE 128
-
-
-	extern volatile uint16_t ring_head;
-	extern volatile uint16_t ring_tail;
-	extern char usb_ring_buf[USB_RING_BUFFER_SIZE];
-
-	extern char cmd[USB_CMD_BUFFER_SIZE];
+	#define USB_READY_TIMEOUT ST_SEC // boot goes on without host after this
+
+	#define USB_CMD_BUFFER_SIZE CMD_BUFFER_SIZE
+	#ifndef USB_RING_BUFFER_SIZE
+	#define USB_RING_BUFFER_SIZE 1024 // power of two, at least two packets, more for faster uploads
+	#endif
+	#define USB_RX_PACKET_SIZE CDC_DATA_FS_MAX_PACKET_SIZE // endpoint is armed only with this much room
+	#define USB_TX_RING_SIZE 1024 // power of two, output waiting for the IN endpoint, sent in place
+	#define USB_TX_PACKET_SIZE 64 // full speed bulk max packet
+	#define USB_TX_MAX_TRANSFER 512 // packets per CDC_Transmit_FS call, ring space is held until complete
+	#define USB_TX_FLUSH_DELAY (ST_MS * 2) // partial packet waits this long for more output
+	#ifndef USB_TX_ZLP
+	// zero length packet after a transfer of whole packets: USBD_CDC_DataIn sends it since the
+	// ST middleware that has CDC_TransmitCplt_FS (v2.5), older middleware needs 1 here
+	#define USB_TX_ZLP 0
+	#endif
+
+
+	extern tRing usbRx;
+
+	extern char* cmd; // line being executed, see cmdQueue
 	extern volatile uint8_t cmdLoaded;
 
 	void usbInit(uint32_t);
 	void usbProcessor(uint32_t param);
-	void usbReceiveBuffer(uint8_t* Buf, uint32_t *Len);
+	void usbReceiveBuffer(uint8_t* Buf, uint32_t *Len); // from CDC_Receive_FS, re-arms the endpoint
+	void usbTransmitComplete(void); // from CDC_TransmitCplt_FS
+	void usbFlush(void); // send partial packet now
+	int usbStats(char* args);
 	__attribute__((weak))  uint8_t onCommand(uint32_t);
 	__attribute__((weak))  void onUsbError(uint32_t);
 